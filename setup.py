@@ -24,7 +24,7 @@ ext_modules = [
             "-std=c++11",
             "-O3"
         ],
-        libraries=["vips-cpp", "vips", "gio-2.0", "gobject-2.0", "glib-2.0"],
+        libraries=["vips-cpp", "vips", "gio-2.0", "gobject-2.0", "glib-2.0", "z"],
     ),
 ]
 
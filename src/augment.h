@@ -0,0 +1,463 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "rng.h"
+#include "deinterleave.h"
+#include "convert.h"
+
+/**
+ * @brief Random augmentation of an env's observations, drawn for every glimpse.
+ *
+ * Flips and rotations compose into one of the 8 symmetries of the square
+ * (rotations need square views); brightness and contrast jitter pixel values
+ * around mid-grey.
+ */
+struct AugmentSpec
+{
+    float flip_x = 0.0f;      ///< Probability of a horizontal flip
+    float flip_y = 0.0f;      ///< Probability of a vertical flip
+    float rot90 = 0.0f;       ///< Probability of a rotation by 90, 180 or 270 degrees (uniform)
+    float brightness = 0.0f;  ///< Offset drawn from [-brightness, brightness], in [0, 1] units
+    float contrast = 0.0f;    ///< Gain drawn from [1 - contrast, 1 + contrast]
+    bool per_channel = false; ///< Draw brightness and contrast for every channel instead of once
+
+    /**
+     * @brief Whether the spec changes any observation.
+     */
+    bool any(void) const
+    {
+        return flip_x > 0 || flip_y > 0 || rot90 > 0 || brightness > 0 || contrast > 0;
+    }
+};
+
+/**
+ * @brief One draw of an AugmentSpec: how the glimpse being copied is remapped.
+ *
+ * Source pixel (y, x) of an H x W crop lands at (a, b) = transpose ? (x, y) :
+ * (y, x), mirrored to H - 1 - a if flip_y and to W - 1 - b if flip_x. Values
+ * go through lut, 256 entries per channel, when jitter is set.
+ */
+struct Augment
+{
+    static const int block = 16; ///< Rows a transposed copy stages before writing them out as runs of output rows
+
+    bool transpose = false;   ///< Swap rows and columns (square views only)
+    bool flip_x = false;      ///< Mirror the output columns
+    bool flip_y = false;      ///< Mirror the output rows
+    bool jitter = false;      ///< Map values through lut
+    std::vector<uint8_t> lut; ///< [channels][256] value map, see jitter_value()
+    std::vector<uint16_t> gain; ///< Per channel: contrast in Q14
+    std::vector<int16_t> bias;  ///< Per channel: offset in Q6, rounding included
+
+    /**
+     * @brief Whether the draw changes the observation.
+     */
+    bool active(void) const
+    {
+        return transpose || flip_x || flip_y || jitter;
+    }
+
+    /**
+     * @brief Draw the transform of the next glimpse from `rng`.
+     *
+     * @param spec What to draw.
+     * @param rng Stream of the env.
+     * @param channels Channels of the observation.
+     */
+    void draw(const AugmentSpec &spec, Rng &rng, const int channels)
+    {
+        // rotations by 90/180/270 degrees, then flips on top: all 8 symmetries
+        const uint32_t k = spec.rot90 > 0 && rng.uniform() < spec.rot90 ? 1 + rng.below(3) : 0;
+        transpose = k == 1 || k == 3;
+        flip_x = k == 1 || k == 2;
+        flip_y = k == 2 || k == 3;
+        if (spec.flip_x > 0 && rng.uniform() < spec.flip_x)
+        {
+            flip_x = !flip_x;
+        }
+        if (spec.flip_y > 0 && rng.uniform() < spec.flip_y)
+        {
+            flip_y = !flip_y;
+        }
+
+        jitter = spec.brightness > 0 || spec.contrast > 0;
+        if (!jitter)
+        {
+            return;
+        }
+        lut.resize(static_cast<std::size_t>(channels) * 256);
+        gain.resize(channels);
+        bias.resize(channels);
+        float offset = 0.0f, g = 1.0f;
+        for (int c = 0; c < channels; ++c)
+        {
+            if (c == 0 || spec.per_channel)
+            {
+                offset = (rng.uniform() * 2 - 1) * std::min(1.0f, spec.brightness) * 255.0f;
+                g = 1.0f + (rng.uniform() * 2 - 1) * std::min(1.0f, spec.contrast);
+            }
+            // (x - 127.5) * g + 127.5 + offset, in fixed point
+            gain[c] = static_cast<uint16_t>(std::lround(g * 16384.0f));
+            bias[c] = static_cast<int16_t>(std::lround((127.5f * (1.0f - g) + offset) * 64.0f) + 32);
+            uint8_t *t = lut.data() + c * 256;
+            for (int x = 0; x < 256; ++x)
+            {
+                t[x] = jitter_value(static_cast<uint8_t>(x), gain[c], bias[c]);
+            }
+        }
+    }
+
+    /**
+     * @brief Jittered value of `x`: (x * gain >> 8) + bias, saturated to int16, >> 6, clamped to uint8.
+     *
+     * Defined by the operations of the SIMD kernels so they match the LUT exactly.
+     */
+    static uint8_t jitter_value(const uint8_t x, const uint16_t gain, const int16_t bias)
+    {
+        const int s = std::min(32767, ((x * gain) >> 8) + bias) >> 6;
+        return static_cast<uint8_t>(std::min(255, std::max(0, s)));
+    }
+};
+
+/**
+ * @brief Jitter `n` values of `row` in place, see Augment::jitter_value().
+ *
+ * The scalar kernel maps through the channel's 256-entry table; the SIMD
+ * kernels compute the same fixed-point affine map 16 or 32 bytes at a time.
+ */
+typedef void (*jitter_fn)(uint8_t *row, int n, const uint8_t *lut, uint16_t gain, int16_t bias);
+
+inline void jitter_scalar(uint8_t *row, const int n, const uint8_t *lut, const uint16_t, const int16_t)
+{
+    int x = 0;
+    for (; x + 4 <= n; x += 4)
+    {
+        const uint8_t a = lut[row[x]], b = lut[row[x + 1]], c = lut[row[x + 2]], d = lut[row[x + 3]];
+        row[x] = a, row[x + 1] = b, row[x + 2] = c, row[x + 3] = d;
+    }
+    for (; x < n; ++x)
+    {
+        row[x] = lut[row[x]];
+    }
+}
+
+#ifdef VIPSENV_X86
+
+__attribute__((target("sse2"))) inline void jitter_sse2(uint8_t *row, const int n, const uint8_t *lut, const uint16_t gain, const int16_t bias)
+{
+    const __m128i z = _mm_setzero_si128(), g = _mm_set1_epi16(static_cast<int16_t>(gain)), b = _mm_set1_epi16(bias);
+    int x = 0;
+    for (; x + 16 <= n; x += 16)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + x));
+        // x << 8 in each 16-bit lane, so mulhi gives x * gain >> 8
+        const __m128i lo = _mm_srai_epi16(_mm_adds_epi16(_mm_mulhi_epu16(_mm_unpacklo_epi8(z, v), g), b), 6);
+        const __m128i hi = _mm_srai_epi16(_mm_adds_epi16(_mm_mulhi_epu16(_mm_unpackhi_epi8(z, v), g), b), 6);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(row + x), _mm_packus_epi16(lo, hi));
+    }
+    jitter_scalar(row + x, n - x, lut, gain, bias);
+}
+
+__attribute__((target("avx2"))) inline void jitter_avx2(uint8_t *row, const int n, const uint8_t *lut, const uint16_t gain, const int16_t bias)
+{
+    const __m256i z = _mm256_setzero_si256(), g = _mm256_set1_epi16(static_cast<int16_t>(gain)), b = _mm256_set1_epi16(bias);
+    int x = 0;
+    for (; x + 32 <= n; x += 32)
+    {
+        // unpack and pack both work within 128-bit lanes, so the byte order survives
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + x));
+        const __m256i lo = _mm256_srai_epi16(_mm256_adds_epi16(_mm256_mulhi_epu16(_mm256_unpacklo_epi8(z, v), g), b), 6);
+        const __m256i hi = _mm256_srai_epi16(_mm256_adds_epi16(_mm256_mulhi_epu16(_mm256_unpackhi_epi8(z, v), g), b), 6);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(row + x), _mm256_packus_epi16(lo, hi));
+    }
+    jitter_sse2(row + x, n - x, lut, gain, bias);
+}
+
+#endif // VIPSENV_X86
+
+/**
+ * @brief Pick the jitter kernel for `level`.
+ */
+inline jitter_fn select_jitter(const SimdLevel level = simd_level())
+{
+#ifdef VIPSENV_X86
+    if (level == SimdLevel::AVX2)
+        return jitter_avx2;
+    if (level != SimdLevel::SCALAR)
+        return jitter_sse2;
+#else
+    (void)level;
+#endif
+    return jitter_scalar;
+}
+
+/**
+ * @brief Reverse `n` bytes of `row` in place.
+ */
+typedef void (*reverse_fn)(uint8_t *row, int n);
+
+inline void reverse_scalar(uint8_t *row, const int n)
+{
+    std::reverse(row, row + n);
+}
+
+#ifdef VIPSENV_X86
+
+__attribute__((target("ssse3"))) inline void reverse_ssse3(uint8_t *row, const int n)
+{
+    const __m128i m = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    int lo = 0, hi = n;
+    // swap mirrored 16-byte blocks from both ends, the middle goes scalar
+    for (; hi - lo >= 32; lo += 16, hi -= 16)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + lo));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + hi - 16));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(row + lo), _mm_shuffle_epi8(b, m));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(row + hi - 16), _mm_shuffle_epi8(a, m));
+    }
+    std::reverse(row + lo, row + hi);
+}
+
+__attribute__((target("avx2"))) inline void reverse_avx2(uint8_t *row, const int n)
+{
+    const __m256i m = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                       15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    int lo = 0, hi = n;
+    for (; hi - lo >= 64; lo += 32, hi -= 32)
+    {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + lo));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + hi - 32));
+        // reverse within lanes, then swap the lanes
+        const __m256i ra = _mm256_shuffle_epi8(a, m), rb = _mm256_shuffle_epi8(b, m);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(row + lo), _mm256_permute2x128_si256(rb, rb, 1));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(row + hi - 32), _mm256_permute2x128_si256(ra, ra, 1));
+    }
+    reverse_ssse3(row + lo, hi - lo);
+}
+
+#endif // VIPSENV_X86
+
+/**
+ * @brief Pick the row reversal kernel for `level`.
+ */
+inline reverse_fn select_reverse(const SimdLevel level = simd_level())
+{
+#ifdef VIPSENV_X86
+    if (level == SimdLevel::AVX2)
+        return reverse_avx2;
+    if (level == SimdLevel::SSSE3)
+        return reverse_ssse3;
+#else
+    (void)level;
+#endif
+    return reverse_scalar;
+}
+
+/**
+ * @brief Transpose a block of bytes: row j of `dst` gets byte j of rows 0..n-1 of `src`.
+ *
+ * Strides are in bytes and may be negative (rows read bottom up).
+ */
+typedef void (*transpose_fn)(const uint8_t *src, std::ptrdiff_t src_stride, uint8_t *dst, std::ptrdiff_t dst_stride, int n, int m);
+
+/**
+ * @brief Any n x m block (n source rows, m bytes each).
+ */
+inline void transpose_scalar(const uint8_t *src, const std::ptrdiff_t src_stride, uint8_t *dst, const std::ptrdiff_t dst_stride, const int n, const int m)
+{
+    for (int j = 0; j < m; ++j)
+    {
+        for (int k = 0; k < n; ++k)
+        {
+            dst[j * dst_stride + k] = src[k * src_stride + j];
+        }
+    }
+}
+
+#ifdef VIPSENV_X86
+
+/**
+ * @brief 16x16 tiles in registers (four rounds of unpacks), the rest scalar.
+ */
+__attribute__((target("sse2"))) inline void transpose_sse2(const uint8_t *src, const std::ptrdiff_t src_stride, uint8_t *dst, const std::ptrdiff_t dst_stride, const int n, const int m)
+{
+    if (n != 16)
+    {
+        transpose_scalar(src, src_stride, dst, dst_stride, n, m);
+        return;
+    }
+    int j0 = 0;
+    for (; j0 + 16 <= m; j0 += 16)
+    {
+        __m128i r[16], t[16];
+        for (int k = 0; k < 16; ++k)
+        {
+            r[k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + k * src_stride + j0));
+        }
+        // 16-bit units: column j of rows 2i, 2i+1
+        for (int i = 0; i < 8; ++i)
+        {
+            t[i] = _mm_unpacklo_epi8(r[2 * i], r[2 * i + 1]);
+            t[i + 8] = _mm_unpackhi_epi8(r[2 * i], r[2 * i + 1]);
+        }
+        // 32-bit units: column j of rows 4i..4i+3; r[4g + i] holds columns 4g..4g+3
+        for (int h = 0; h < 2; ++h)
+        {
+            for (int i = 0; i < 4; ++i)
+            {
+                r[8 * h + i] = _mm_unpacklo_epi16(t[8 * h + 2 * i], t[8 * h + 2 * i + 1]);
+                r[8 * h + 4 + i] = _mm_unpackhi_epi16(t[8 * h + 2 * i], t[8 * h + 2 * i + 1]);
+            }
+        }
+        // 64-bit units: columns of rows 0..7 and 8..15, then whole columns
+        for (int g = 0; g < 4; ++g)
+        {
+            const __m128i a = _mm_unpacklo_epi32(r[4 * g], r[4 * g + 1]);
+            const __m128i b = _mm_unpackhi_epi32(r[4 * g], r[4 * g + 1]);
+            const __m128i c = _mm_unpacklo_epi32(r[4 * g + 2], r[4 * g + 3]);
+            const __m128i d = _mm_unpackhi_epi32(r[4 * g + 2], r[4 * g + 3]);
+            t[4 * g] = _mm_unpacklo_epi64(a, c);
+            t[4 * g + 1] = _mm_unpackhi_epi64(a, c);
+            t[4 * g + 2] = _mm_unpacklo_epi64(b, d);
+            t[4 * g + 3] = _mm_unpackhi_epi64(b, d);
+        }
+        for (int j = 0; j < 16; ++j)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + (j0 + j) * dst_stride), t[j]);
+        }
+    }
+    transpose_scalar(src + j0, src_stride, dst + j0 * dst_stride, dst_stride, n, m - j0);
+}
+
+#endif // VIPSENV_X86
+
+/**
+ * @brief Pick the block transpose kernel for `level`.
+ */
+inline transpose_fn select_transpose(const SimdLevel level = simd_level())
+{
+#ifdef VIPSENV_X86
+    if (level != SimdLevel::SCALAR)
+        return transpose_sse2;
+#else
+    (void)level;
+#endif
+    return transpose_scalar;
+}
+
+/**
+ * @brief Remaps the rows of a crop by an Augment on their way into a planar observation.
+ *
+ * Source rows are staged planar ([C][W] uint8) with stage() and handed to
+ * write() once complete. Values are jittered per channel and the row is
+ * reversed in place if its elements land mirrored. Untransposed, it is then
+ * converted and stored as output row y (or its mirror). Transposed, staged
+ * rows become output columns: they are collected in blocks of
+ * Augment::block, and every block is written as one contiguous run per
+ * output row. No pass over the observation is added either way.
+ */
+class AugmentCopy
+{
+public:
+    /**
+     * @brief Allocate the staging of `channels` x `width` crop rows and pick the kernels for `level`.
+     */
+    void init(const int channels, const int width, const SimdLevel level = simd_level())
+    {
+        reverse_row = select_reverse(level);
+        jitter_row = select_jitter(level);
+        transpose = select_transpose(level);
+        rows.resize(static_cast<std::size_t>(Augment::block) * channels * width);
+        block.resize(static_cast<std::size_t>(Augment::block) * width);
+    }
+
+    /**
+     * @brief Planar staging ([C][W]) of crop row `y`.
+     */
+    uint8_t *stage(const Augment &aug, const int y, const int C, const int W)
+    {
+        return rows.data() + static_cast<std::size_t>(aug.transpose ? y % Augment::block : 0) * C * W;
+    }
+
+    /**
+     * @brief Writes staged row `y` of a C x H x W crop into `out`, augmented by `aug`.
+     *
+     * Rows must come in order 0..H-1; transposed crops must be square.
+     *
+     * @param aug Draw applied to the crop.
+     * @param y Crop row, staged with stage().
+     * @param out Planar (C, H, W) output of `itemsize`-byte elements.
+     * @param convert uint8 -> dtype kernel (nullptr = uint8 output).
+     * @param scale Per-channel conversion scale, used with `convert`.
+     * @param shift Per-channel conversion shift, used with `convert`.
+     */
+    void write(const Augment &aug, const int y, uint8_t *out, const int C, const int H, const int W, const std::size_t itemsize,
+               const convert_fn convert, const float *scale, const float *shift)
+    {
+        const std::size_t plane = static_cast<std::size_t>(H) * W;
+        const std::size_t staged = static_cast<std::size_t>(C) * W;
+        uint8_t *staged_rows = stage(aug, y, C, W);
+        for (int c = 0; c < C; c++)
+        {
+            uint8_t *r = staged_rows + c * W;
+            if (aug.jitter)
+            {
+                jitter_row(r, W, aug.lut.data() + c * 256, aug.gain[c], aug.bias[c]);
+            }
+            if (aug.transpose ? aug.flip_y : aug.flip_x)
+            {
+                reverse_row(r, W);
+            }
+            if (!aug.transpose)
+            {
+                const int oy = aug.flip_y ? H - 1 - y : y;
+                uint8_t *dst = out + (c * plane + static_cast<std::size_t>(oy) * W) * itemsize;
+                if (convert)
+                {
+                    convert(r, dst, W, scale[c], shift[c]);
+                }
+                else
+                {
+                    std::memcpy(dst, r, W);
+                }
+            }
+        }
+        if (!aug.transpose || (y % Augment::block != Augment::block - 1 && y != H - 1))
+        {
+            return;
+        }
+
+        // rows y0..y are output columns y0..y (mirrored: W-1-y..W-1-y0, so read bottom up)
+        const int y0 = y - y % Augment::block, n = y - y0 + 1;
+        const int ox = aug.flip_x ? W - 1 - y : y0;
+        const std::ptrdiff_t stride = aug.flip_x ? -static_cast<std::ptrdiff_t>(staged) : static_cast<std::ptrdiff_t>(staged);
+        for (int c = 0; c < C; c++)
+        {
+            const uint8_t *src = rows.data() + (aug.flip_x ? n - 1 : 0) * staged + c * W;
+            uint8_t *dst = out + (c * plane + ox) * itemsize;
+            if (!convert)
+            {
+                transpose(src, stride, dst, W, n, H);
+                continue;
+            }
+            transpose(src, stride, block.data(), n, n, H);
+            for (int oy = 0; oy < H; oy++)
+            {
+                convert(block.data() + oy * n, dst + static_cast<std::size_t>(oy) * W * itemsize, n, scale[c], shift[c]);
+            }
+        }
+    }
+
+private:
+    reverse_fn reverse_row = nullptr; ///< Row mirroring kernel
+    jitter_fn jitter_row = nullptr;   ///< Brightness/contrast kernel
+    transpose_fn transpose = nullptr; ///< Block transpose kernel
+    std::vector<uint8_t> rows;        ///< Planar uint8 rows ([Augment::block][C][W]) staged for augmentation
+    std::vector<uint8_t> block;       ///< Transposed block ([W][Augment::block]) before conversion
+};
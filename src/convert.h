@@ -0,0 +1,156 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "deinterleave.h"
+
+/**
+ * @brief Element type of the observations written into the pool buffer.
+ */
+enum class ObsDtype
+{
+    UINT8,   ///< Raw pixels
+    FLOAT32, ///< x * scale[c] + shift[c]
+    FLOAT16, ///< x * scale[c] + shift[c], IEEE half precision
+};
+
+/**
+ * @brief Bytes per element of `dtype`.
+ */
+inline std::size_t dtype_size(const ObsDtype dtype)
+{
+    return dtype == ObsDtype::FLOAT32 ? 4 : dtype == ObsDtype::FLOAT16 ? 2 : 1;
+}
+
+/**
+ * Pixel conversion kernels
+ *
+ * Convert one planar row of `n` uint8 pixels to the output type as
+ * `x * scale + shift`. With scale = 1 / (255 * std) and shift = -mean / std
+ * this covers [0, 1] scaling as well as per-channel standardization. Like the
+ * deinterleave kernels, the SIMD variants are compiled with target attributes
+ * and picked at runtime.
+ */
+typedef void (*convert_fn)(const uint8_t *src, void *dst, int n, float scale, float shift);
+
+/**
+ * @brief Round-to-nearest-even float -> IEEE half conversion.
+ */
+inline uint16_t float_to_half(const float f)
+{
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    const uint32_t sign = (x >> 16) & 0x8000;
+    const int32_t exp = static_cast<int32_t>((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+
+    if (((x >> 23) & 0xff) == 0xff)
+    {
+        return static_cast<uint16_t>(sign | 0x7c00 | (mant ? 0x200 : 0)); // inf / nan
+    }
+    if (exp >= 31)
+    {
+        return static_cast<uint16_t>(sign | 0x7c00); // overflow
+    }
+    if (exp <= 0)
+    {
+        if (exp < -10)
+        {
+            return static_cast<uint16_t>(sign); // underflow
+        }
+        mant |= 0x800000;
+        const int shift = 14 - exp;
+        uint32_t h = mant >> shift;
+        const uint32_t rem = mant & ((1u << shift) - 1), half = 1u << (shift - 1);
+        if (rem > half || (rem == half && (h & 1)))
+        {
+            h += 1;
+        }
+        return static_cast<uint16_t>(sign | h);
+    }
+    uint32_t h = (static_cast<uint32_t>(exp) << 10) | (mant >> 13);
+    const uint32_t rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+    {
+        h += 1; // a carry into the exponent is still correctly rounded
+    }
+    return static_cast<uint16_t>(sign | h);
+}
+
+inline void convert_f32_scalar(const uint8_t *src, void *dst, int n, float scale, float shift)
+{
+    float *q = static_cast<float *>(dst);
+    for (int x = 0; x < n; ++x)
+    {
+        q[x] = src[x] * scale + shift;
+    }
+}
+
+inline void convert_f16_scalar(const uint8_t *src, void *dst, int n, float scale, float shift)
+{
+    uint16_t *q = static_cast<uint16_t *>(dst);
+    for (int x = 0; x < n; ++x)
+    {
+        q[x] = float_to_half(src[x] * scale + shift);
+    }
+}
+
+#ifdef VIPSENV_X86
+
+__attribute__((target("avx2,fma"))) inline void convert_f32_avx2(const uint8_t *src, void *dst, int n, float scale, float shift)
+{
+    float *q = static_cast<float *>(dst);
+    const __m256 a = _mm256_set1_ps(scale), b = _mm256_set1_ps(shift);
+    int x = 0;
+    for (; x + 8 <= n; x += 8)
+    {
+        const __m256i u = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + x)));
+        _mm256_storeu_ps(q + x, _mm256_fmadd_ps(_mm256_cvtepi32_ps(u), a, b));
+    }
+    convert_f32_scalar(src + x, q + x, n - x, scale, shift);
+}
+
+__attribute__((target("avx2,fma,f16c"))) inline void convert_f16_avx2(const uint8_t *src, void *dst, int n, float scale, float shift)
+{
+    uint16_t *q = static_cast<uint16_t *>(dst);
+    const __m256 a = _mm256_set1_ps(scale), b = _mm256_set1_ps(shift);
+    int x = 0;
+    for (; x + 8 <= n; x += 8)
+    {
+        const __m256i u = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + x)));
+        const __m128i h = _mm256_cvtps_ph(_mm256_fmadd_ps(_mm256_cvtepi32_ps(u), a, b), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(q + x), h);
+    }
+    convert_f16_scalar(src + x, q + x, n - x, scale, shift);
+}
+
+#endif // VIPSENV_X86
+
+/**
+ * @brief Pick the conversion kernel for `dtype`.
+ *
+ * @return The kernel, or nullptr for ObsDtype::UINT8 (no conversion).
+ */
+inline convert_fn select_convert(const ObsDtype dtype, const SimdLevel level = simd_level())
+{
+#ifdef VIPSENV_X86
+    static const bool fma = __builtin_cpu_supports("fma");
+    static const bool f16c = __builtin_cpu_supports("f16c");
+    if (level == SimdLevel::AVX2 && fma)
+    {
+        if (dtype == ObsDtype::FLOAT32)
+            return convert_f32_avx2;
+        if (dtype == ObsDtype::FLOAT16 && f16c)
+            return convert_f16_avx2;
+    }
+#else
+    (void)level;
+#endif
+    if (dtype == ObsDtype::FLOAT32)
+        return convert_f32_scalar;
+    if (dtype == ObsDtype::FLOAT16)
+        return convert_f16_scalar;
+    return nullptr;
+}
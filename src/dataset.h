@@ -0,0 +1,266 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Dataset
+ *
+ * Immutable dataset index shared by every env of a pool: one path string table
+ * plus the class label and (optional) dimensions of each file. It is either
+ * memory-mapped read-only from a manifest file, so million-file datasets load
+ * in constant time and their pages are shared between processes, or built in
+ * memory in the same layout from path/class lists. Opening checks only the
+ * header and table sizes; an entry is checked when its path is read.
+ *
+ * Manifest layout (native endianness, 8-byte aligned):
+ *
+ *     Header  { char magic[4] = "GVDS"; uint32 version = 1; uint64 count; uint64 strings_bytes; }
+ *     Entry   { uint64 offset; uint32 length; int32 cls; int32 width; int32 height; } x count
+ *     char    strings[strings_bytes]  (paths, each NUL-terminated)
+ *
+ * width/height are 0 when unknown.
+ *
+ * @see Dataset::write() for building a manifest.
+ * @see Dataset::open() for mapping one.
+ */
+class Dataset
+{
+public:
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t count;
+        uint64_t strings_bytes;
+    };
+
+    struct Entry
+    {
+        uint64_t offset; ///< Offset of the path in the string table
+        uint32_t length; ///< Path length without the NUL
+        int32_t cls;     ///< Class label
+        int32_t width;   ///< Width in pixels (0 = unknown)
+        int32_t height;  ///< Height in pixels (0 = unknown)
+    };
+
+    static const uint32_t version = 1;
+
+private:
+    Dataset(const Dataset &) = delete;
+    Dataset &operator=(const Dataset &) = delete;
+
+    std::vector<char> owned_;     /**< Backing storage of an in-memory index. */
+    void *map_ = nullptr;         /**< Mapping of a manifest file, or nullptr. */
+    std::size_t map_bytes_ = 0;   /**< Length of map_. */
+    const Entry *entries_ = nullptr; /**< Entry table. */
+    const char *strings_ = nullptr;  /**< String table. */
+    uint64_t strings_bytes_ = 0;     /**< Size of the string table. */
+    std::size_t count_ = 0;          /**< Number of entries. */
+    std::string what_;               /**< Manifest path (or "Dataset"), for errors. */
+
+    Dataset() = default;
+
+    /**
+     * @brief Point at an index laid out at `base`, checking its header and table sizes.
+     *
+     * Touches only the header, so mapping a manifest does not fault in its
+     * entries; path() checks each entry when it is read.
+     */
+    void attach(const char *base, const std::size_t bytes, const std::string &what)
+    {
+        if (bytes < sizeof(Header))
+        {
+            throw std::runtime_error(what + ": too small to be a dataset manifest.");
+        }
+        const Header *h = reinterpret_cast<const Header *>(base);
+        if (std::memcmp(h->magic, "GVDS", 4) != 0 || h->version != version)
+        {
+            throw std::runtime_error(what + ": not a version " + std::to_string(version) + " dataset manifest.");
+        }
+        if (h->count > (bytes - sizeof(Header)) / sizeof(Entry))
+        {
+            throw std::runtime_error(what + ": truncated dataset manifest.");
+        }
+        const uint64_t table = sizeof(Header) + h->count * sizeof(Entry);
+        if (h->strings_bytes > bytes - table)
+        {
+            throw std::runtime_error(what + ": truncated dataset manifest.");
+        }
+        entries_ = reinterpret_cast<const Entry *>(base + sizeof(Header));
+        strings_ = base + table;
+        strings_bytes_ = h->strings_bytes;
+        count_ = static_cast<std::size_t>(h->count);
+        what_ = what;
+    }
+
+    /**
+     * @brief Lay out an index in memory.
+     */
+    static std::vector<char> serialize(const std::vector<std::string> &files, const std::vector<int> &classes,
+                                       const std::vector<std::pair<int, int>> &dims)
+    {
+        if (files.size() != classes.size() || (!dims.empty() && dims.size() != files.size()))
+        {
+            throw std::runtime_error("Dataset: files, classes and dims must have the same length.");
+        }
+        uint64_t strings_bytes = 0;
+        for (const std::string &f : files)
+        {
+            strings_bytes += f.size() + 1;
+        }
+
+        std::vector<char> buf(sizeof(Header) + files.size() * sizeof(Entry) + strings_bytes);
+        Header h;
+        std::memcpy(h.magic, "GVDS", 4);
+        h.version = version;
+        h.count = files.size();
+        h.strings_bytes = strings_bytes;
+        std::memcpy(buf.data(), &h, sizeof(h));
+
+        Entry *entries = reinterpret_cast<Entry *>(buf.data() + sizeof(Header));
+        char *strings = buf.data() + sizeof(Header) + files.size() * sizeof(Entry);
+        uint64_t offset = 0;
+        for (std::size_t i = 0; i < files.size(); ++i)
+        {
+            Entry e;
+            e.offset = offset;
+            e.length = static_cast<uint32_t>(files[i].size());
+            e.cls = classes[i];
+            e.width = dims.empty() ? 0 : dims[i].first;
+            e.height = dims.empty() ? 0 : dims[i].second;
+            std::memcpy(entries + i, &e, sizeof(e));
+            std::memcpy(strings + offset, files[i].c_str(), files[i].size() + 1);
+            offset += files[i].size() + 1;
+        }
+        return buf;
+    }
+
+public:
+    ~Dataset()
+    {
+        if (map_)
+        {
+            munmap(map_, map_bytes_);
+        }
+    }
+
+    /**
+     * @brief Build an in-memory index from path and class lists.
+     *
+     * @param dims Optional (width, height) per file; empty if unknown.
+     */
+    static std::shared_ptr<const Dataset> from_lists(const std::vector<std::string> &files, const std::vector<int> &classes,
+                                                     const std::vector<std::pair<int, int>> &dims = {})
+    {
+        std::shared_ptr<Dataset> d(new Dataset());
+        d->owned_ = serialize(files, classes, dims);
+        d->attach(d->owned_.data(), d->owned_.size(), "Dataset");
+        return d;
+    }
+
+    /**
+     * @brief Memory-map a manifest written by Dataset::write().
+     *
+     * @throws std::runtime_error if the file cannot be mapped or is not a valid manifest.
+     */
+    static std::shared_ptr<const Dataset> open(const std::string &manifest)
+    {
+        const int fd = ::open(manifest.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error(manifest + ": cannot open dataset manifest.");
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            close(fd);
+            throw std::runtime_error(manifest + ": empty dataset manifest.");
+        }
+        void *map = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+        {
+            throw std::runtime_error(manifest + ": cannot map dataset manifest.");
+        }
+
+        std::shared_ptr<Dataset> d(new Dataset());
+        d->map_ = map;
+        d->map_bytes_ = static_cast<std::size_t>(st.st_size);
+        d->attach(static_cast<const char *>(map), d->map_bytes_, manifest);
+        return d;
+    }
+
+    /**
+     * @brief Write a manifest for Dataset::open().
+     *
+     * Written to `manifest`.tmp and renamed, so readers never map a partial file.
+     */
+    static void write(const std::string &manifest, const std::vector<std::string> &files, const std::vector<int> &classes,
+                      const std::vector<std::pair<int, int>> &dims = {})
+    {
+        const std::vector<char> buf = serialize(files, classes, dims);
+        const std::string tmp = manifest + ".tmp";
+        FILE *f = std::fopen(tmp.c_str(), "wb");
+        if (!f)
+        {
+            throw std::runtime_error(tmp + ": cannot create dataset manifest.");
+        }
+        const bool ok = std::fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+        if (std::fclose(f) != 0 || !ok || std::rename(tmp.c_str(), manifest.c_str()) != 0)
+        {
+            std::remove(tmp.c_str());
+            throw std::runtime_error(manifest + ": cannot write dataset manifest.");
+        }
+    }
+
+    /**
+     * @brief Number of files.
+     */
+    inline std::size_t size(void) const
+    {
+        return count_;
+    }
+
+    /**
+     * @brief NUL-terminated path of file `i`.
+     *
+     * @throws std::runtime_error if the entry points outside the string table
+     * or its path is not NUL-terminated (corrupt manifest).
+     */
+    inline const char *path(const std::size_t i) const
+    {
+        const Entry &e = entries_[i];
+        if (e.offset >= strings_bytes_ || e.length >= strings_bytes_ - e.offset || strings_[e.offset + e.length] != '\0')
+        {
+            throw std::runtime_error(what_ + ": corrupt path entry " + std::to_string(i) + ".");
+        }
+        return strings_ + e.offset;
+    }
+
+    /**
+     * @brief Class label of file `i`.
+     */
+    inline int cls(const std::size_t i) const
+    {
+        return entries_[i].cls;
+    }
+
+    /**
+     * @brief (width, height) of file `i`, (0, 0) if unknown.
+     */
+    inline std::pair<int, int> dims(const std::size_t i) const
+    {
+        return std::make_pair(entries_[i].width, entries_[i].height);
+    }
+};
@@ -0,0 +1,292 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VIPSENV_X86 1
+#endif
+
+/**
+ * Crop copy kernels
+ *
+ * Convert one row of interleaved (HWC) pixels with `B` bands into `P` planar
+ * (CHW) rows, `plane` bytes apart. Kernels are specialized at compile time for
+ * the common band layouts; the SIMD variants are compiled with per-function
+ * target attributes and picked at runtime, so the module still loads on CPUs
+ * without SSSE3/AVX2.
+ *
+ * Supported (B, P): (1, 1), (1, 3), (3, 3), (4, 4), (4, 3). Other layouts use
+ * deinterleave_generic().
+ */
+typedef void (*deinterleave_fn)(const uint8_t *src, uint8_t *dst, std::size_t plane, int n);
+
+/**
+ * @brief Any band count; missing planes repeat the last band.
+ */
+inline void deinterleave_generic(const uint8_t *src, uint8_t *dst, std::size_t plane, int n, int bands, int planes)
+{
+    for (int c = 0; c < planes; ++c)
+    {
+        const uint8_t *p = src + (c < bands ? c : bands - 1);
+        uint8_t *q = dst + c * plane;
+        for (int x = 0; x < n; ++x)
+        {
+            q[x] = p[x * bands];
+        }
+    }
+}
+
+/**
+ * @brief Scalar kernel, also used for the tail of the SIMD kernels.
+ */
+template <int B, int P>
+inline void deinterleave_scalar(const uint8_t *src, uint8_t *dst, std::size_t plane, int n)
+{
+    if (B == 1)
+    {
+        for (int c = 0; c < P; ++c)
+        {
+            std::memcpy(dst + c * plane, src, n);
+        }
+        return;
+    }
+    for (int x = 0; x < n; ++x)
+    {
+        for (int c = 0; c < P; ++c)
+        {
+            dst[c * plane + x] = src[x * B + c];
+        }
+    }
+}
+
+#ifdef VIPSENV_X86
+
+/**
+ * @brief pshufb masks gathering band `c` of 16 RGB pixels from three 16-byte loads.
+ */
+inline void rgb_masks(const int c, int8_t mask[3][16])
+{
+    for (int k = 0; k < 3; ++k)
+    {
+        for (int i = 0; i < 16; ++i)
+        {
+            const int byte = i * 3 + c - k * 16;
+            mask[k][i] = (byte >= 0 && byte < 16) ? static_cast<int8_t>(byte) : -1;
+        }
+    }
+}
+
+struct RgbMasks
+{
+    int8_t m[3][3][16]; // [band][load][byte]
+    RgbMasks()
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            rgb_masks(c, m[c]);
+        }
+    }
+};
+
+__attribute__((target("ssse3"))) inline void deinterleave_rgb_ssse3(const uint8_t *src, uint8_t *dst, std::size_t plane, int n)
+{
+    static const RgbMasks masks;
+    __m128i mk[3][3];
+    for (int c = 0; c < 3; ++c)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            mk[c][k] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(masks.m[c][k]));
+        }
+    }
+
+    int x = 0;
+    for (; x + 16 <= n; x += 16)
+    {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 3));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 3 + 16));
+        const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x * 3 + 32));
+        for (int c = 0; c < 3; ++c)
+        {
+            const __m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, mk[c][0]), _mm_shuffle_epi8(b, mk[c][1])), _mm_shuffle_epi8(d, mk[c][2]));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + c * plane + x), v);
+        }
+    }
+    deinterleave_scalar<3, 3>(src + x * 3, dst + x, plane, n - x);
+}
+
+__attribute__((target("avx2"))) inline void deinterleave_rgb_avx2(const uint8_t *src, uint8_t *dst, std::size_t plane, int n)
+{
+    static const RgbMasks masks;
+    __m256i mk[3][3];
+    for (int c = 0; c < 3; ++c)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            mk[c][k] = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(masks.m[c][k])));
+        }
+    }
+
+    // pixels 0..15 in the low lane, 16..31 in the high lane; vpshufb works per lane
+    int x = 0;
+    for (; x + 32 <= n; x += 32)
+    {
+        const uint8_t *s = src + x * 3;
+        const __m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s))), _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 48)), 1);
+        const __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 16))), _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 64)), 1);
+        const __m256i d = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 32))), _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + 80)), 1);
+        for (int c = 0; c < 3; ++c)
+        {
+            const __m256i v = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(a, mk[c][0]), _mm256_shuffle_epi8(b, mk[c][1])), _mm256_shuffle_epi8(d, mk[c][2]));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + c * plane + x), v);
+        }
+    }
+    deinterleave_rgb_ssse3(src + x * 3, dst + x, plane, n - x);
+}
+
+/**
+ * @brief Transpose four registers of 4 pixels x 4 bands (band-grouped by pshufb) into 4 planes.
+ */
+__attribute__((target("ssse3"))) inline void transpose_rgba(__m128i v[4])
+{
+    const __m128i ab_lo = _mm_unpacklo_epi32(v[0], v[1]); // R0 R1 G0 G1
+    const __m128i ab_hi = _mm_unpackhi_epi32(v[0], v[1]); // B0 B1 A0 A1
+    const __m128i cd_lo = _mm_unpacklo_epi32(v[2], v[3]);
+    const __m128i cd_hi = _mm_unpackhi_epi32(v[2], v[3]);
+    v[0] = _mm_unpacklo_epi64(ab_lo, cd_lo);
+    v[1] = _mm_unpackhi_epi64(ab_lo, cd_lo);
+    v[2] = _mm_unpacklo_epi64(ab_hi, cd_hi);
+    v[3] = _mm_unpackhi_epi64(ab_hi, cd_hi);
+}
+
+__attribute__((target("avx2"))) inline void transpose_rgba(__m256i v[4])
+{
+    const __m256i ab_lo = _mm256_unpacklo_epi32(v[0], v[1]);
+    const __m256i ab_hi = _mm256_unpackhi_epi32(v[0], v[1]);
+    const __m256i cd_lo = _mm256_unpacklo_epi32(v[2], v[3]);
+    const __m256i cd_hi = _mm256_unpackhi_epi32(v[2], v[3]);
+    v[0] = _mm256_unpacklo_epi64(ab_lo, cd_lo);
+    v[1] = _mm256_unpackhi_epi64(ab_lo, cd_lo);
+    v[2] = _mm256_unpacklo_epi64(ab_hi, cd_hi);
+    v[3] = _mm256_unpackhi_epi64(ab_hi, cd_hi);
+}
+
+template <int P>
+__attribute__((target("ssse3"))) inline void deinterleave_rgba_ssse3(const uint8_t *src, uint8_t *dst, std::size_t plane, int n)
+{
+    const __m128i group = _mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    int x = 0;
+    for (; x + 16 <= n; x += 16)
+    {
+        const __m128i *s = reinterpret_cast<const __m128i *>(src + x * 4);
+        __m128i v[4];
+        for (int k = 0; k < 4; ++k)
+        {
+            v[k] = _mm_shuffle_epi8(_mm_loadu_si128(s + k), group);
+        }
+        transpose_rgba(v);
+        for (int c = 0; c < P; ++c)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + c * plane + x), v[c]);
+        }
+    }
+    deinterleave_scalar<4, P>(src + x * 4, dst + x, plane, n - x);
+}
+
+template <int P>
+__attribute__((target("avx2"))) inline void deinterleave_rgba_avx2(const uint8_t *src, uint8_t *dst, std::size_t plane, int n)
+{
+    const __m256i group = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+                                           0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    int x = 0;
+    for (; x + 32 <= n; x += 32)
+    {
+        const __m128i *s = reinterpret_cast<const __m128i *>(src + x * 4);
+        __m256i v[4];
+        for (int k = 0; k < 4; ++k)
+        {
+            v[k] = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(s + k)), _mm_loadu_si128(s + k + 4), 1), group);
+        }
+        transpose_rgba(v);
+        for (int c = 0; c < P; ++c)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + c * plane + x), v[c]);
+        }
+    }
+    deinterleave_rgba_ssse3<P>(src + x * 4, dst + x, plane, n - x);
+}
+
+#endif // VIPSENV_X86
+
+/**
+ * @brief Instruction set used by select_deinterleave().
+ */
+enum class SimdLevel
+{
+    SCALAR,
+    SSSE3,
+    AVX2,
+};
+
+/**
+ * @brief Best instruction set supported by the running CPU.
+ */
+inline SimdLevel simd_level(void)
+{
+#ifdef VIPSENV_X86
+    static const SimdLevel level = __builtin_cpu_supports("avx2")    ? SimdLevel::AVX2
+                                   : __builtin_cpu_supports("ssse3") ? SimdLevel::SSSE3
+                                                                     : SimdLevel::SCALAR;
+    return level;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+/**
+ * @brief Pick the kernel for `bands` interleaved bands into `planes` planes.
+ *
+ * @param bands   Bands of the source pixels.
+ * @param planes  Planes of the destination.
+ * @param level   Highest instruction set to use.
+ * @return The kernel, or nullptr if the layout needs deinterleave_generic().
+ */
+inline deinterleave_fn select_deinterleave(const int bands, const int planes, const SimdLevel level = simd_level())
+{
+    if (bands == 1 && planes == 1)
+        return deinterleave_scalar<1, 1>;
+    if (bands == 1 && planes == 3)
+        return deinterleave_scalar<1, 3>;
+#ifdef VIPSENV_X86
+    if (level == SimdLevel::AVX2)
+    {
+        if (bands == 3 && planes == 3)
+            return deinterleave_rgb_avx2;
+        if (bands == 4 && planes == 4)
+            return deinterleave_rgba_avx2<4>;
+        if (bands == 4 && planes == 3)
+            return deinterleave_rgba_avx2<3>;
+    }
+    if (level == SimdLevel::SSSE3)
+    {
+        if (bands == 3 && planes == 3)
+            return deinterleave_rgb_ssse3;
+        if (bands == 4 && planes == 4)
+            return deinterleave_rgba_ssse3<4>;
+        if (bands == 4 && planes == 3)
+            return deinterleave_rgba_ssse3<3>;
+    }
+#else
+    (void)level;
+#endif
+    if (bands == 3 && planes == 3)
+        return deinterleave_scalar<3, 3>;
+    if (bands == 4 && planes == 4)
+        return deinterleave_scalar<4, 4>;
+    if (bands == 4 && planes == 3)
+        return deinterleave_scalar<4, 3>;
+    return nullptr;
+}
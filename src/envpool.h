@@ -1,7 +1,75 @@
+#pragma once
+
 #include <iostream>
 #include <vector>
 #include <thread>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <random>
+#include <algorithm>
+#include <stdexcept>
+#include <exception>
+#include <mutex>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
 #include "concurrentqueue/blockingconcurrentqueue.h"
+#include "threadpool.h"
+#include "sharedmem.h"
+#include "stats.h"
+#include "trajectory.h"
+
+/**
+ * @brief Struct-of-arrays view of the scalar part of a batch of steps.
+ *
+ * Every frame of EnvPool's buffer ring keeps one instance with a slot per env,
+ * written by the workers, and one for gathered recv() batches. Flags are
+ * stored as bytes so they can be exposed as NumPy bool arrays.
+ */
+struct StepArrays
+{
+    std::vector<float> reward;       ///< Reward
+    std::vector<uint8_t> terminated; ///< Episode ended (data_t::done)
+    std::vector<uint8_t> truncated;  ///< Episode was cut off
+    std::vector<int> env_id;         ///< Environment that produced the step
+    std::vector<int> timestep;       ///< Step within the episode
+    std::vector<int> target;         ///< Class label of the episode
+    std::vector<int> level;          ///< Pyramid level of the observation
+    std::vector<int> newest;         ///< History index of the newest observation (see init_t::history_len)
+
+    void resize(const std::size_t n)
+    {
+        reward.resize(n);
+        terminated.resize(n);
+        truncated.resize(n);
+        env_id.resize(n);
+        timestep.resize(n);
+        target.resize(n);
+        level.resize(n);
+        newest.resize(n);
+    }
+
+    /**
+     * @brief Copy element `from` of `src` into element `to`.
+     */
+    void copy(const std::size_t to, const StepArrays &src, const std::size_t from)
+    {
+        reward[to] = src.reward[from];
+        terminated[to] = src.terminated[from];
+        truncated[to] = src.truncated[from];
+        env_id[to] = src.env_id[from];
+        timestep[to] = src.timestep[from];
+        target[to] = src.target[from];
+        level[to] = src.level[from];
+        newest[to] = src.newest[from];
+    }
+};
 
 /**
  * Async EnvPool
@@ -9,7 +77,84 @@
  * Represents an asynchronous environment pool designed for parallel
  * simulation of environments.
  *
- * batch-action -> action queue -> threadpool -> state queue -> buffer-state
+ * batch-action -> per-env action slot -> work-stealing threadpool -> completion queue -> buffer-state
+ *
+ * Env steps run as tasks on a ThreadPool of init_t::num_threads workers, so the
+ * number of envs is independent of the number of threads. init_t must provide
+ * num_env, num_threads, affinity, cpus, wait, num_buffers, history_len and
+ * num_procs.
+ *
+ * init_t::wait sets how the workers wait for actions and recv() waits for
+ * results (see WaitPolicy): spinning first saves the sleep/wake round trip,
+ * which dominates when a step takes microseconds.
+ *
+ * Observations are not carried through the queues: the pool owns contiguous
+ * [num_env, obs_size] byte buffers and every env writes into its own slot. env_t
+ * must provide `static std::size_t obs_size(const init_t &)`, a constructor
+ * `env_t(const init_t &, uint8_t *slot)` and `void bind(uint8_t *slot)`, which
+ * redirects the env's next observation to another slot.
+ *
+ * With init_t::num_buffers = K > 1 the pool keeps a ring of K such buffers
+ * (frames). Every recv() batch lives in one frame and leases it: sends write
+ * into the other frames, so the envs can step t+1 while the caller still
+ * reads batch t, until the caller release()s the lease (see EnvPool::lease()).
+ * When every frame is leased, send() throws. With K = 1 nothing is leased and a
+ * batch is valid until the next send().
+ *
+ * With init_t::history_len = k > 1 every env slot holds the env's last k
+ * observations, [k, obs_size] bytes. Each step writes only the next entry of
+ * this ring and records its index in StepArrays::newest, so the slots form a
+ * [num_env, k, ...] history without moving old observations; entry
+ * (newest + 1 + j) % k is the j-th oldest. Resets zero the history first. When
+ * a step lands in another frame than the env's previous one, the worker copies
+ * the history over before writing.
+ *
+ * Rewards, flags and info of each step are also written by the worker into
+ * per-env struct-of-arrays slots (see StepArrays), so data_t must provide
+ * reward, done, truncated, info.timestep, info.target and info.level. recv()
+ * exposes them like the observations: in place for a full synchronous batch,
+ * gathered otherwise (see EnvPool::batch_arrays()).
+ *
+ * With init_t::num_procs = P > 0 the envs are split into P contiguous shards,
+ * each stepped by its own forked process with its own thread pool (its share
+ * of num_threads), allocator and libvips state; the calling process only
+ * routes. The observation ring lives in shared memory, so observations never
+ * cross a process boundary: commands (env, action, frame) and results (the
+ * scalar part of data_t) travel through one pair of shared-memory rings per
+ * shard (see ShmRing) and a collector thread per shard feeds the results into
+ * the completion queue, so recv() and everything after it is unchanged. A
+ * shard whose process dies makes the next recv() throw instead of hanging.
+ * The shards are forked by the constructor: env_t must not have started
+ * threads or opened files by then, and env state other than the observations
+ * (caches, schedulers, prefetch counters) is per process. Phase latencies of
+ * the shards are merged into init_t::stats.
+ *
+ * With init_t::record set, every finished step is also appended to a
+ * trajectory file (see TrajectoryWriter): the thread that finishes it adds a
+ * TrajectoryRecord (env, image, glimpse rect, action, reward, flags) to its own
+ * buffer, and a background thread compresses and writes full buffers. This
+ * needs data_t::info to carry index, left and top as well. ReplayEnv serves
+ * such a recording again.
+ *
+ * Every env owns its random stream, seeded with `env_t::seed(seed, env_id)`
+ * from the pool seed init_t::seed, so a seeded pool replays the same episodes.
+ *
+ * Phase latencies (queue wait, step, reset, recv wait, gather) are recorded in
+ * init_t::stats, which the pool creates if it is empty and shares with the
+ * envs; see stats.h.
+ *
+ * All workers push finished steps into one shared completion queue. With
+ * init_t::batch_size == num_env (the default) recv() waits for every env and
+ * returns them in env order. With batch_size < num_env the pool runs in async
+ * mode: recv() returns the first batch_size envs to finish, tagged with
+ * data_t::env_id, and their observations are gathered into a [batch_size,
+ * obs_size] buffer. The caller then sends actions for exactly those env ids,
+ * so a slow env never stalls the batch.
+ *
+ * Any subset of envs can be stepped or reset by id. Every env has at most one
+ * action in flight; recv() returns the envs sent since the last recv() (at most
+ * batch_size of them in async mode). Whenever it returns fewer than all envs
+ * their observations are gathered into a contiguous batch buffer.
  *
  * @tparam env_t      The type representing the environment.
  * @tparam action_t   The type representing actions to be taken in the environment.
@@ -17,7 +162,7 @@
  * @tparam init_t     The type representing the initialization parameters for environments.
  *
  * @details The environment steps asynchronously, and the class manages a fixed-size pool of environments.
- * It orchestrates the flow from batched actions to action queues, thread pools, state queues, and buffer states.
+ * It orchestrates the flow from batched actions to per-env action slots, a thread pool, state queues, and buffer states.
  *
  * @note This class is templated to accommodate various types for environments, actions, data, and initialization parameters.
  * The private section contains deleted copy constructor and assignment operator to prevent unintended copies.
@@ -35,20 +180,115 @@ private:
     EnvPool &operator=(const EnvPool &) = delete;
 
 public:
-    const int num_env_ = 0; /**< Number of environments in the pool. */
-    int stop_ = 0;    /**< Flag to signal worker threads to stop processing. */
+    const int num_env_ = 0;    /**< Number of environments in the pool. */
+    const int batch_size_ = 0; /**< Number of environments returned by recv(). */
 
     init_t init; /**< Initialization parameters for setting up the environments. */
 
     // vector of envs
     std::vector<env_t> envs_; /**< Vector of environments in the pool. */
 
-    // vector to hold pointers instead of instances of BlockingConcurrentQueue
-    std::vector<moodycamel::BlockingConcurrentQueue<action_t, moodycamel::ConcurrentQueueDefaultTraits> *> action_bcq; /**< Vector of action queues for each environment. */
-    std::vector<moodycamel::BlockingConcurrentQueue<data_t, moodycamel::ConcurrentQueueDefaultTraits> *> data_bcq;     /**< Vector of data queues for each environment. */
+    /**
+     * @brief One observation batch buffer of the ring, see init_t::num_buffers.
+     */
+    struct frame_t
+    {
+        uint8_t *obs = nullptr;         /**< Contiguous [num_env_, obs_size_] slots the envs write into, in obs_mem_. */
+        StepArrays slots;               /**< Per-env step results, written by the workers. */
+        std::vector<uint8_t> batch_obs; /**< Gather buffer for batches smaller than num_env_. */
+        StepArrays batch;               /**< Gathered step results. */
+    };
+
+    // observation buffers shared by all envs, one slot per env
+    std::size_t view_size_ = 0;   /**< Size of the observation one step writes, in bytes. */
+    int history_ = 1;             /**< Observations kept per env, see init_t::history_len. */
+    std::size_t obs_size_ = 0;    /**< Size of one env's slot (history_ observations) in bytes. */
+    std::unique_ptr<SharedMemory> obs_mem_; /**< Storage of every frame's slots, shared with shard processes. */
+    std::vector<frame_t> frames_; /**< Ring of observation buffers. */
+    std::vector<int> target_;     /**< Frame each env's pending or last step writes into (caller thread). */
+    std::vector<int> written_;    /**< Frame each env's last step was written into (worker side). */
+    std::vector<int> newest_;     /**< History index of each env's newest observation (worker side). */
+    std::vector<char> failed_;    /**< Whether each env's last reset or step threw, so its next action resets it (worker side). */
+    int write_ = 0;               /**< Frame new sends write into. */
+    int result_ = 0;              /**< Frame holding the last recv() batch. */
+    bool gathered_ = false;       /**< Whether the last recv() gathered into its frame's batch buffers. */
+    std::unique_ptr<std::atomic<uint64_t>[]> leased_; /**< Per frame: token of the lease holding it (0 = free). */
+    uint64_t lease_ = 0;          /**< Lease token of the last recv() (0 = none). */
+    uint64_t leases_ = 0;         /**< Lease tokens handed out (caller thread only). */
+
+    // pending action of each env, read by the task that steps it
+    std::vector<action_t> actions_; /**< Last action sent to each environment. */
+    std::vector<char> busy_;        /**< Whether an env has an action in flight (caller thread only). */
+    int pending_ = 0;               /**< Envs sent but not yet received (caller thread only). */
+    std::vector<std::chrono::steady_clock::time_point> submitted_; /**< When each env's action was submitted, for Phase::QUEUE. */
+    std::vector<std::exception_ptr> errors_;                       /**< Exception of each env's failed step, set before it is queued, taken by recv(). */
+
+    // completion queue shared by all envs
+    moodycamel::BlockingConcurrentQueue<data_t, moodycamel::ConcurrentQueueDefaultTraits> data_bcq; /**< Finished steps in completion order. */
+    std::vector<data_t> done_;                                                                     /**< Scratch for bulk dequeues. */
+    int recv_budget_ = 0;                                                                          /**< recv()'s adaptive spin budget, see spin_until(). */
 
     // thread workers
-    std::vector<std::thread> workers_; /**< Vector of worker threads for processing actions asynchronously. */
+    std::unique_ptr<ThreadPool> workers_; /**< Work-stealing pool that runs env steps (in the shard processes when sharded). */
+
+    /**
+     * @brief An env step for a shard process.
+     */
+    struct command_t
+    {
+        enum
+        {
+            STEP, ///< Step (or reset, see action_t::force_reset) env `env`
+            SEED, ///< Reseed the shard's envs from `seed`
+            STOP  ///< Finish the steps in flight and exit
+        } type = STEP;
+        int env = 0;                                            ///< Env to step
+        int frame = 0;                                          ///< Frame the step writes into
+        action_t action;                                        ///< Action of the step
+        uint64_t seed = 0;                                      ///< Pool seed of SEED
+        std::chrono::steady_clock::time_point submitted;        ///< For Phase::QUEUE
+    };
+
+    /**
+     * @brief A finished step sent back by a shard process.
+     */
+    struct completion_t
+    {
+        data_t data;        ///< Scalar results; data.obs points into obs_mem_
+        int frame = 0;      ///< Frame the observation was written into
+        int newest = 0;     ///< History index of the observation
+        bool reset = false; ///< Whether the env was reset rather than stepped
+        char error[256];    ///< what() of the exception the step threw, empty if it succeeded
+    };
+
+    /**
+     * @brief One process of a sharded pool, see init_t::num_procs.
+     */
+    struct shard_t
+    {
+        int first = 0, last = 0;             ///< Envs [first, last) run in this shard
+        int num_threads = 1;                 ///< Worker threads of the shard process
+        std::vector<int> cpus;               ///< CPUs of those threads (empty = unpinned)
+        pid_t pid = 0;                       ///< Shard process
+        std::atomic<int> status;             ///< wait() status once the process exited unexpectedly, -1 while it runs
+        std::unique_ptr<SharedMemory> mem;   ///< Rings and recorder
+        ShmRing<command_t> commands;         ///< Pool -> shard
+        ShmRing<completion_t> completions;   ///< Shard -> pool
+        Stats::Recorder *recorder = nullptr; ///< Shard's phase latencies, in mem
+        std::thread collector;               ///< Moves completions into data_bcq (pool process)
+        shard_t() : status(-1) {}
+    };
+
+    std::vector<std::unique_ptr<shard_t>> shards_; /**< Shard processes; empty when the envs run in this process. */
+    std::vector<int> shard_of_;                    /**< Env -> shard. */
+    int serving_ = -1;                             /**< In a shard process: its shard; -1 in the pool process. */
+    std::atomic<bool> stopping_;                   /**< Stops the collectors. */
+    std::mutex reply_m_;                           /**< Serializes the shard workers' pushes to the completion ring. */
+    int in_flight_ = 0;                            /**< Steps running in this shard process, under reply_m_. */
+    std::chrono::steady_clock::time_point published_; /**< Last export of this shard's stats, under reply_m_. */
+
+    std::unique_ptr<TrajectoryWriter> recorder_; /**< Trajectory file of init_t::record (pool process only), nullptr if not recording. */
+    std::vector<uint32_t> recorded_;             /**< Steps recorded per env, written by the thread finishing the env's step. */
 
     /**
      * @brief Default constructor for EnvPool
@@ -58,7 +298,7 @@ public:
      * @note Use this constructor when creating an EnvPool without specific initialization parameters.
      * The instance must be properly initialized before use.
      */
-    EnvPool(void) {}
+    EnvPool(void) : stopping_(false) {}
 
     /**
      * @brief Constructor for EnvPool
@@ -68,62 +308,501 @@ public:
      * @param init_params   The initialization parameters for setting up the environments.
      *
      * @note Use this constructor to create an instance of EnvPool with the given initialization parameters.
-     * The constructor initializes environments, action queues, and data queues based on the provided parameters.
-     * It also creates worker threads to process actions asynchronously.
+     * The constructor initializes environments, action slots, and data queues based on the provided parameters.
+     * It also creates the worker thread pool (init_t::num_threads, pinned per init_t::affinity) to process actions asynchronously.
      *
      * @see EnvPool::~EnvPool() for the controlled shutdown of the environment pool.
      * @see EnvPool::send() for sending actions to the environment pool.
      * @see EnvPool::recv() for retrieving states resulting from asynchronous processing.
      * @see EnvPool::reset() for initiating a reset in a controlled manner.
      */
-    EnvPool(init_t init_params) : num_env_(init_params.num_env)
+    EnvPool(init_t init_params)
+        : num_env_(init_params.num_env),
+          batch_size_(init_params.batch_size > 0 && init_params.batch_size < init_params.num_env ? init_params.batch_size : init_params.num_env),
+          stopping_(false)
     {
         init = init_params;
+        if (!init.stats)
+        {
+            init.stats = std::make_shared<Stats>();
+        }
+
+        // Allocate the observation buffers once; envs write into their slot in place
+        view_size_ = env_t::obs_size(init_params);
+        history_ = std::max(1, init_params.history_len);
+        obs_size_ = view_size_ * history_;
+        frames_.resize(std::max(1, init_params.num_buffers));
+        obs_mem_.reset(new SharedMemory(frames_.size() * num_env_ * obs_size_));
+        leased_.reset(new std::atomic<uint64_t>[frames_.size()]);
+        for (std::size_t f = 0; f < frames_.size(); ++f)
+        {
+            frame_t &frame = frames_[f];
+            frame.obs = obs_mem_->data() + f * num_env_ * obs_size_;
+            if (is_async())
+            {
+                frame.batch_obs.assign(static_cast<std::size_t>(batch_size_) * obs_size_, 0);
+            }
+            frame.slots.resize(num_env_);
+            frame.batch.resize(batch_size_);
+            for (int i = 0; i < num_env_; ++i)
+            {
+                frame.slots.env_id[i] = i;
+            }
+            leased_[f].store(0);
+        }
+        target_.assign(num_env_, 0);
+        written_.assign(num_env_, 0);
+        newest_.assign(num_env_, 0);
+        failed_.assign(num_env_, 0);
+        envs_.reserve(num_env_);
 
-        // Initialize environments, action queues, and data queues
+        // Initialize environments and action slots
         for (int i = 0; i < num_env_; ++i)
         {
-            envs_.emplace_back(env_t(init_params));
+            envs_.emplace_back(init, obs(i));
+        }
+        actions_.resize(num_env_);
+        busy_.assign(num_env_, 0);
+        submitted_.resize(num_env_);
+        errors_.resize(num_env_);
+        done_.resize(num_env_);
+        seed(init_params.seed < 0 ? std::random_device{}() : static_cast<uint64_t>(init_params.seed));
 
-            // Change the initialization to use pointers
-            action_bcq.emplace_back(new moodycamel::BlockingConcurrentQueue<action_t, moodycamel::ConcurrentQueueDefaultTraits>());
-            data_bcq.emplace_back(new moodycamel::BlockingConcurrentQueue<data_t, moodycamel::ConcurrentQueueDefaultTraits>());
+        // Create the worker threads; by default one per core, never more than envs
+        int num_threads = init_params.num_threads;
+        if (num_threads <= 0)
+        {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        num_threads = std::min(num_threads, num_env_);
+        if (init_params.num_procs > 0)
+        {
+            fork_shards(std::min(init_params.num_procs, num_env_), num_threads);
+        }
+        else
+        {
+            workers_.reset(new ThreadPool(num_threads, init_params.affinity, init_params.cpus, init_params.wait));
         }
 
-        // Create worker threads for asynchronous processing of actions
-        for (int i = 0; i < num_env_; ++i)
+        // after forking: only the pool process writes the recording
+        if (!init.record.empty())
         {
-            workers_.emplace_back([this, i]
-                                  {
-                for (;;)
-                { // runs until stop_ == 1
-                    action_t raw_action;
-                    action_bcq[i]->wait_dequeue(raw_action);
-                    if (stop_ == 1)
-                    {
-                        break;
-                    }
+            recorded_.assign(num_env_, 0);
+            recorder_.reset(new TrajectoryWriter(init.record, TrajectoryMeta::of(init), init.record_compress));
+        }
+    }
+
+    /**
+     * @brief Split the envs into `procs` shards and fork a process for each.
+     *
+     * The `num_threads` workers are divided between the shards and pinned as one
+     * pool of that many threads would be.
+     *
+     * @throws std::runtime_error if shared memory or a process cannot be created.
+     */
+    void fork_shards(const int procs, const int num_threads)
+    {
+        shard_of_.resize(num_env_);
+        const int per = std::max(1, num_threads / procs);
+        for (int s = 0; s < procs; ++s)
+        {
+            shards_.emplace_back(new shard_t());
+            shard_t &sh = *shards_.back();
+            sh.first = static_cast<int>(static_cast<int64_t>(s) * num_env_ / procs);
+            sh.last = static_cast<int>(static_cast<int64_t>(s + 1) * num_env_ / procs);
+            sh.num_threads = std::min(per, sh.last - sh.first);
+            for (int t = 0; t < sh.num_threads; ++t)
+            {
+                const int cpu = ThreadPool::cpu_of(s * per + t, procs * per, init.affinity, init.cpus);
+                if (cpu >= 0)
+                {
+                    sh.cpus.push_back(cpu);
+                }
+            }
+            std::fill(shard_of_.begin() + sh.first, shard_of_.begin() + sh.last, s);
+
+            // a command per env in flight plus SEED and STOP, a result per env in flight
+            const std::size_t n = static_cast<std::size_t>(sh.last - sh.first) + 2;
+            const std::size_t commands = ShmRing<command_t>::bytes(n), completions = ShmRing<completion_t>::bytes(n);
+            sh.mem.reset(new SharedMemory(commands + completions + sizeof(Stats::Recorder)));
+            sh.commands.init(sh.mem->data(), n, init.wait);
+            sh.completions.init(sh.mem->data() + commands, n, init.wait);
+            sh.recorder = new (sh.mem->data() + commands + completions) Stats::Recorder();
+        }
+
+        // fork before this process starts any thread, so the children inherit no held lock
+        const pid_t parent = getpid();
+        for (int s = 0; s < procs; ++s)
+        {
+            const pid_t pid = fork();
+            if (pid == 0)
+            {
+                prctl(PR_SET_PDEATHSIG, SIGKILL);
+                if (getppid() != parent)
+                {
+                    _exit(1);
+                }
+                serve(s);
+            }
+            if (pid < 0)
+            {
+                for (int k = 0; k < s; ++k)
+                {
+                    kill(shards_[k]->pid, SIGKILL);
+                    waitpid(shards_[k]->pid, nullptr, 0);
+                }
+                shards_.clear();
+                throw std::runtime_error("Cannot fork shard process " + std::to_string(s) + ".");
+            }
+            shards_[s]->pid = pid;
+        }
+        for (int s = 0; s < procs; ++s)
+        {
+            init.stats->attach(shards_[s]->recorder);
+            shards_[s]->collector = std::thread([this, s]
+                                                { collect(s); });
+        }
+    }
 
-                    data_t data;
-                    if (raw_action.force_reset || envs_[i].is_done())
+    /**
+     * @brief Main loop of shard process `s`: run its commands until STOP, then exit.
+     */
+    void serve(const int s)
+    {
+        serving_ = s;
+        shard_t &sh = *shards_[s];
+        try
+        {
+            init.stats->reset(); // only this process's samples are exported
+            published_ = std::chrono::steady_clock::now();
+            workers_.reset(new ThreadPool(sh.num_threads, sh.cpus.empty() ? Affinity::NONE : Affinity::EXPLICIT, sh.cpus, init.wait));
+            command_t c;
+            for (;;)
+            {
+                if (!sh.commands.pop(c))
+                {
+                    continue;
+                }
+                if (c.type == command_t::STOP)
+                {
+                    break;
+                }
+                if (c.type == command_t::SEED)
+                {
+                    for (int i = sh.first; i < sh.last; ++i)
                     {
-                        data = envs_[i].reset();
-                    } else {
-                        data = envs_[i].step(raw_action);
+                        envs_[i].seed(c.seed, i);
                     }
-                    data_bcq[i]->enqueue(data);
-                }});
+                    continue;
+                }
+                const int i = c.env;
+                actions_[i] = c.action;
+                target_[i] = c.frame;
+                submitted_[i] = c.submitted;
+                {
+                    std::lock_guard<std::mutex> lock(reply_m_);
+                    in_flight_ += 1;
+                }
+                workers_->submit([this, i]
+                                 { run(i); },
+                                 i - sh.first);
+            }
+            workers_.reset();
+        }
+        catch (const std::exception &e)
+        {
+            std::cerr << "Shard process " << s << ": " << e.what() << std::endl;
+            _exit(1);
+        }
+        _exit(0);
+    }
+
+    /**
+     * @brief Collector of shard `s` (pool process): hand its results to recv().
+     *
+     * If the shard process dies, queues a result with env_id -1 - s so recv()
+     * reports it.
+     */
+    void collect(const int s)
+    {
+        shard_t &sh = *shards_[s];
+        completion_t c;
+        while (!stopping_.load())
+        {
+            if (sh.completions.pop(c, std::chrono::milliseconds(100)))
+            {
+                complete(c);
+                continue;
+            }
+            int status = 0;
+            if (!stopping_.load() && waitpid(sh.pid, &status, WNOHANG) == sh.pid)
+            {
+                while (sh.completions.try_pop(c))
+                {
+                    complete(c);
+                }
+                sh.status.store(status);
+                data_t dead;
+                dead.env_id = -1 - s;
+                data_bcq.enqueue(dead);
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief Throws if a shard process has died.
+     */
+    void check_shards(void) const
+    {
+        for (std::size_t s = 0; s < shards_.size(); ++s)
+        {
+            const int status = shards_[s]->status.load();
+            if (status != -1)
+            {
+                throw std::runtime_error("Shard process " + std::to_string(s) + " (envs " + std::to_string(shards_[s]->first) + " to " +
+                                         std::to_string(shards_[s]->last - 1) + ") " +
+                                         (WIFSIGNALED(status) ? "was killed by signal " + std::to_string(WTERMSIG(status))
+                                                              : "exited with status " + std::to_string(WEXITSTATUS(status))) +
+                                         "; the pool cannot be used any more.");
+            }
+        }
+    }
+
+    /**
+     * @brief Step Task
+     *
+     * Runs one reset or step of env `i` with its pending action on a pool worker.
+     * Each env has at most one task in flight, so envs_[i] is never shared.
+     *
+     * @param i   Index of the environment.
+     */
+    void run(const int i)
+    {
+        Stats *stats = init.stats.get();
+#ifndef VIPSENV_NO_STATS
+        const auto start = std::chrono::steady_clock::now();
+        stats->add(Phase::QUEUE, std::chrono::duration_cast<std::chrono::nanoseconds>(start - submitted_[i]).count());
+#endif
+
+        uint8_t *slot = frames_[target_[i]].obs + i * obs_size_;
+        const bool reset = actions_[i].force_reset || envs_[i].is_done() || failed_[i];
+        if (history_ > 1)
+        {
+            if (reset)
+            {
+                std::memset(slot, 0, obs_size_);
+                newest_[i] = 0;
+            }
+            else
+            {
+                if (written_[i] != target_[i])
+                {
+                    std::memcpy(slot, frames_[written_[i]].obs + i * obs_size_, obs_size_);
+                }
+                newest_[i] = (newest_[i] + 1) % history_;
+            }
+        }
+        written_[i] = target_[i];
+        envs_[i].bind(slot + newest_[i] * view_size_);
+
+        // an exception must not escape into the worker; recv() rethrows it
+        data_t data;
+        std::exception_ptr error;
+        try
+        {
+            if (reset)
+            {
+                VIPSENV_TIME_PHASE(stats, Phase::RESET);
+                data = envs_[i].reset();
+            } else {
+                VIPSENV_TIME_PHASE(stats, Phase::STEP);
+                data = envs_[i].step(actions_[i]);
+            }
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+            data = data_t();
+        }
+        failed_[i] = error ? 1 : 0;
+        data.env_id = i;
+        if (serving_ >= 0)
+        {
+            reply(data, reset, error);
+            return;
+        }
+        if (error)
+        {
+            fail(data, error);
+            return;
+        }
+        finish(target_[i], data, newest_[i], reset);
+    }
+
+    /**
+     * @brief Queue the failed step of env data.env_id for recv(), which throws `error`.
+     *
+     * Nothing is written to the env's slot or recorded.
+     */
+    void fail(const data_t &data, const std::exception_ptr &error)
+    {
+        errors_[data.env_id] = error;
+        data_bcq.enqueue(data);
+    }
+
+    /**
+     * @brief Hand a step finished by a shard process to recv() (pool process).
+     */
+    void complete(const completion_t &c)
+    {
+        if (c.error[0] != '\0')
+        {
+            fail(c.data, std::make_exception_ptr(std::runtime_error(c.error)));
+            return;
+        }
+        finish(c.frame, c.data, c.newest, c.reset);
+    }
+
+    /**
+     * @brief Record a finished step of env data.env_id in frame `frame` and queue it for recv().
+     *
+     * @param reset Whether the env was reset rather than stepped, for the recording.
+     */
+    void finish(const int frame, const data_t &data, const int newest, const bool reset)
+    {
+        const int i = data.env_id;
+        StepArrays &slots = frames_[frame].slots;
+        slots.reward[i] = data.reward;
+        slots.terminated[i] = data.done;
+        slots.truncated[i] = data.truncated;
+        slots.timestep[i] = data.info.timestep;
+        slots.target[i] = data.info.target;
+        slots.level[i] = data.info.level;
+        slots.newest[i] = newest;
+        if (recorder_)
+        {
+            recorder_->append(to_record(data, actions_[i], recorded_[i]++, reset));
+        }
+        data_bcq.enqueue(data);
+    }
+
+    /**
+     * @brief Send a finished step back to the pool process (shard process only).
+     *
+     * Exports the shard's stats when it goes idle, and at least every 10 ms.
+     */
+    void reply(const data_t &data, const bool reset, const std::exception_ptr &error)
+    {
+        completion_t c;
+        c.data = data;
+        c.frame = target_[data.env_id];
+        c.newest = newest_[data.env_id];
+        c.reset = reset;
+        c.error[0] = '\0';
+        if (error)
+        {
+            try
+            {
+                std::rethrow_exception(error);
+            }
+            catch (const std::exception &e)
+            {
+                std::snprintf(c.error, sizeof(c.error), "%s", e.what());
+            }
+            catch (...)
+            {
+                std::snprintf(c.error, sizeof(c.error), "unknown exception in env %d", data.env_id);
+            }
+        }
+        std::lock_guard<std::mutex> lock(reply_m_);
+        shards_[serving_]->completions.push(c);
+        in_flight_ -= 1;
+#ifndef VIPSENV_NO_STATS
+        const auto now = std::chrono::steady_clock::now();
+        if (in_flight_ == 0 || now - published_ > std::chrono::milliseconds(10))
+        {
+            init.stats->publish(*shards_[serving_]->recorder);
+            published_ = now;
+        }
+#endif
+    }
+
+    /**
+     * @brief Whether recv() returns fewer envs than the pool holds.
+     */
+    bool is_async(void) const
+    {
+        return batch_size_ < num_env_;
+    }
+
+    /**
+     * @brief Mark the envs in `env_id` as in flight.
+     *
+     * @throws std::runtime_error if an id is out of range, repeated, or already
+     * has an action in flight; no env is marked in that case.
+     */
+    void claim(const std::vector<int> &env_id)
+    {
+        for (std::size_t k = 0; k < env_id.size(); ++k)
+        {
+            const int i = env_id[k];
+            if (i < 0 || i >= num_env_ || busy_[i])
+            {
+                for (std::size_t j = 0; j < k; ++j)
+                {
+                    busy_[env_id[j]] = 0;
+                }
+                throw std::runtime_error("env_id " + std::to_string(i) + " is out of range or already has an action in flight.");
+            }
+            busy_[i] = 1;
+        }
+    }
+
+    /**
+     * @brief Frame new sends write into: the current one unless it is leased.
+     *
+     * @throws std::runtime_error if every frame is leased.
+     */
+    int writable(void)
+    {
+        const int k = static_cast<int>(frames_.size());
+        for (int d = 0; d < k; ++d)
+        {
+            const int f = (write_ + d) % k;
+            if (leased_[f].load() == 0)
+            {
+                write_ = f;
+                return f;
+            }
         }
+        throw std::runtime_error("All " + std::to_string(k) + " observation buffers are held; release() one before sending.");
+    }
 
-      std::size_t processor_count = std::thread::hardware_concurrency();
-      for (std::size_t tid = 0; tid < num_env_; ++tid) {
-        cpu_set_t cpuset;
-        CPU_ZERO(&cpuset);
-        std::size_t cid = tid % processor_count;
-        CPU_SET(cid, &cpuset);
-        pthread_setaffinity_np(workers_[tid].native_handle(), sizeof(cpu_set_t),
-                               &cpuset);
-      }
+    /**
+     * @brief Submit env `i` with `action` to the thread pool, writing into frame `frame`.
+     */
+    void submit(const int i, const action_t &action, const int frame)
+    {
+        pending_ += 1;
+        actions_[i] = action;
+        target_[i] = frame;
+#ifndef VIPSENV_NO_STATS
+        submitted_[i] = std::chrono::steady_clock::now();
+#endif
+        if (!shards_.empty())
+        {
+            command_t c;
+            c.env = i;
+            c.frame = frame;
+            c.action = action;
+            c.submitted = submitted_[i];
+            shards_[shard_of_[i]]->commands.push(c);
+            return;
+        }
+        workers_->submit([this, i]
+                         { run(i); },
+                         i);
     }
 
     /**
@@ -142,9 +821,33 @@ public:
      */
     void send(const std::vector<action_t> action)
     {
-        for (int i = 0; i < num_env_; ++i)
+        send(action, all_env_ids());
+    }
+
+    /**
+     * @brief Send Method (addressed)
+     *
+     * Enqueues actions for the environments listed in `env_id`; action[k] goes to
+     * env env_id[k]. In async mode this is how the envs returned by the last
+     * recv() are stepped again.
+     *
+     * @param action   Actions, one per entry of env_id.
+     * @param env_id   Ids of the environments to step.
+     *
+     * @throws std::runtime_error if an env is addressed twice or still in flight.
+     */
+    void send(const std::vector<action_t> &action, const std::vector<int> &env_id)
+    {
+        if (action.size() != env_id.size())
+        {
+            throw std::runtime_error("Got " + std::to_string(action.size()) + " actions for " + std::to_string(env_id.size()) + " env ids.");
+        }
+        check_shards();
+        const int frame = writable();
+        claim(env_id);
+        for (std::size_t k = 0; k < env_id.size(); ++k)
         {
-            action_bcq[i]->enqueue(action[i]);
+            submit(env_id[k], action[k], frame);
         }
     }
 
@@ -154,9 +857,11 @@ public:
      * Retrieves the latest batch of states resulting from asynchronous processing
      * of actions by the environment pool.
      *
-     * @return A vector of data_t representing the current states of the environments.
+     * @return The states of the envs sent since the last recv(); sorted by env id
+     * when synchronous, the first batch_size_ in completion order (see
+     * data_t::env_id) in async mode.
      *
-     * @note Use this method to obtain the current states of all environments
+     * @note Use this method to obtain the current states of the environments
      * after sending actions using EnvPool::send().
      *
      * @see EnvPool::send() for sending actions to the environment pool.
@@ -165,12 +870,197 @@ public:
      */
     std::vector<data_t> recv(void)
     {
-        std::vector<data_t> states(num_env_);
+        std::vector<data_t> states;
+        recv(states);
+        return states;
+    }
+
+    /**
+     * @brief Receive Method (caller-owned storage)
+     *
+     * Same as EnvPool::recv() but fills a caller-owned vector, so a caller that
+     * keeps the vector around does not allocate per step. Observations are at
+     * EnvPool::batch_obs() in the same order as `states` and stay valid until
+     * the next send() to those envs, or with several buffers until the batch's
+     * lease is released.
+     *
+     * @param states   Vector resized to the number of states received.
+     *
+     * @throws std::runtime_error if the batch must be gathered and every frame
+     * is leased; nothing is received in that case. Also if a shard process
+     * died (see init_t::num_procs).
+     * @throws The first exception an env of the batch threw, once the whole
+     * batch has been received; its envs can be sent again, and the next action
+     * of an env that threw resets it (in shard processes the exception is
+     * rethrown as std::runtime_error with the same what()).
+     */
+    void recv(std::vector<data_t> &states)
+    {
+        check_shards();
+        const int n = is_async() ? std::min(batch_size_, pending_) : pending_;
+
+        // a full synchronous batch written into one frame is already contiguous there
+        const bool in_place = n == num_env_ && std::all_of(target_.begin(), target_.end(), [this](const int f)
+                                                            { return f == target_[0]; });
+        const int frame = in_place ? target_[0] : n == 0 ? write_ : gatherable();
+        states.resize(n);
+
+        Stats *stats = init.stats.get();
+        std::exception_ptr error;
+        {
+            VIPSENV_TIME_PHASE(stats, Phase::RECV_WAIT);
+            int got = 0;
+            while (got < n)
+            {
+                std::size_t m = data_bcq.try_dequeue_bulk(done_.begin(), n - got);
+                if (m == 0)
+                {
+                    spin_until(init.wait, recv_budget_, [this]
+                               { return data_bcq.size_approx() > 0; });
+                    m = data_bcq.wait_dequeue_bulk(done_.begin(), n - got);
+                }
+                for (std::size_t k = 0; k < m; ++k)
+                {
+                    if (done_[k].env_id < 0)
+                    {
+                        check_shards();
+                    }
+                    const int i = done_[k].env_id;
+                    busy_[i] = 0;
+                    if (errors_[i])
+                    {
+                        if (!error)
+                        {
+                            error = errors_[i];
+                        }
+                        errors_[i] = nullptr;
+                    }
+                    states[got + k] = done_[k];
+                }
+                got += static_cast<int>(m);
+            }
+        }
+        pending_ -= n;
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+
+        if (!is_async())
+        {
+            std::sort(states.begin(), states.end(), [](const data_t &a, const data_t &b)
+                      { return a.env_id < b.env_id; });
+        }
+
+        result_ = frame;
+        gathered_ = !in_place;
+        if (gathered_)
+        {
+            VIPSENV_TIME_PHASE(stats, Phase::GATHER);
+            frame_t &dst = frames_[frame];
+            if (dst.batch_obs.size() < static_cast<std::size_t>(n) * obs_size_)
+            {
+                dst.batch_obs.resize(static_cast<std::size_t>(is_async() ? batch_size_ : num_env_) * obs_size_);
+            }
+            dst.batch.resize(std::max(dst.batch.env_id.size(), static_cast<std::size_t>(n)));
+            for (int k = 0; k < n; ++k)
+            {
+                const int i = states[k].env_id;
+                std::memcpy(dst.batch_obs.data() + k * obs_size_, obs(i), obs_size_);
+                dst.batch.copy(k, frames_[target_[i]].slots, i);
+            }
+        }
+
+        lease_ = 0;
+        if (frames_.size() > 1 && n > 0)
+        {
+            lease_ = ++leases_;
+            leased_[frame].store(lease_);
+        }
+    }
+
+    /**
+     * @brief Frame a gathered batch can be written into, preferring one that is not written by sends.
+     *
+     * @throws std::runtime_error if every frame is leased.
+     */
+    int gatherable(void) const
+    {
+        const int k = static_cast<int>(frames_.size());
+        for (int d = 1; d <= k; ++d)
+        {
+            const int f = (write_ + d) % k;
+            if (leased_[f].load() == 0)
+            {
+                return f;
+            }
+        }
+        throw std::runtime_error("All " + std::to_string(k) + " observation buffers are held; release() one before receiving.");
+    }
+
+    /**
+     * @brief Lease token of the last recv() batch, 0 if it holds no lease (single buffer or empty batch).
+     */
+    uint64_t lease(void) const
+    {
+        return lease_;
+    }
+
+    /**
+     * @brief Give the frame of a recv() batch back to the pool.
+     *
+     * May be called from any thread; releasing a token twice, or 0, is a no-op.
+     *
+     * @return Whether `token` still held a frame.
+     */
+    bool release(const uint64_t token)
+    {
+        for (std::size_t f = 0; token != 0 && f < frames_.size(); ++f)
+        {
+            uint64_t held = token;
+            if (leased_[f].compare_exchange_strong(held, 0))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Pointer to the [n, obs_size_] observations of the last recv().
+     */
+    uint8_t *batch_obs(void)
+    {
+        return gathered_ ? frames_[result_].batch_obs.data() : frames_[result_].obs;
+    }
+
+    /**
+     * @brief Step results of the last recv(), first n entries, in the order of its states.
+     */
+    const StepArrays &batch_arrays(void) const
+    {
+        return gathered_ ? frames_[result_].batch : frames_[result_].slots;
+    }
+
+    /**
+     * @brief Ids 0..num_env_-1.
+     */
+    std::vector<int> all_env_ids(void) const
+    {
+        std::vector<int> ids(num_env_);
         for (int i = 0; i < num_env_; ++i)
         {
-            data_bcq[i]->wait_dequeue(states[i]);
+            ids[i] = i;
         }
-        return std::move(states);
+        return ids;
+    }
+
+    /**
+     * @brief Pointer to the observation slot env `i` last wrote into.
+     */
+    uint8_t *obs(const int i)
+    {
+        return frames_[target_[i]].obs + i * obs_size_;
     }
 
     /**
@@ -187,18 +1077,100 @@ public:
      */
     void reset(void)
     {
+        reset(all_env_ids());
+    }
+
+    /**
+     * @brief Reset Method (addressed)
+     *
+     * Resets only the environments listed in `env_id`, e.g. the ones that
+     * finished their episode, while the others keep their state.
+     *
+     * @param env_id   Ids of the environments to reset.
+     *
+     * @throws std::runtime_error if an env is addressed twice or still in flight.
+     */
+    void reset(const std::vector<int> &env_id)
+    {
+        check_shards();
+        const int frame = writable();
+        claim(env_id);
         action_t empty_action(true);
+        for (std::size_t k = 0; k < env_id.size(); ++k)
+        {
+            submit(env_id[k], empty_action, frame);
+        }
+    }
+
+    /**
+     * @brief Seed Method
+     *
+     * Reseeds every environment's random stream from `seed`. The envs' next
+     * resets start the new streams, so seed() followed by reset() reproduces a
+     * run exactly.
+     *
+     * @param seed   Pool seed; env i uses stream (seed, i).
+     *
+     * @throws std::runtime_error if an env still has an action in flight.
+     */
+    void seed(const uint64_t seed)
+    {
+        if (std::find(busy_.begin(), busy_.end(), 1) != busy_.end())
+        {
+            throw std::runtime_error("Cannot seed while envs have actions in flight; recv() them first.");
+        }
         for (int i = 0; i < num_env_; ++i)
         {
-            action_bcq[i]->enqueue(empty_action);
+            envs_[i].seed(seed, i);
+        }
+        for (const std::unique_ptr<shard_t> &sh : shards_)
+        {
+            command_t c;
+            c.type = command_t::SEED;
+            c.seed = seed;
+            sh->commands.push(c);
         }
     }
 
+    /**
+     * @brief Write every step recorded so far to the trajectory file (see init_t::record).
+     *
+     * @throws std::runtime_error if an env still has an action in flight or the file cannot be written.
+     */
+    void flush_record(void)
+    {
+        if (std::find(busy_.begin(), busy_.end(), 1) != busy_.end())
+        {
+            throw std::runtime_error("Cannot flush the recording while envs have actions in flight; recv() them first.");
+        }
+        if (recorder_)
+        {
+            recorder_->flush();
+        }
+    }
+
+    /**
+     * @brief Per-phase latency summary since the last reset_stats(), indexed by Phase.
+     */
+    std::vector<PhaseStats> get_stats(void)
+    {
+        return init.stats->summary();
+    }
+
+    /**
+     * @brief Start a new stats window.
+     */
+    void reset_stats(void)
+    {
+        init.stats->reset();
+    }
+
     /**
      * @brief Destructor for EnvPool
      *
      * Initiates a controlled shutdown of the asynchronous environment pool.
-     * Signals worker threads to stop, enqueues termination actions, and joins threads.
+     * Lets in-flight steps finish, joins the worker threads (stops the shard
+     * processes) and frees the queues.
      *
      * @note Call explicitly to ensure proper resource release and shutdown.
      *
@@ -206,18 +1178,29 @@ public:
      */
     ~EnvPool()
     {
-        stop_ = 1;
-        action_t empty_actions(true);
-        for (int i = 0; i < num_env_; ++i)
+        stopping_.store(true);
+        for (const std::unique_ptr<shard_t> &sh : shards_)
+        {
+            sh->completions.wake();
+            sh->collector.join();
+        }
+        for (const std::unique_ptr<shard_t> &sh : shards_)
         {
-            action_bcq[i]->enqueue(empty_actions);
+            if (sh->status.load() == -1)
+            {
+                command_t c;
+                c.type = command_t::STOP;
+                sh->commands.push(c);
+            }
         }
-        for (auto &worker : workers_)
+        for (const std::unique_ptr<shard_t> &sh : shards_)
         {
-            if (worker.joinable())
+            if (sh->status.load() == -1)
             {
-                worker.join();
+                waitpid(sh->pid, nullptr, 0);
             }
         }
+        workers_.reset();
+        recorder_.reset(); // nothing appends any more; flushes the last buffers
     }
 };
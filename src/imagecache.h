@@ -0,0 +1,171 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include <vips/vips8>
+
+/**
+ * @brief Counters reported by ImageCache::stats().
+ */
+struct CacheStats
+{
+    uint64_t hits = 0;      ///< Lookups served from the cache
+    uint64_t misses = 0;    ///< Lookups that opened the file
+    uint64_t evictions = 0; ///< Entries dropped to stay within the budget
+    std::size_t bytes = 0;  ///< Estimated bytes held by the cached entries
+    std::size_t entries = 0; ///< Number of cached images
+};
+
+/**
+ * ImageCache
+ *
+ * Pool-wide, thread-safe LRU cache of opened images keyed by file path (and
+ * page or subifd for the levels of a pyramid). Each
+ * entry is the image wrapped in a threaded libvips tile cache, so the parsed
+ * header and the decoded tiles are shared by every env that reads the file.
+ * An entry is charged for its full tile cache (tiles_per_image decoded tiles)
+ * plus a fixed header cost, and least recently used entries are evicted once
+ * the total exceeds the byte budget.
+ *
+ * Evicting an entry only drops the cache's reference; envs still holding the
+ * VImage keep using it until their next reset.
+ *
+ * @see ImageCache::get() for opening a file through the cache.
+ * @see ImageCache::stats() for the hit/miss/eviction counters.
+ */
+class ImageCache
+{
+private:
+    ImageCache(const ImageCache &) = delete;
+    ImageCache &operator=(const ImageCache &) = delete;
+
+    struct Entry
+    {
+        vips::VImage image;                   ///< Tile-cached image
+        std::size_t bytes = 0;                ///< Charge against the budget
+        std::list<std::string>::iterator pos; ///< Position in lru_
+    };
+
+    std::mutex m_;                                  /**< Guards everything below. */
+    std::list<std::string> lru_;                    /**< Keys, most recently used first. */
+    std::unordered_map<std::string, Entry> map_;    /**< Key -> entry. */
+    std::size_t bytes_ = 0;                         /**< Sum of Entry::bytes. */
+    CacheStats stats_;                              /**< Counters (bytes/entries filled in stats()). */
+
+    /**
+     * @brief Drop least recently used entries until the budget is met, keeping at least `keep`.
+     */
+    void evict(const std::size_t keep)
+    {
+        while (bytes_ > budget && map_.size() > keep)
+        {
+            auto it = map_.find(lru_.back());
+            bytes_ -= it->second.bytes;
+            map_.erase(it);
+            lru_.pop_back();
+            stats_.evictions += 1;
+        }
+    }
+
+public:
+    const std::size_t budget;       ///< Byte budget of the cache
+    const int tile_size;            ///< Edge of a cached tile in pixels
+    const int tiles_per_image;      ///< Decoded tiles kept per image
+    static const std::size_t header_bytes = 64 * 1024; ///< Charge for an open file without tiles
+
+    /**
+     * @brief Constructor for ImageCache
+     *
+     * @param budget_bytes     Byte budget of the cache.
+     * @param tile_size        Edge of a cached tile in pixels.
+     * @param tiles_per_image  Decoded tiles kept per image.
+     */
+    ImageCache(const std::size_t budget_bytes, const int tile_size = 256, const int tiles_per_image = 64)
+        : budget(budget_bytes), tile_size(tile_size), tiles_per_image(tiles_per_image) {}
+
+    /**
+     * @brief Get the image at `path`, opening and caching it on a miss.
+     *
+     * The file is opened without holding the cache lock, so misses on different
+     * files proceed in parallel.
+     *
+     * @param path  File path.
+     * @param field Load option selecting a sub-image ("page" or "subifd"), or nullptr.
+     * @param value Value of `field`.
+     * @return Tile-cached image, safe to read from several threads.
+     */
+    vips::VImage get(const std::string &path, const char *field = nullptr, const int value = 0)
+    {
+        const std::string key = field ? path + "#" + field + "=" + std::to_string(value) : path;
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            auto it = map_.find(key);
+            if (it != map_.end())
+            {
+                lru_.splice(lru_.begin(), lru_, it->second.pos);
+                stats_.hits += 1;
+                return it->second.image;
+            }
+            stats_.misses += 1;
+        }
+
+        vips::VOption *options = vips::VImage::option()->set("access", VIPS_ACCESS_RANDOM);
+        if (field)
+        {
+            options->set(field, value);
+        }
+        vips::VImage file = vips::VImage::new_from_file(path.c_str(), options);
+        vips::VImage image = file.tilecache(vips::VImage::option()
+                                                ->set("tile_width", tile_size)
+                                                ->set("tile_height", tile_size)
+                                                ->set("max_tiles", tiles_per_image)
+                                                ->set("access", VIPS_ACCESS_RANDOM)
+                                                ->set("threaded", true));
+        const std::size_t pel = static_cast<std::size_t>(image.bands()) * vips_format_sizeof(image.format());
+        const std::size_t bytes = header_bytes + static_cast<std::size_t>(tiles_per_image) * tile_size * tile_size * pel;
+
+        std::lock_guard<std::mutex> lock(m_);
+        auto it = map_.find(key);
+        if (it != map_.end())
+        {
+            // another env opened it meanwhile; share theirs
+            lru_.splice(lru_.begin(), lru_, it->second.pos);
+            return it->second.image;
+        }
+        lru_.push_front(key);
+        Entry &e = map_[key];
+        e.image = image;
+        e.bytes = bytes;
+        e.pos = lru_.begin();
+        bytes_ += bytes;
+        evict(1);
+        return image;
+    }
+
+    /**
+     * @brief Snapshot of the cache counters.
+     */
+    CacheStats stats(void)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        CacheStats s = stats_;
+        s.bytes = bytes_;
+        s.entries = map_.size();
+        return s;
+    }
+
+    /**
+     * @brief Drop every entry and zero the counters.
+     */
+    void clear(void)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        map_.clear();
+        lru_.clear();
+        bytes_ = 0;
+        stats_ = CacheStats();
+    }
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <cstdint>
+
+#include "threadpool.h"
+
+/**
+ * @brief Counters reported by Prefetcher::stats().
+ */
+struct PrefetchStats
+{
+    uint64_t resets = 0; ///< Resets served by the prefetcher
+    uint64_t waited = 0; ///< Resets whose episode was not ready yet
+};
+
+/**
+ * Prefetcher
+ *
+ * Shared pool of I/O threads on which envs open and warm the images of their
+ * upcoming episodes while the current episode runs. Each env keeps up to
+ * `depth` episodes in flight and reset() just takes the oldest one.
+ *
+ * The threads start on the first submit(), so a pool can fork its shard
+ * processes (see init_t::num_procs) after creating the prefetcher and each
+ * process gets threads of its own.
+ *
+ * @see VipsEnv::_next_episode() for the env side.
+ */
+class Prefetcher
+{
+private:
+    Prefetcher(const Prefetcher &) = delete;
+    Prefetcher &operator=(const Prefetcher &) = delete;
+
+    const int num_threads_;         /**< Requested I/O threads. */
+    std::once_flag started_;        /**< Starts io_ on first use. */
+    std::unique_ptr<ThreadPool> io_; /**< I/O threads. */
+    std::atomic<uint64_t> resets_; /**< See PrefetchStats::resets. */
+    std::atomic<uint64_t> waited_; /**< See PrefetchStats::waited. */
+
+public:
+    const int depth; ///< Episodes each env keeps in flight
+
+    /**
+     * @brief Constructor for Prefetcher
+     *
+     * @param num_threads  Number of I/O threads (0 = hardware concurrency).
+     * @param depth        Episodes each env keeps in flight.
+     */
+    Prefetcher(const int num_threads, const int depth) : num_threads_(num_threads), resets_(0), waited_(0), depth(depth) {}
+
+    /**
+     * @brief Run `f` on an I/O thread.
+     *
+     * @return Future of f's result; exceptions thrown by f are rethrown by get().
+     */
+    template <typename T, typename F>
+    std::future<T> submit(F f)
+    {
+        auto task = std::make_shared<std::packaged_task<T()>>(f);
+        std::future<T> result = task->get_future();
+        std::call_once(started_, [this]
+                       { io_.reset(new ThreadPool(num_threads_)); });
+        io_->submit([task]
+                   { (*task)(); });
+        return result;
+    }
+
+    /**
+     * @brief Record one reset and whether it had to wait for its episode.
+     */
+    void count(const bool waited)
+    {
+        resets_.fetch_add(1);
+        if (waited)
+        {
+            waited_.fetch_add(1);
+        }
+    }
+
+    /**
+     * @brief Snapshot of the counters.
+     */
+    PrefetchStats stats(void) const
+    {
+        PrefetchStats s;
+        s.resets = resets_.load();
+        s.waited = waited_.load();
+        return s;
+    }
+};
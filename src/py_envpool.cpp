@@ -3,6 +3,10 @@
 #include <utility>
 #include <cstdlib>
 #include <cstdint>
+#include <cmath>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
 #include <vips/vips8>
 
 #include <pybind11/pybind11.h>
@@ -10,156 +14,550 @@
 #include <pybind11/stl.h>
 
 #include "vipsenv.h"
+#include "tiledenv.h"
+#include "replayenv.h"
 #include "envpool.h"
+#include "syncpool.h"
 
 using namespace vips;
 using namespace pybind11::literals;
 
 namespace py = pybind11;
 
+/**
+ * Validate a (N, A) float32 action buffer, A >= 2.
+ *
+ * Checked once per batch, with the GIL held.
+ */
+void CheckActions(const py::buffer_info &info)
+{
+    if (info.format != py::format_descriptor<float>::format() || info.itemsize != sizeof(float))
+    {
+        throw py::type_error("action must be a float32 array, got format '" + info.format + "'.");
+    }
+    if (info.ndim != 2 || info.shape[1] < 2)
+    {
+        throw py::value_error("action must have shape (N, A) with A >= 2.");
+    }
+}
+
+/**
+ * Read a (N, A) float32 action buffer into `ret`; safe without the GIL.
+ *
+ * Columns are (x, y[, level]); strides are honored, so slices need no copy.
+ * The level is clamped to [0, 65536] before it is converted to int.
+ *
+ * @throws std::invalid_argument (ValueError) for a NaN or infinite value.
+ */
 template <typename action_t>
-void ToActionT(const std::vector<py::array> &py_arrs, std::vector<action_t> &ret)
+void ToActionT(const py::buffer_info &info, std::vector<action_t> &ret)
+{
+    const char *base = static_cast<const char *>(info.ptr);
+    const py::ssize_t n = info.shape[0], a = info.shape[1];
+    const py::ssize_t row = info.strides[0], col = info.strides[1];
+    ret.resize(n);
+    for (py::ssize_t i = 0; i < n; ++i)
+    {
+        const char *p = base + i * row;
+        const float x = *reinterpret_cast<const float *>(p), y = *reinterpret_cast<const float *>(p + col);
+        const float level = a > 2 ? *reinterpret_cast<const float *>(p + 2 * col) : 0.0f;
+        if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(level))
+        {
+            throw std::invalid_argument("action row " + std::to_string(i) + " is not finite.");
+        }
+        ret[i].val = std::make_pair(x, y);
+        ret[i].level = static_cast<int>(std::max(0.0f, std::min(level, 65536.0f)));
+    }
+}
+
+/**
+ * Split a {file path: class index} dict into lists.
+ */
+void ToLists(const py::dict &dataset, std::vector<std::string> &files, std::vector<int> &classes)
 {
-    // Iterate through the outer tuple
-    for (int i = 0; i < py_arrs.size(); ++i)
+    files.reserve(dataset.size());
+    classes.reserve(dataset.size());
+    for (auto &item : dataset)
     {
-        py::tuple innerTuple = py_arrs[i].cast<py::tuple>();
+        files.emplace_back(item.first.cast<std::string>());
+        classes.emplace_back(item.second.cast<int>());
+    }
+}
 
-        // Extract values from the inner tuple
-        ret[i].val = std::make_pair(innerTuple[0].cast<float>(), innerTuple[1].cast<float>());
+/**
+ * Annotation file of every dataset file, from a list in dataset order or a
+ * {file path: annotation path} dict (files missing from it have none).
+ */
+std::vector<std::string> ToAnnotationPaths(const py::object &annotations, const Dataset &dataset)
+{
+    std::vector<std::string> paths(dataset.size());
+    if (py::isinstance<py::dict>(annotations))
+    {
+        const py::dict d = annotations.cast<py::dict>();
+        for (std::size_t i = 0; i < dataset.size(); ++i)
+        {
+            const py::str file(dataset.path(i));
+            if (d.contains(file) && !d[file].is_none())
+            {
+                paths[i] = d[file].cast<std::string>();
+            }
+        }
+        return paths;
     }
+    const py::list l = annotations.cast<py::list>();
+    if (l.size() != dataset.size())
+    {
+        throw py::value_error("annotations must have one entry per dataset file.");
+    }
+    for (std::size_t i = 0; i < dataset.size(); ++i)
+    {
+        paths[i] = l[i].is_none() ? std::string() : l[i].cast<std::string>();
+    }
+    return paths;
 }
 
-py::array_t<float> convert_to_pyarray(const std::vector<uint8_t> &input_vector, size_t height, size_t width, size_t num_channels)
+/**
+ * Augmentation spec from a dict with any of the AugmentSpec fields.
+ */
+AugmentSpec ToAugmentSpec(const py::dict &d)
 {
-    // Ensure the vector size matches the expected size
-    size_t expected_size = height * width * num_channels;
-    if (input_vector.size() != expected_size)
+    AugmentSpec a;
+    for (const auto &item : d)
     {
-        throw std::runtime_error("Input vector size does not match the expected size.");
+        const std::string key = item.first.cast<std::string>();
+        if (key == "flip_x")
+            a.flip_x = item.second.cast<float>();
+        else if (key == "flip_y")
+            a.flip_y = item.second.cast<float>();
+        else if (key == "rot90")
+            a.rot90 = item.second.cast<float>();
+        else if (key == "brightness")
+            a.brightness = item.second.cast<float>();
+        else if (key == "contrast")
+            a.contrast = item.second.cast<float>();
+        else if (key == "per_channel")
+            a.per_channel = item.second.cast<bool>();
+        else
+            throw py::value_error("Unknown augmentation '" + key + "'.");
     }
+    return a;
+}
 
-    // Assuming the data is stored contiguously
-    std::vector<size_t> shape = {num_channels, height, width};
-    std::vector<size_t> strides = {height * width * sizeof(uint8_t), width * sizeof(uint8_t), sizeof(uint8_t)};
+/**
+ * Augmentation specs from None, one dict (every env) or a list of dicts (one per env).
+ */
+std::vector<AugmentSpec> ToAugmentSpecs(const py::object &augment)
+{
+    std::vector<AugmentSpec> specs;
+    if (augment.is_none())
+    {
+        return specs;
+    }
+    if (py::isinstance<py::dict>(augment))
+    {
+        specs.push_back(ToAugmentSpec(augment.cast<py::dict>()));
+        return specs;
+    }
+    for (const py::handle &h : augment.cast<py::list>())
+    {
+        specs.push_back(ToAugmentSpec(h.cast<py::dict>()));
+    }
+    return specs;
+}
 
-    // Create a new py::array_t<float> with the correct dimensions and strides
-    // The data pointer is obtained from the address of the first element of the input vector
-    return py::array_t<uint8_t>(
-        shape,
-        strides,
-        input_vector.data() // pointer to the first element of the input vector
-    );
+/**
+ * NumPy dtype of the observations.
+ */
+py::dtype ToDtype(const ObsDtype dtype)
+{
+    switch (dtype)
+    {
+    case ObsDtype::FLOAT32:
+        return py::dtype::of<float>();
+    case ObsDtype::FLOAT16:
+        return py::dtype("float16");
+    default:
+        return py::dtype::of<uint8_t>();
+    }
 }
 
-void ToNumpy(std::vector<py::array> &dat, const std::vector<data_t> &input_vector, size_t height, size_t width, size_t num_channels)
+/**
+ * Wrap a pool observation buffer as a (num_env, C, H, W) array without copying,
+ * or (num_env, history, C, H, W) when the pool keeps a history.
+ *
+ * @param buf Pointer to the first byte of the pool observation buffer.
+ * @param dtype Element type of the buffer.
+ * @param history Observations per env (init_t::history_len).
+ * @param base Python object that owns the buffer; kept alive by the array.
+ */
+py::array ToNumpy(uint8_t *buf, const py::dtype &dtype, size_t num_env, size_t history, size_t num_channels, size_t height, size_t width, py::handle base)
 {
-    for (int i = 0; i < input_vector.size(); ++i)
+    const size_t item = dtype.itemsize();
+    const size_t view = num_channels * height * width * item;
+    std::vector<size_t> shape = {num_env, num_channels, height, width};
+    std::vector<size_t> strides = {history * view, height * width * item, width * item, item};
+    if (history > 1)
     {
-        dat[i] = convert_to_pyarray(input_vector[i].obs.array, height, width, num_channels);
+        shape.insert(shape.begin() + 1, history);
+        strides.insert(strides.begin() + 1, view);
     }
+    return py::array(dtype, shape, strides, buf, base);
 }
 
+/**
+ * Wrap `n` elements of a pool-owned array as a 1-D array without copying.
+ *
+ * @param dtype Element type; defaults to the one of T.
+ * @param base Python object that owns the buffer; kept alive by the array.
+ */
+template <typename T>
+py::array ToNumpy(const T *buf, size_t n, py::handle base, const py::dtype &dtype = py::dtype::of<T>())
+{
+    return py::array(dtype, std::vector<size_t>{n}, std::vector<size_t>{sizeof(T)}, buf, base);
+}
 
 /**
- * AsyncVipsEnv class
+ * Owner of the arrays of one recv() batch: releases the batch's pool buffer
+ * once the last of them is freed.
  *
- * Class binds C++ Envpool<VipsEnv> with PyBind11 types.
+ * @param pool Pool the batch came from.
+ * @param lease Lease token of the batch (0 = holds no buffer; `owner` is returned as is).
+ * @param owner Python object that owns the pool; kept alive by the returned object.
  */
-class AsyncVipsEnv
+template <class pool_t>
+py::object ToOwner(pool_t &pool, const uint64_t lease, const py::object &owner)
+{
+    if (lease == 0)
+    {
+        return owner;
+    }
+    struct hold
+    {
+        py::object owner;
+        pool_t *pool;
+        uint64_t lease;
+    };
+    return py::capsule(new hold{owner, &pool, lease}, [](void *p)
+                       {
+                           hold *h = static_cast<hold *>(p);
+                           h->pool->release(h->lease);
+                           delete h; });
+}
+
+/**
+ * AsyncEnv class
+ *
+ * Class binds C++ Envpool<env_t> (or SyncEnvPool<env_t>) with PyBind11 types,
+ * for each env backend (VipsEnv, TiledEnv and their ReplayEnv).
+ */
+template <class env_t, template <class, typename, typename, typename> class pool_t = EnvPool>
+class AsyncEnv
 {
 public:
-    EnvPool<VipsEnv, action_t, data_t, init_t> env_pool; ///< Environment pool instance.
+    pool_t<env_t, action_t, data_t, init_t> env_pool; ///< Environment pool instance.
+    std::vector<data_t> states;                          ///< Reused per-step state storage.
+    std::vector<action_t> actions;                       ///< Reused per-send action storage.
 
     /**
-     * Constructor for AsyncVipsEnv.
+     * Constructor for AsyncEnv.
      *
      * @param num_env Number of environments in the pool.
-     * @param dataset Dictionary containing file paths and corresponding class indices.
+     * @param dataset Dictionary of file paths to class indices, or the path of a dataset manifest (None with `replay`).
      * @param view_sz Tuple representing the view size (height, width).
      * @param max_episode_len Maximum length of an episode.
+     * @param num_threads Number of worker threads (0 = one per core, at most num_env).
+     * @param affinity CPU pinning policy of the worker threads.
+     * @param cpus CPU ids used with Affinity.EXPLICIT.
+     * @param batch_size Envs returned per recv (0 = num_env; smaller enables async mode).
+     * @param cache_bytes Byte budget of the shared image cache (0 = no cache).
+     * @param prefetch_depth Upcoming episodes each env opens ahead of time (0 = open in reset).
+     * @param prefetch_threads I/O threads of the prefetcher (0 = one per core).
+     * @param num_levels Pyramid levels reachable with the level action (1 = full resolution only).
+     * @param dtype Element type of the observations.
+     * @param mean Per-channel mean in [0, 1] units subtracted for float dtypes.
+     * @param stddev Per-channel std in [0, 1] units divided by for float dtypes.
+     * @param seed Pool seed (-1 = nondeterministic).
+     * @param schedule_group Envs that share a file (0 = every env draws its own files).
+     * @param schedule_window Episodes each env plays on a shared file.
+     * @param weights Per-file sampling weights (empty = uniform).
+     * @param balanced Weight files so that every class is equally likely.
+     * @param num_buffers Observation buffers in the ring; with more than one every batch holds a buffer until released.
+     * @param history_len Observations kept per env; obs gains a history axis when more than one.
+     * @param num_procs Processes the envs are sharded across (0 = threads of this process).
+     * @param wait How workers wait for actions and recv for results.
+     * @param annotations Annotation file per dataset file, as a list or a {file path: annotation path} dict (None = no rewards).
+     * @param reward Reward computed from the annotations.
+     * @param record Trajectory file every step is appended to ("" = not recorded).
+     * @param record_compress zlib-compress the trajectory file.
+     * @param replay Trajectory file served by the replay backends ("" = none); its files are the dataset.
+     * @param augment Augmentation of every env (dict) or of each env (list of dicts), None = none.
      */
-    AsyncVipsEnv(const int &num_env, const py::dict &dataset, const py::tuple &view_sz, const int &max_episode_len)
-        : env_pool([num_env, dataset, view_sz, max_episode_len]()
+    AsyncEnv(const int &num_env, const py::object &dataset, const py::tuple &view_sz, const int &max_episode_len,
+             const int &num_threads, const Affinity &affinity, const std::vector<int> &cpus, const int &batch_size,
+             const std::size_t &cache_bytes, const int &prefetch_depth, const int &prefetch_threads,
+             const int &num_levels, const ObsDtype &dtype, const std::vector<float> &mean, const std::vector<float> &stddev,
+             const int64_t &seed, const int &schedule_group, const int &schedule_window, const std::vector<double> &weights,
+             const bool &balanced, const int &num_buffers, const int &history_len, const int &num_procs,
+             const WaitPolicy &wait, const py::object &annotations, const RewardMode &reward,
+             const std::string &record, const bool &record_compress, const std::string &replay, const py::object &augment)
+        : env_pool([&]()
                    {
                         init_t init;
-                        for (auto &item : dataset)
+                        if (!replay.empty())
                         {
-                            /* dict keys are file paths, values are class_idx */
-                            const std::string &key = item.first.cast<std::string>();
-                            const int &value = item.second.cast<int>();
-
-                            init.files.emplace_back(key);
-                            init.classes.emplace_back(value);
+                            init.replay = Trajectory::open(replay);
+                        }
+                        if (dataset.is_none() && init.replay)
+                        {
+                            init.dataset = Dataset::from_lists(init.replay->meta().files, init.replay->meta().classes);
+                        }
+                        else if (py::isinstance<py::str>(dataset))
+                        {
+                            init.dataset = Dataset::open(dataset.cast<std::string>());
+                        }
+                        else
+                        {
+                            std::vector<std::string> files;
+                            std::vector<int> classes;
+                            ToLists(dataset.cast<py::dict>(), files, classes);
+                            init.dataset = Dataset::from_lists(files, classes);
                         }
 
                         init.view_sz = view_sz.cast<std::pair<int, int>>();
                         init.max_episode_len = max_episode_len - 1;
                         init.num_env = num_env;
+                        init.num_threads = num_threads;
+                        init.affinity = affinity;
+                        init.cpus = cpus;
 
-                        return init; }()) {}
+                        init.batch_size = batch_size;
+                        if (cache_bytes > 0)
+                        {
+                            init.cache = std::make_shared<ImageCache>(cache_bytes);
+                        }
+                        init.num_levels = init.replay ? init.replay->meta().num_levels : std::max(1, num_levels);
+                        init.dtype = dtype;
+                        init.mean = mean;
+                        init.stddev = stddev;
+                        init.seed = seed;
+                        init.num_buffers = std::max(1, num_buffers);
+                        init.history_len = std::max(1, history_len);
+                        init.num_procs = std::max(0, num_procs);
+                        init.wait = wait;
+                        if (!annotations.is_none())
+                        {
+                            init.annotations = std::make_shared<Annotations>(ToAnnotationPaths(annotations, *init.dataset));
+                            init.reward = reward;
+                        }
+                        init.record = record;
+                        init.record_compress = record_compress;
+                        init.augment = ToAugmentSpecs(augment);
+                        if (schedule_group > 0 || !weights.empty() || balanced)
+                        {
+                            init.scheduler = std::make_shared<EpisodeScheduler>(init.dataset, num_env, std::max(1, schedule_group), schedule_window,
+                                                                                balanced ? EpisodeScheduler::balanced_weights(*init.dataset) : weights);
+                        }
+                        if (prefetch_depth > 0)
+                        {
+                            init.prefetch = std::make_shared<Prefetcher>(prefetch_threads, prefetch_depth);
+                        }
+
+                        return init; }()), states(env_pool.batch_size_) {}
 
     /**
      * py api
+     *
+     * Steps every env, or only the envs in `env_id` (action[k] goes to env_id[k]).
      */
-    void PySend(const std::vector<py::array> &action)
+    void PySend(const py::buffer &action, const py::array_t<int, py::array::c_style | py::array::forcecast> &env_id)
     {
-        std::vector<action_t> arr(env_pool.num_env_);
-        ToActionT(action, arr);
+        const py::buffer_info info = action.request();
+        CheckActions(info);
+        if (env_id.ndim() != 1)
+        {
+            throw py::value_error("env_id must be one-dimensional.");
+        }
+        const int *ids = env_id.data();
+        const std::size_t num_ids = static_cast<std::size_t>(env_id.size());
+
         py::gil_scoped_release release;
-        env_pool.send(arr); // delegate to the c++ api
+        ToActionT(info, actions);
+        if (num_ids == 0)
+        {
+            env_pool.send(actions); // delegate to the c++ api
+        }
+        else
+        {
+            env_pool.send(actions, std::vector<int>(ids, ids + num_ids));
+        }
     }
 
     /**
      * py api
+     *
+     * Returns (obs, reward, terminated, truncated, info) of the envs sent since
+     * the last recv; info holds env_id, timestep, target and level arrays and
+     * the batch's buffer token, plus the newest array when the pool keeps a
+     * history (obs is then (N, history, C, H, W)). For a full synchronous batch obs is a zero-copy
+     * view of the observation buffer, otherwise it views the gathered batch; the
+     * same holds for the other arrays. With one buffer they are overwritten by
+     * the next step, copy them if they must outlive the next send(). With
+     * several, the batch's buffer is not reused until every array is freed or
+     * release(info["buffer"]) is called.
      */
-    std::vector<py::array> PyRecv(void)
+    py::tuple PyRecv(void)
     {
-        py::gil_scoped_release release;
+        {
+            py::gil_scoped_release release;
+            env_pool.recv(states);
+        }
+
+        const init_t &init = env_pool.init;
+        VIPSENV_TIME_PHASE(init.stats.get(), Phase::PY_RECV);
+        const size_t batch_size = states.size();
+        py::object base = ToOwner(env_pool, env_pool.lease(), py::cast(this));
+        py::array obs = ToNumpy(env_pool.batch_obs(), ToDtype(init.dtype), batch_size, env_pool.history_, init.channels, init.view_sz.first, init.view_sz.second, base);
 
-        std::vector<data_t> arr(env_pool.num_env_);
+        // step results were laid out as arrays by the workers; only views are created here
+        const StepArrays &a = env_pool.batch_arrays();
+        py::dict info("env_id"_a = ToNumpy(a.env_id.data(), batch_size, base),
+                      "timestep"_a = ToNumpy(a.timestep.data(), batch_size, base),
+                      "target"_a = ToNumpy(a.target.data(), batch_size, base),
+                      "level"_a = ToNumpy(a.level.data(), batch_size, base),
+                      "buffer"_a = env_pool.lease());
+        if (env_pool.history_ > 1)
         {
-            arr = env_pool.recv();
+            info["newest"] = ToNumpy(a.newest.data(), batch_size, base);
         }
+        return py::make_tuple(obs, ToNumpy(a.reward.data(), batch_size, base),
+                              ToNumpy(a.terminated.data(), batch_size, base, py::dtype::of<bool>()),
+                              ToNumpy(a.truncated.data(), batch_size, base, py::dtype::of<bool>()), info);
+    }
 
-        // // Create reward, done, and truncated arrays
-        // py::array_t<float> rewards({env_pool.num_env_}, {sizeof(float)});
-        // py::array_t<bool> dones({env_pool.num_env_}, {sizeof(bool)});
-        // py::array_t<bool> truncated({env_pool.num_env_}, {sizeof(bool)});
+    /**
+     * py api
+     *
+     * Give the buffer of a recv() batch back to the pool; its arrays must not be read afterwards.
+     */
+    bool PyRelease(const uint64_t buffer)
+    {
+        return env_pool.release(buffer);
+    }
 
-        // auto rewards_unchecked = rewards.mutable_unchecked<1>();
-        // auto dones_unchecked = dones.mutable_unchecked<1>();
-        // auto truncated_unchecked = truncated.mutable_unchecked<1>();
+    /**
+     * py api
+     *
+     * Counters of the shared image cache (all zero without a cache).
+     */
+    py::dict PyCacheStats(void)
+    {
+        CacheStats stats;
+        if (env_pool.init.cache)
+        {
+            stats = env_pool.init.cache->stats();
+        }
+        return py::dict("hits"_a = stats.hits, "misses"_a = stats.misses, "evictions"_a = stats.evictions,
+                        "bytes"_a = stats.bytes, "entries"_a = stats.entries);
+    }
 
-        // Create info dictionary
-        // py::dict info_dict;
-        std::vector<py::array> ret;
-        ret.reserve(env_pool.num_env_);
-        // py::gil_scoped_acquire acquire;
-        // ToNumpy(ret, arr, (size_t) env_pool.init.view_sz.first, (size_t) env_pool.init.view_sz.second, 3);
+    /**
+     * py api
+     *
+     * Latency of each phase of the worker loop since the last reset_stats(),
+     * as {phase: {count, total_us, p50_us, p90_us, p99_us, max_us}}.
+     */
+    py::dict PyGetStats(void)
+    {
+        const std::vector<PhaseStats> stats = env_pool.get_stats();
+        py::dict out;
+        for (int p = 0; p < static_cast<int>(Phase::COUNT); ++p)
+        {
+            const PhaseStats &s = stats[p];
+            out[phase_name(static_cast<Phase>(p))] = py::dict("count"_a = s.count, "total_us"_a = s.total_us, "p50_us"_a = s.p50_us,
+                                                              "p90_us"_a = s.p90_us, "p99_us"_a = s.p99_us, "max_us"_a = s.max_us);
+        }
+        return out;
+    }
 
-        // // Stack observations arrays
-        // for (int e = 0; e < env_pool.num_env_; e++)
-        // {
-        //     rewards_unchecked(e) = arr[e].reward;
-        //     dones_unchecked(e) = arr[e].done;
-        //     truncated_unchecked(e) = arr[e].truncated;
+    /**
+     * py api
+     *
+     * Start a new stats window.
+     */
+    void PyResetStats(void)
+    {
+        env_pool.reset_stats();
+    }
 
-        //     std::string key = "env_" + std::to_string(e);
-        //     info_dict[&key[0]] = py::dict("timestep"_a = static_cast<int>(arr[e].info.timestep), "target"_a = static_cast<int>(arr[e].info.target));
-        // }
+    /**
+     * py api
+     *
+     * Counters of the episode scheduler (all zero without one); reuse is
+     * episodes per distinct image visit.
+     */
+    py::dict PyScheduleStats(void)
+    {
+        ScheduleStats stats;
+        if (env_pool.init.scheduler)
+        {
+            stats = env_pool.init.scheduler->stats();
+        }
+        const double reuse = stats.files ? static_cast<double>(stats.episodes) / stats.files : 0.0;
+        return py::dict("episodes"_a = stats.episodes, "files"_a = stats.files, "reuse"_a = reuse);
+    }
 
-        // return py::make_tuple(ret, info_dict);
-        return ret;
+    /**
+     * py api
+     *
+     * Counters of the prefetcher (all zero without prefetching).
+     */
+    py::dict PyPrefetchStats(void)
+    {
+        PrefetchStats stats;
+        if (env_pool.init.prefetch)
+        {
+            stats = env_pool.init.prefetch->stats();
+        }
+        return py::dict("resets"_a = stats.resets, "waited"_a = stats.waited);
     }
 
     /**
      * py api
+     *
+     * Reseeds every env's random stream; the next resets start the new streams.
      */
-    void PyReset(void)
+    void PySeed(const uint64_t seed)
+    {
+        env_pool.seed(seed);
+    }
+
+    /**
+     * py api
+     *
+     * Writes every step recorded so far to the trajectory file.
+     */
+    void PyFlushRecord(void)
     {
         py::gil_scoped_release release;
-        env_pool.reset();
+        env_pool.flush_record();
+    }
+
+    /**
+     * py api
+     *
+     * Resets every env, or only the envs in `env_id`.
+     */
+    void PyReset(const std::vector<int> &env_id)
+    {
+        py::gil_scoped_release release;
+        if (env_id.empty())
+        {
+            env_pool.reset();
+        }
+        else
+        {
+            env_pool.reset(env_id);
+        }
     }
 };
 
@@ -182,6 +580,116 @@ void shutdown(void)
     vips_shutdown();
 }
 
+/**
+ * Write a dataset manifest that AsyncVipsEnv can map instead of taking a dict.
+ *
+ * @param manifest Output path.
+ * @param dataset Dictionary containing file paths and corresponding class indices.
+ * @param probe Read each file's header to record its dimensions.
+ */
+void build_manifest(const std::string &manifest, const py::dict &dataset, const bool probe)
+{
+    std::vector<std::string> files;
+    std::vector<int> classes;
+    ToLists(dataset, files, classes);
+
+    py::gil_scoped_release release;
+    std::vector<std::pair<int, int>> dims;
+    if (probe)
+    {
+        dims.reserve(files.size());
+        for (const std::string &f : files)
+        {
+            dims.push_back(VipsEnv::probe(f));
+        }
+    }
+    Dataset::write(manifest, files, classes, dims);
+}
+
+/**
+ * Convert an image into the pre-tiled format read by AsyncTiledEnv.
+ *
+ * @param src Any file libvips can open.
+ * @param dst Output path.
+ * @param tile Tile edge in pixels.
+ * @param num_levels Maximum number of pyramid levels, including full resolution.
+ */
+void convert_tiled(const std::string &src, const std::string &dst, const int tile, const int num_levels)
+{
+    py::gil_scoped_release release;
+    TiledEnv::convert(src, dst, tile, num_levels);
+}
+
+/**
+ * Read a trajectory file into a dict of column arrays, one row per record in
+ * file order, plus the recording's files, classes and view size.
+ */
+py::dict load_trajectory(const std::string &path)
+{
+    std::shared_ptr<const Trajectory> t;
+    {
+        py::gil_scoped_release release;
+        t = Trajectory::open(path);
+    }
+    const std::vector<TrajectoryRecord> &r = t->records();
+    const py::ssize_t n = static_cast<py::ssize_t>(r.size());
+    py::array_t<uint32_t> env(n), seq(n);
+    py::array_t<int32_t> index(n), timestep(n), level(n), left(n), top(n);
+    py::array_t<float> action({n, py::ssize_t(2)}), reward(n);
+    py::array_t<bool> done(n), truncated(n), reset(n);
+    for (py::ssize_t k = 0; k < n; ++k)
+    {
+        env.mutable_at(k) = r[k].env;
+        seq.mutable_at(k) = r[k].seq;
+        index.mutable_at(k) = r[k].index;
+        timestep.mutable_at(k) = r[k].timestep;
+        level.mutable_at(k) = r[k].level;
+        left.mutable_at(k) = r[k].left;
+        top.mutable_at(k) = r[k].top;
+        action.mutable_at(k, 0) = r[k].action[0];
+        action.mutable_at(k, 1) = r[k].action[1];
+        reward.mutable_at(k) = r[k].reward;
+        done.mutable_at(k) = r[k].done != 0;
+        truncated.mutable_at(k) = r[k].truncated != 0;
+        reset.mutable_at(k) = r[k].reset != 0;
+    }
+    const TrajectoryMeta &m = t->meta();
+    return py::dict("env"_a = env, "seq"_a = seq, "index"_a = index, "timestep"_a = timestep, "level"_a = level,
+                    "left"_a = left, "top"_a = top, "action"_a = action, "reward"_a = reward, "done"_a = done,
+                    "truncated"_a = truncated, "reset"_a = reset, "files"_a = m.files, "classes"_a = m.classes,
+                    "view_sz"_a = py::make_tuple(m.view_h, m.view_w), "num_levels"_a = m.num_levels, "num_envs"_a = m.num_env);
+}
+
+/**
+ * Bind AsyncEnv<env_t, pool_t> as class `name` of module `m`.
+ */
+template <class env_t, template <class, typename, typename, typename> class pool_t = EnvPool>
+void bind_env(py::module &m, const char *name)
+{
+    typedef AsyncEnv<env_t, pool_t> py_env_t;
+    py::class_<py_env_t>(m, name)
+        .def(py::init<int, py::object, py::tuple, int, int, Affinity, std::vector<int>, int, std::size_t, int, int, int, ObsDtype, std::vector<float>, std::vector<float>, int64_t, int, int, std::vector<double>, bool, int, int, int, WaitPolicy, py::object, RewardMode, std::string, bool, std::string, py::object>(), py::arg("num_env"), py::arg("dataset"), py::arg("view_sz"), py::arg("max_episode_len"),
+             py::arg("num_threads") = 0, py::arg("affinity") = Affinity::COMPACT, py::arg("cpus") = std::vector<int>(), py::arg("batch_size") = 0, py::arg("cache_bytes") = 0,
+             py::arg("prefetch_depth") = 0, py::arg("prefetch_threads") = 0, py::arg("num_levels") = 1,
+             py::arg("dtype") = ObsDtype::UINT8, py::arg("mean") = std::vector<float>(), py::arg("std") = std::vector<float>(), py::arg("seed") = -1,
+             py::arg("schedule_group") = 0, py::arg("schedule_window") = 1, py::arg("weights") = std::vector<double>(), py::arg("balanced") = false, py::arg("num_buffers") = 1, py::arg("history_len") = 1, py::arg("num_procs") = 0, py::arg("wait") = WaitPolicy::ADAPTIVE,
+             py::arg("annotations") = py::none(), py::arg("reward") = RewardMode::NONE,
+             py::arg("record") = "", py::arg("record_compress") = true, py::arg("replay") = "", py::arg("augment") = py::none())
+        .def("send", &py_env_t::PySend, "Send a (N, 2|3) float32 action array to environment pool, optionally only to env_id.", py::arg("action"), py::arg("env_id") = py::array_t<int>(0))
+        .def("recv", &py_env_t::PyRecv, "Receive (obs, reward, terminated, truncated, info) of the next batch from environment pool.")
+        .def("release", &py_env_t::PyRelease, "Release the buffer of a recv() batch, see info[\"buffer\"].", py::arg("buffer"))
+        .def("cache_stats", &py_env_t::PyCacheStats, "Hit/miss/eviction counters of the shared image cache.")
+        .def("schedule_stats", &py_env_t::PyScheduleStats, "Episodes, distinct image visits and reuse factor of the episode scheduler.")
+        .def("prefetch_stats", &py_env_t::PyPrefetchStats, "Resets served by the prefetcher and how many had to wait.")
+        .def_property_readonly("dataset_size", [](const py_env_t &self)
+                               { return self.env_pool.init.dataset->size(); }, "Number of files in the dataset.")
+        .def("get_stats", &py_env_t::PyGetStats, "Per-phase latency histograms summary since the last reset_stats().")
+        .def("reset_stats", &py_env_t::PyResetStats, "Start a new stats window.")
+        .def("flush_record", &py_env_t::PyFlushRecord, "Write every step recorded so far to the trajectory file.")
+        .def("seed", &py_env_t::PySeed, "Reseed every env; env i draws from stream (seed, i).", py::arg("seed"))
+        .def("reset", &py_env_t::PyReset, "Reset environment pool, optionally only env_id.", py::arg("env_id") = std::vector<int>());
+}
+
 /**
  * Pybind11 module definition for the AsyncVipsEnv class.
  */
@@ -190,11 +698,36 @@ PYBIND11_MODULE(compiled, m)
     m.doc() = "AsyncVipsEnv";
 
     m.def("init", &init, "Initialize the Vips environment. Must be called before anything else (set file_name = sys.argv[0]).", py::arg("file_name"));
+    m.def("build_manifest", &build_manifest, "Write a dataset manifest from a {path: class} dict.", py::arg("manifest"), py::arg("dataset"), py::arg("probe") = true);
+    m.def("convert_tiled", &convert_tiled, "Convert an image into the pre-tiled format read by AsyncTiledEnv.", py::arg("src"), py::arg("dst"), py::arg("tile") = 256, py::arg("num_levels") = 1);
+    m.def("load_trajectory", &load_trajectory, "Read a trajectory file into a dict of numpy arrays (one row per recorded step).", py::arg("path"));
     m.def("shutdown", &shutdown, "Shutdown the Vips environment. Must be called at the end. Do not use this library beyond this point.");
 
-    py::class_<AsyncVipsEnv>(m, "AsyncVipsEnv")
-        .def(py::init<int, py::dict, py::tuple, int>(), py::arg("num_env"), py::arg("dataset"), py::arg("view_sz"), py::arg("max_episode_len"))
-        .def("send", &AsyncVipsEnv::PySend, "Send action vector to environment pool.", py::arg("action"))
-        .def("recv", &AsyncVipsEnv::PyRecv, "Receive step from environment pool.")
-        .def("reset", &AsyncVipsEnv::PyReset, "Reset environment pool.");
+    py::enum_<Affinity>(m, "Affinity", "CPU pinning policy of the worker threads.")
+        .value("NONE", Affinity::NONE)
+        .value("COMPACT", Affinity::COMPACT)
+        .value("SCATTER", Affinity::SCATTER)
+        .value("EXPLICIT", Affinity::EXPLICIT);
+
+    py::enum_<WaitPolicy>(m, "WaitPolicy", "How the workers wait for actions and recv for results.")
+        .value("BLOCK", WaitPolicy::BLOCK)
+        .value("ADAPTIVE", WaitPolicy::ADAPTIVE)
+        .value("SPIN", WaitPolicy::SPIN);
+
+    py::enum_<RewardMode>(m, "RewardMode", "Reward computed from the image annotations.")
+        .value("NONE", RewardMode::NONE)
+        .value("COVERAGE", RewardMode::COVERAGE)
+        .value("DISCOVERY", RewardMode::DISCOVERY);
+
+    py::enum_<ObsDtype>(m, "ObsDtype", "Element type of the observations.")
+        .value("UINT8", ObsDtype::UINT8)
+        .value("FLOAT32", ObsDtype::FLOAT32)
+        .value("FLOAT16", ObsDtype::FLOAT16);
+
+    bind_env<VipsEnv>(m, "AsyncVipsEnv");
+    bind_env<TiledEnv>(m, "AsyncTiledEnv");
+    bind_env<ReplayEnv<VipsEnv>>(m, "AsyncVipsReplayEnv");
+    bind_env<ReplayEnv<TiledEnv>>(m, "AsyncTiledReplayEnv");
+    bind_env<VipsEnv, SyncEnvPool>(m, "SyncVipsEnv");
+    bind_env<TiledEnv, SyncEnvPool>(m, "SyncTiledEnv");
 }
@@ -1,5 +1,4 @@
 import pprint
-import warnings
 from typing import (
     Any,
     Dict,
@@ -14,68 +13,287 @@ import gymnasium as gym
 
 from .envpool import EnvPool
 from vipsenvpool.compiled import AsyncVipsEnv as _AsyncVipsEnvCPP
+from vipsenvpool.compiled import AsyncTiledEnv as _AsyncTiledEnvCPP
+from vipsenvpool.compiled import AsyncVipsReplayEnv as _AsyncVipsReplayEnvCPP
+from vipsenvpool.compiled import AsyncTiledReplayEnv as _AsyncTiledReplayEnvCPP
+from vipsenvpool.compiled import SyncVipsEnv as _SyncVipsEnvCPP
+from vipsenvpool.compiled import SyncTiledEnv as _SyncTiledEnvCPP
+from vipsenvpool.compiled import Affinity, ObsDtype, RewardMode, WaitPolicy
 from vipsenvpool.compiled import init, shutdown
+from vipsenvpool.compiled import build_manifest, convert_tiled, load_trajectory
 
 init(__file__)
 
 class VipsEnvPool(EnvPool):
-    def __init__(self, num_envs: int, dataset: dict, view_sz: tuple, max_episode_len: int) -> None:
+    def __init__(
+        self,
+        num_envs: int,
+        dataset: Optional[Union[dict, str]],
+        view_sz: tuple,
+        max_episode_len: int,
+        num_threads: int = 0,
+        affinity: Union[str, List[int]] = "compact",
+        batch_size: int = 0,
+        cache_bytes: int = 0,
+        prefetch_depth: int = 0,
+        prefetch_threads: int = 0,
+        num_levels: int = 1,
+        dtype: str = "uint8",
+        mean: Optional[List[float]] = None,
+        std: Optional[List[float]] = None,
+        seed: Optional[int] = None,
+        schedule_group: int = 0,
+        schedule_window: int = 1,
+        sampling: Union[str, List[float]] = "uniform",
+        backend: str = "vips",
+        num_buffers: int = 1,
+        history_len: int = 1,
+        num_procs: int = 0,
+        wait: str = "adaptive",
+        annotations: Optional[Union[List[Optional[str]], Dict[str, str]]] = None,
+        reward: str = "none",
+        record: Optional[str] = None,
+        record_compress: bool = True,
+        replay: Optional[str] = None,
+        mode: str = "async",
+        augment: Optional[Union[Dict[str, Any], List[Dict[str, Any]]]] = None,
+    ) -> None:
+        """VipsEnvPool.
+
+        dataset: {file path: class id} dict, or the path of a manifest written by
+            build_manifest(). A manifest is memory-mapped and shared by all envs,
+            so startup time and memory do not grow with the number of files.
+            May be None with replay.
+        num_threads: worker threads stepping the envs (0 = one per core, at most num_envs).
+        affinity: "none", "compact", "scatter" or an explicit list of cpu ids.
+        batch_size: envs returned per recv (0 = num_envs). A smaller value enables
+            async mode: recv returns the first batch_size envs to finish and
+            info["env_id"] tells which ones; send actions back with that env_id.
+        cache_bytes: byte budget of an image cache shared by all envs, so resets
+            reuse already opened files and decoded tiles (0 = no cache).
+        prefetch_depth: upcoming episodes each env opens and warms on I/O threads
+            while the current one runs (0 = open in reset).
+        prefetch_threads: I/O threads of the prefetcher (0 = one per core).
+        num_levels: pyramid levels the agent can zoom through. With more than one,
+            actions are (x, y, level) and level 0 is full resolution; levels come
+            from the file's pyramid pages or are shrunk on load.
+        dtype: "uint8", "float32" or "float16" observations. Float observations
+            are scaled to [0, 1] by the worker threads while copying the crop.
+        mean, std: per-channel statistics in [0, 1] units; float observations
+            are standardized as (x / 255 - mean) / std.
+        seed: pool seed; env i samples its episodes from stream (seed, i), so
+            a seeded pool replays the same images and crops (None = random).
+        schedule_group: envs (consecutive ids) that play the same image at the
+            same time, so their reads hit the same cached file and tiles; groups
+            rotate through the dataset in shuffled epochs (0 = every env draws
+            its own images).
+        schedule_window: episodes each env plays on a shared image before its
+            group moves on.
+        sampling: "uniform", "balanced" (every class equally likely) or a list
+            of per-file weights, in dataset order.
+        backend: "vips" decodes crops with libvips; "tiled" reads files written
+            by convert_tiled() and copies crops straight from memory-mapped
+            raw tiles (cache_bytes and prefetch_depth are not used).
+        num_buffers: observation buffers the pool rotates through. With 1, the
+            arrays returned by recv/step are overwritten by the next step. With
+            more, each batch keeps its buffer until all of its arrays are freed
+            or release(info["buffer"]) is called, so the next step can run while
+            the learner still reads the previous batch; send raises once all
+            buffers are held.
+        history_len: glimpses kept per env. With k > 1 obs is (N, k, C, H, W):
+            each step overwrites only the oldest entry, and info["newest"] is
+            the index of the newest one, so the history in time order is
+            np.roll(obs[i], -(info["newest"][i] + 1), axis=0). Resets zero the
+            history.
+        num_procs: worker processes the envs are split across (0 = threads of
+            this process). Each process steps its share of the envs with its own
+            libvips, cache and share of num_threads; observations stay in shared
+            memory, so recv/step return the same arrays. A process that dies
+            (e.g. a crashing decoder) makes the next recv raise. Cache, schedule
+            and prefetch stats only cover this process then.
+        wait: how workers wait for actions and recv for results. "block"
+            sleeps right away; "adaptive" first spins for as long as that has
+            recently paid off, saving the wakeup latency when steps take
+            microseconds; "spin" never sleeps (lowest latency, but every worker
+            keeps a core busy while idle).
+        annotations: annotation file of each dataset file, as a list in dataset
+            order (None entries = not annotated) or a {file path: annotation
+            path} dict. An annotation is an image whose first band is non-zero
+            where labelled, or a ".txt"/".poly" file with one polygon per line
+            ("x0 y0 x1 y1 ..." in full-resolution pixels). Each is turned into
+            a summed-area table once, shared by all envs, so rewards cost a few
+            lookups per step.
+        reward: "none" (always 0), "coverage" (labelled fraction of the
+            glimpse) or "discovery" (labelled area first seen in the episode,
+            as a fraction of the glimpse). Needs annotations.
+        record: path of a trajectory file every step is appended to: env,
+            image, glimpse rect, action, reward and flags, 44 bytes a step.
+            Records are buffered per worker thread and written by a background
+            thread, so recording costs the hot path almost nothing; call
+            flush_record() to make the file complete while the pool runs. Read
+            it with load_trajectory().
+        record_compress: zlib-compress the trajectory file.
+        replay: path of a trajectory file to serve instead of sampling
+            episodes. Env i replays recorded env i (modulo the recorded envs):
+            every recorded glimpse is cropped again from its image and returned
+            with the recorded reward and flags; actions are ignored. view_sz
+            must match the recording, its pyramid levels replace num_levels (which
+            only sets the action width then), and dataset may be None to use
+            the recorded files.
+        mode: "async" steps the envs as tasks of a worker thread pool and
+            collects them through a completion queue. "sync" steps every env
+            inside recv with a fork-join team of num_threads threads that
+            includes the calling thread, without queues, which costs less per
+            batch when steps take microseconds or there are few envs. Sync
+            needs batch_size 0 or num_envs, num_buffers 1, num_procs 0 and no
+            replay.
+        augment: random augmentation of every glimpse, applied by the worker
+            threads while the crop is copied instead of in another pass over
+            the batch. A dict for all envs, or a list with one dict per env,
+            with any of: "flip_x", "flip_y" (flip probabilities), "rot90"
+            (probability of a rotation by 90, 180 or 270 degrees; square
+            view_sz only), "brightness" (offset drawn from [-b, b], in [0, 1]
+            units), "contrast" (gain drawn from [1 - c, 1 + c]) and
+            "per_channel" (draw brightness/contrast per channel). Draws come
+            from a per-env stream of the pool seed, so seeded runs repeat them.
+        """
         assert num_envs > 0, f"Number envs must be >= 1, got {num_envs}!"
-        assert isinstance(dataset, dict), f"dataset must be of type dict, got {type(dataset)}!"
-        assert len(dataset) > 0, f"Got empty dataset!"
-        for k, v in dataset.items():
-            if not (isinstance(k, str) and isinstance(v, int)):
-                raise ValueError(f"dataset key, value pair must be filename (type str) and class id (type int)!")
+        assert isinstance(dataset, (dict, str)) or (dataset is None and replay is not None), f"dataset must be a dict or a manifest path, got {type(dataset)}!"
+        if isinstance(dataset, dict):
+            assert len(dataset) > 0, f"Got empty dataset!"
+            for k, v in dataset.items():
+                if not (isinstance(k, str) and isinstance(v, int)):
+                    raise ValueError(f"dataset key, value pair must be filename (type str) and class id (type int)!")
 
         assert isinstance(view_sz, tuple) and len(view_sz) == 2, f"view_sz must be (height, width) tuple of integer values, got {type(view_sz)}, with element type(s) {[type(i) for i in view_sz]} and shape {len(view_sz)}"
         view_sz = tuple([int(i) for i in view_sz])
         assert isinstance(max_episode_len, int) and max_episode_len > 1, f"max_episode_len must be integer >= 2!"
+        assert isinstance(num_threads, int) and num_threads >= 0, f"num_threads must be integer >= 0, got {num_threads}!"
+        assert isinstance(batch_size, int) and 0 <= batch_size <= num_envs, f"batch_size must be integer in [0, num_envs], got {batch_size}!"
+        batch_size = batch_size or num_envs
+        assert isinstance(cache_bytes, int) and cache_bytes >= 0, f"cache_bytes must be integer >= 0, got {cache_bytes}!"
+        assert isinstance(prefetch_depth, int) and prefetch_depth >= 0, f"prefetch_depth must be integer >= 0, got {prefetch_depth}!"
+        assert isinstance(num_levels, int) and num_levels >= 1, f"num_levels must be integer >= 1, got {num_levels}!"
+        assert dtype in ("uint8", "float32", "float16"), f"dtype must be 'uint8', 'float32' or 'float16', got {dtype}!"
+        if dtype == "uint8":
+            assert mean is None and std is None, f"mean/std need a float dtype!"
+        mean = [float(m) for m in mean] if mean is not None else []
+        std = [float(s) for s in std] if std is not None else []
+        assert all(s > 0 for s in std), f"std must be positive, got {std}!"
+        assert seed is None or (isinstance(seed, int) and seed >= 0), f"seed must be None or integer >= 0, got {seed}!"
+        assert isinstance(schedule_group, int) and schedule_group >= 0, f"schedule_group must be integer >= 0, got {schedule_group}!"
+        assert isinstance(schedule_window, int) and schedule_window >= 1, f"schedule_window must be integer >= 1, got {schedule_window}!"
+        weights, balanced = [], False
+        if isinstance(sampling, str):
+            assert sampling in ("uniform", "balanced"), f"sampling must be 'uniform', 'balanced' or a list of weights, got {sampling}!"
+            balanced = sampling == "balanced"
+        else:
+            weights = [float(w) for w in sampling]
+            assert len(weights) > 0 and all(w >= 0 for w in weights), f"sampling weights must be non-negative!"
+        assert isinstance(num_buffers, int) and num_buffers >= 1, f"num_buffers must be integer >= 1, got {num_buffers}!"
+        assert isinstance(history_len, int) and history_len >= 1, f"history_len must be integer >= 1, got {history_len}!"
+        assert isinstance(num_procs, int) and 0 <= num_procs <= num_envs, f"num_procs must be integer in [0, num_envs], got {num_procs}!"
+        assert wait in ("block", "adaptive", "spin"), f"wait must be 'block', 'adaptive' or 'spin', got {wait}!"
+        assert reward in ("none", "coverage", "discovery"), f"reward must be 'none', 'coverage' or 'discovery', got {reward}!"
+        assert reward == "none" or annotations is not None, f"reward '{reward}' needs annotations!"
+        if annotations is not None and not isinstance(annotations, dict):
+            annotations = [None if a is None else str(a) for a in annotations]
+        assert backend in ("vips", "tiled"), f"backend must be 'vips' or 'tiled', got {backend}!"
+        assert mode in ("async", "sync"), f"mode must be 'async' or 'sync', got {mode}!"
+        if augment is not None:
+            specs = [augment] if isinstance(augment, dict) else list(augment)
+            assert len(specs) in (1, num_envs), f"augment must be a dict or a list of {num_envs} dicts, got {len(specs)}!"
+            for a in specs:
+                unknown = set(a) - {"flip_x", "flip_y", "rot90", "brightness", "contrast", "per_channel"}
+                assert not unknown, f"Unknown augmentation(s) {sorted(unknown)}!"
+                assert all(0 <= a.get(k, 0) <= 1 for k in ("flip_x", "flip_y", "rot90", "brightness", "contrast")), f"augmentation values must be in [0, 1], got {a}!"
+                assert not a.get("rot90", 0) or view_sz[0] == view_sz[1], f"rot90 needs a square view_sz, got {view_sz}!"
+        if mode == "sync":
+            assert batch_size in (0, num_envs), f"mode 'sync' returns every env, got batch_size {batch_size}!"
+            assert num_buffers == 1 and num_procs == 0, f"mode 'sync' needs num_buffers 1 and num_procs 0!"
+            assert replay is None, f"mode 'sync' cannot replay!"
+        assert isinstance(prefetch_threads, int) and prefetch_threads >= 0, f"prefetch_threads must be integer >= 0, got {prefetch_threads}!"
+        cpus = []
+        if isinstance(affinity, str):
+            assert affinity in ("none", "compact", "scatter"), f"affinity must be 'none', 'compact', 'scatter' or a list of cpu ids, got {affinity}!"
+            affinity = getattr(Affinity, affinity.upper())
+        else:
+            cpus = [int(c) for c in affinity]
+            assert len(cpus) > 0, f"Got empty cpu list for affinity!"
+            affinity = Affinity.EXPLICIT
 
         self.config = {
             "num_envs": num_envs,
-            "dataset_size": len(dataset),
+            "dataset": dataset if isinstance(dataset, str) or dataset is None else "dict",
             "view_sz": view_sz,
-            "max_episode_len": max_episode_len 
+            "max_episode_len": max_episode_len,
+            "num_threads": num_threads,
+            "affinity": affinity.name.lower() if not cpus else cpus,
+            "batch_size": batch_size,
+            "cache_bytes": cache_bytes,
+            "prefetch_depth": prefetch_depth,
+            "num_levels": num_levels,
+            "dtype": dtype,
+            "schedule_group": schedule_group,
+            "schedule_window": schedule_window,
+            "backend": backend,
+            "num_buffers": num_buffers,
+            "history_len": history_len,
+            "num_procs": num_procs,
+            "wait": wait,
+            "reward": reward,
+            "record": record,
+            "replay": replay,
+            "mode": mode,
+            "augment": augment,
         }
-        self.action_array_spec = {str(i): np.zeros((2,), dtype=np.float32) for i in range(num_envs)}
-        self._cpp_cls = _AsyncVipsEnvCPP(num_envs, dataset, view_sz, max_episode_len)
-
-    def _check_action(self, actions: List[np.ndarray]) -> None:
-        for a, (k, v) in zip(actions, self.action_array_spec.items()):
-            if v.dtype != a.dtype:
-                raise RuntimeError(
-                    f'Expected dtype {v.dtype} with action "{k}", got {a.dtype}'
-                )
-            shape = tuple(v.shape)
-            if shape != a.shape:
-                raise RuntimeError(
-                    f"Expected shape {shape} with action \"{k}\", "
-                    f"got {a.shape}"
-                )
+        self.action_dim = 3 if num_levels > 1 else 2
+        if mode == "sync":
+            cpp_cls = _SyncTiledEnvCPP if backend == "tiled" else _SyncVipsEnvCPP
+        elif replay is not None:
+            cpp_cls = _AsyncTiledReplayEnvCPP if backend == "tiled" else _AsyncVipsReplayEnvCPP
+        else:
+            cpp_cls = _AsyncTiledEnvCPP if backend == "tiled" else _AsyncVipsEnvCPP
+        self._cpp_cls = cpp_cls(num_envs, dataset, view_sz, max_episode_len, num_threads, affinity, cpus, batch_size, cache_bytes, prefetch_depth, prefetch_threads, num_levels,
+                                getattr(ObsDtype, dtype.upper()), mean, std,
+                                -1 if seed is None else seed, schedule_group, schedule_window, weights, balanced, num_buffers, history_len, num_procs,
+                                getattr(WaitPolicy, wait.upper()), annotations, getattr(RewardMode, reward.upper()),
+                                record or "", record_compress, replay or "", augment)
+        self.config["dataset_size"] = self._cpp_cls.dataset_size
+
+    def _check_action(self, action: np.ndarray, env_id: np.ndarray) -> None:
+        n = len(env_id) if len(env_id) else self.config["num_envs"]
+        if action.shape != (n, self.action_dim):
+            raise RuntimeError(
+                f"Expected action of shape {(n, self.action_dim)}, got {action.shape}"
+            )
 
     def _to(
-      self: Any, state_values: List[np.ndarray], reset: bool
+      self: Any, state_values: Tuple[np.ndarray, np.ndarray, np.ndarray, np.ndarray, Dict[str, np.ndarray]], reset: bool
     ) -> Union[
       Any,
       Tuple[Any, Any],
       Tuple[Any, np.ndarray, np.ndarray, Any],
       Tuple[Any, np.ndarray, np.ndarray, np.ndarray, Any],
     ]:
-      info = {}
+      # every array is a view of pool memory: with num_buffers > 1 it stays valid
+      # until the batch's lease is released or the buffer ring wraps, with one
+      # buffer until the next send to those envs (see EnvPool::recv)
+      obs, reward, terminated, truncated, info = state_values
       if reset:
-        return np.zeros((self.config['num_envs'], 3, 256, 256)), info
-      terminated = False if self._step < 100 else True
-      terminated = np.array([terminated for i in range(self.config['num_envs'])], dtype=np.bool_)
-      return np.zeros((self.config['num_envs'], 3, 256, 256)), np.zeros((self.config['num_envs'], 1), dtype=np.float32), terminated, terminated, info
+        return obs, info
+      return obs, reward, terminated, truncated, info
 
     def _from(
         self,
         action: Union[Dict[str, Any], np.ndarray],
         env_id: Optional[np.ndarray] = None,
-    ) -> List[np.ndarray]:
-        """Convert action to C++-acceptable format."""
+    ) -> Tuple[np.ndarray, np.ndarray]:
+        """Convert action and env_id to the (N, A) float32 / (N,) int32 arrays read by C++."""
         assert isinstance(action, np.ndarray), f"Expected action of type np.ndarray, got {type(action)}"
-        return list(map(lambda x: x.astype(np.float32), action))  # type: ignore
+        action = np.asarray(action, dtype=np.float32)  # no copy if already float32
+        env_id = np.asarray([] if env_id is None else env_id, dtype=np.int32)
+        return action, env_id
 
     def __len__(self) -> int:
         """Return the number of environments."""
@@ -88,19 +306,65 @@ class VipsEnvPool(EnvPool):
             self._all_env_ids = np.arange(self.config["num_envs"], dtype=np.int32)
         return self._all_env_ids  # type: ignore
 
-    def seed(self, seed: Optional[Union[int, List[int]]] = None) -> None:
-        """Set the seed for all environments (abandoned)."""
-        warnings.warn("The `seed` function in envpool is abandoned. ", stacklevel=2)
+    def release(self, buffer: int) -> bool:
+        """Give the buffer of a batch (info["buffer"]) back to the pool before its arrays are freed.
+
+        The batch's arrays must not be read afterwards. Returns False if the
+        buffer was already released.
+        """
+        return self._cpp_cls.release(buffer)
+
+    def flush_record(self) -> None:
+        """Write every step recorded so far to the trajectory file (see record).
+
+        Must not be called while actions are in flight.
+        """
+        self._cpp_cls.flush_record()
+
+    def cache_stats(self) -> Dict[str, int]:
+        """Hit/miss/eviction counters of the shared image cache."""
+        return self._cpp_cls.cache_stats()
+
+    def schedule_stats(self) -> Dict[str, float]:
+        """Episodes, distinct image visits and reuse factor of the episode scheduler."""
+        return self._cpp_cls.schedule_stats()
+
+    def prefetch_stats(self) -> Dict[str, int]:
+        """Resets served by the prefetcher and how many had to wait."""
+        return self._cpp_cls.prefetch_stats()
+
+    def get_stats(self) -> Dict[str, Dict[str, float]]:
+        """Latency per phase of the worker loop since the last reset_stats().
+
+        Phases: queue, step, reset, open, episode_wait, fetch, copy, recv_wait,
+        gather and py_recv; each maps to count, total_us, p50_us, p90_us, p99_us
+        and max_us. All zero if the extension was built with VIPSENV_NO_STATS.
+        """
+        return self._cpp_cls.get_stats()
+
+    def reset_stats(self) -> None:
+        """Start a new stats window."""
+        self._cpp_cls.reset_stats()
+
+    def seed(self, seed: Optional[int] = None) -> None:
+        """Reseed all environments; call reset() afterwards to replay from the seed.
+
+        Must not be called while actions are in flight. None draws a random seed.
+        """
+        if seed is None:
+            seed = int(np.random.SeedSequence().entropy) & 0x7FFFFFFFFFFFFFFF
+        assert isinstance(seed, int) and seed >= 0, f"seed must be integer >= 0, got {seed}!"
+        self._cpp_cls.seed(seed)
 
     def send(
         self,
         action: Union[Dict[str, Any], np.ndarray],
         env_id: Optional[np.ndarray] = None,
     ) -> None:
-        """Send actions into EnvPool."""
-        action = self._from(action, env_id)
-        self._check_action(action)
-        self._cpp_cls.send(action)
+        """Send a (N, 2) float32 action array, or (N, 3) with levels, into EnvPool."""
+        action, env_id = self._from(action, env_id)
+        self._check_action(action, env_id)
+        self._cpp_cls.send(action, env_id)
 
     def recv(
         self,
@@ -116,18 +380,16 @@ class VipsEnvPool(EnvPool):
         env_id: Optional[np.ndarray] = None,
     ) -> Tuple:
         """Perform one step with multiple environments in EnvPool."""
-        # TODO: remove
-        self._step += 1
         self.send(action, env_id)
         return self.recv(reset=False)
 
     def reset(
         self,
+        env_id: Optional[np.ndarray] = None,
     ) -> Tuple:
         """Follows the async semantics, reset the envs in env_ids."""
-        # TODO: Remove later
-        self._step = 0
-        self._cpp_cls.reset()
+        env_id = [] if env_id is None else [int(i) for i in env_id]
+        self._cpp_cls.reset(env_id)
         return self.recv(reset=True)
 
     def __repr__(self) -> str:
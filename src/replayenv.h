@@ -0,0 +1,179 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <stdexcept>
+
+#include "vipsenv.h"
+#include "trajectory.h"
+
+/**
+ * @brief ReplayEnv Class
+ *
+ * Serves a recording (see TrajectoryWriter) instead of sampling episodes: env i
+ * replays the steps of recorded env i (modulo the recorded envs) in order,
+ * cropping each recorded glimpse again from the image with base_t and
+ * returning the recorded reward and flags. Actions are ignored and no episode
+ * logic runs; an episode ends where the recorded one ended. At the end of its
+ * track an env starts over, and seed() rewinds it.
+ *
+ * base_t is VipsEnv or TiledEnv and provides `_open(index)` and
+ * `_crop(level, left, top, img)`. The pool must use the recording's view size,
+ * number of pyramid levels and files, in the recorded order (records refer to
+ * files by dataset index).
+ *
+ * @class ReplayEnv
+ */
+template <class base_t>
+class ReplayEnv : public base_t
+{
+public:
+    ReplayEnv(ReplayEnv &&) = default; ///< Envs are moved, never copied, into the pool's vector
+
+    const std::shared_ptr<const Trajectory> replay; ///< Recording being served
+    int track = 0;                                  ///< Recorded env this env replays
+    std::size_t next = 0;                           ///< Position in the track of the next record
+    bool ended = true;                              ///< The last served record ended its episode
+
+    /**
+     * @brief Constructor for ReplayEnv
+     *
+     * @param i Initialization parameters; i.replay is the recording.
+     * @param obs_slot Storage of obs_size(i) bytes the env writes observations into.
+     *
+     * @throws std::runtime_error if the view size, the number of levels or the
+     * dataset files differ from the recording's.
+     */
+    ReplayEnv(const init_t &i, uint8_t *obs_slot) : base_t(i, obs_slot), replay(i.replay)
+    {
+        if (!replay)
+        {
+            throw std::runtime_error("ReplayEnv needs a recording (init_t::replay).");
+        }
+        const TrajectoryMeta &m = replay->meta();
+        if (m.view_h != i.view_sz.first || m.view_w != i.view_sz.second)
+        {
+            throw std::runtime_error("The recording was made with views of " + std::to_string(m.view_h) + "x" + std::to_string(m.view_w) +
+                                     ", not " + std::to_string(i.view_sz.first) + "x" + std::to_string(i.view_sz.second) + ".");
+        }
+        if (m.num_levels != i.num_levels)
+        {
+            throw std::runtime_error("The recording was made with " + std::to_string(m.num_levels) + " pyramid levels, not " +
+                                     std::to_string(i.num_levels) + ".");
+        }
+        check_files(i.dataset, replay);
+    }
+
+    /**
+     * @brief Throws unless `dataset` holds the recorded files in the recorded order.
+     *
+     * Every env of a pool gets the same dataset and recording, so the last pair
+     * checked on this thread is not compared again.
+     */
+    static void check_files(const std::shared_ptr<const Dataset> &files, const std::shared_ptr<const Trajectory> &recording)
+    {
+        static thread_local std::weak_ptr<const Dataset> checked_files;
+        static thread_local std::weak_ptr<const Trajectory> checked_recording;
+        if (checked_files.lock() == files && checked_recording.lock() == recording)
+        {
+            return;
+        }
+        const Dataset &dataset = *files;
+        const TrajectoryMeta &m = recording->meta();
+        if (dataset.size() != m.files.size())
+        {
+            throw std::runtime_error("The recording has " + std::to_string(m.files.size()) + " files, the dataset " +
+                                     std::to_string(dataset.size()) + "; replay with the recorded files.");
+        }
+        for (std::size_t k = 0; k < dataset.size(); ++k)
+        {
+            if (m.files[k] != dataset.path(k))
+            {
+                throw std::runtime_error("Dataset file " + std::to_string(k) + " is " + dataset.path(k) + ", the recording's is " +
+                                         m.files[k] + "; replay with the recorded files.");
+            }
+        }
+        checked_files = files;
+        checked_recording = recording;
+    }
+
+    /**
+     * @brief Rewind to the start of recorded env `env_id` % recorded envs.
+     */
+    void seed(const uint64_t seed, const int env_id)
+    {
+        base_t::seed(seed, env_id);
+        track = env_id % replay->num_env();
+        next = 0;
+        ended = true;
+    }
+
+    /**
+     * @brief Serves the next recorded episode start of the track.
+     */
+    data_t reset()
+    {
+        const std::vector<uint32_t> &t = replay->env(track);
+        for (std::size_t k = 0; k < t.size() && !replay->records()[t[next % t.size()]].reset; ++k)
+        {
+            next += 1;
+        }
+        if (t.empty() || !replay->records()[t[next % t.size()]].reset)
+        {
+            throw std::runtime_error("The recording has no episode of env " + std::to_string(track) + ".");
+        }
+        next %= t.size();
+        return play();
+    }
+
+    /**
+     * @brief Serves the next recorded step of the track; `action` is ignored.
+     */
+    data_t step(action_t action)
+    {
+        (void)action;
+        return play();
+    }
+
+    /**
+     * @brief Whether the recorded episode ended with the last served record.
+     */
+    bool is_done(void)
+    {
+        return ended;
+    }
+
+    /**
+     * @brief Crops and returns record `next` of the track, then moves past it.
+     */
+    data_t play()
+    {
+        const std::vector<uint32_t> &t = replay->env(track);
+        const TrajectoryRecord &r = replay->records()[t[next]];
+        next += 1;
+        if (r.index != this->dataset_index)
+        {
+            base_t::_open(r.index);
+        }
+        if (r.level >= static_cast<int>(this->level_sz.size()))
+        {
+            throw std::runtime_error(std::string(this->dataset->path(r.index)) + ": recorded level " + std::to_string(r.level) + " is not available.");
+        }
+        this->timestep = r.timestep;
+
+        data_t d;
+        d.obs = this->obs;
+        base_t::_crop(r.level, r.left, r.top, d.obs);
+        d.reward = r.reward;
+        d.done = r.done != 0;
+        d.truncated = r.truncated != 0;
+        d.info = info_t(r.timestep, this->dataset->cls(r.index), r.level);
+        d.info.index = r.index;
+        d.info.left = r.left;
+        d.info.top = r.top;
+        ended = d.done || d.truncated || next >= t.size() || replay->records()[t[next]].reset;
+        return d;
+    }
+};
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <vips/vips8>
+
+/**
+ * @brief Reward VipsEnv computes for a glimpse from the image's annotation.
+ */
+enum class RewardMode
+{
+    NONE,      ///< Reward is always 0
+    COVERAGE,  ///< Labelled fraction of the glimpse, in [0, 1]
+    DISCOVERY, ///< Labelled area first seen in this episode, as a fraction of the glimpse, in [0, 1]
+};
+
+/**
+ * AreaTable
+ *
+ * Summed-area table of one image's annotation mask. The mask is kept at its
+ * own resolution (at most max_side pixels per side) and stretched over the
+ * image's full-resolution extent, so the labelled area of any rectangle of any
+ * pyramid level is four table lookups. Mask values are coverage in [0, 255];
+ * lookups interpolate bilinearly between table entries, so rectangles need not
+ * align with mask pixels.
+ */
+class AreaTable
+{
+private:
+    AreaTable(const AreaTable &) = delete;
+    AreaTable &operator=(const AreaTable &) = delete;
+
+    int w_ = 0, h_ = 0;         /**< Mask size. */
+    double sx_ = 1.0, sy_ = 1.0; /**< Mask pixels per image pixel. */
+    std::vector<uint32_t> sat_; /**< (w_ + 1) x (h_ + 1) prefix sums, first row and column 0. */
+
+    AreaTable() = default;
+
+    /**
+     * @brief Prefix sum at mask coordinates (x, y), bilinear between entries.
+     */
+    inline double at(double x, double y) const
+    {
+        x = std::max(0.0, std::min(x, static_cast<double>(w_)));
+        y = std::max(0.0, std::min(y, static_cast<double>(h_)));
+        const int x0 = std::min(static_cast<int>(x), w_ - 1), y0 = std::min(static_cast<int>(y), h_ - 1);
+        const double fx = x - x0, fy = y - y0;
+        const std::size_t row = static_cast<std::size_t>(w_) + 1;
+        const uint32_t *p = sat_.data() + static_cast<std::size_t>(y0) * row + x0;
+        return (p[0] * (1 - fx) + p[1] * fx) * (1 - fy) + (p[row] * (1 - fx) + p[row + 1] * fx) * fy;
+    }
+
+public:
+    static const int max_side = 2048; ///< Longest mask side kept; keeps sums within uint32
+
+    /**
+     * @brief Build the table of a `w` x `h` coverage mask covering an `image_w` x `image_h` image.
+     */
+    static std::shared_ptr<const AreaTable> from_mask(const uint8_t *mask, const int w, const int h, const int image_w, const int image_h)
+    {
+        if (w <= 0 || h <= 0 || w > max_side || h > max_side || image_w <= 0 || image_h <= 0)
+        {
+            throw std::runtime_error("AreaTable: invalid mask or image size.");
+        }
+        std::shared_ptr<AreaTable> t(new AreaTable());
+        t->w_ = w;
+        t->h_ = h;
+        t->sx_ = static_cast<double>(w) / image_w;
+        t->sy_ = static_cast<double>(h) / image_h;
+        const std::size_t row = static_cast<std::size_t>(w) + 1;
+        t->sat_.assign(row * (h + 1), 0);
+        for (int y = 0; y < h; ++y)
+        {
+            uint32_t run = 0;
+            const uint8_t *m = mask + static_cast<std::size_t>(y) * w;
+            uint32_t *above = t->sat_.data() + static_cast<std::size_t>(y) * row;
+            uint32_t *out = above + row;
+            for (int x = 0; x < w; ++x)
+            {
+                run += m[x];
+                out[x + 1] = above[x + 1] + run;
+            }
+        }
+        return t;
+    }
+
+    /**
+     * @brief Rasterize polygons (even-odd rule) into a mask and build its table.
+     *
+     * @param polygons Each polygon as x0, y0, x1, y1, ... in full-resolution image pixels.
+     */
+    static std::shared_ptr<const AreaTable> from_polygons(const std::vector<std::vector<double>> &polygons, const int image_w, const int image_h)
+    {
+        const double f = std::max(1.0, static_cast<double>(std::max(image_w, image_h)) / max_side);
+        const int w = std::max(1, static_cast<int>(image_w / f)), h = std::max(1, static_cast<int>(image_h / f));
+        const double sx = static_cast<double>(w) / image_w, sy = static_cast<double>(h) / image_h;
+        std::vector<uint8_t> mask(static_cast<std::size_t>(w) * h, 0);
+        std::vector<double> xs;
+        for (int y = 0; y < h; ++y)
+        {
+            const double cy = (y + 0.5) / sy; // pixel centre in image coordinates
+            xs.clear();
+            for (const std::vector<double> &p : polygons)
+            {
+                const std::size_t n = p.size() / 2;
+                for (std::size_t k = 0; k < n; ++k)
+                {
+                    const double ax = p[2 * k], ay = p[2 * k + 1];
+                    const double bx = p[2 * ((k + 1) % n)], by = p[2 * ((k + 1) % n) + 1];
+                    if ((ay <= cy) != (by <= cy))
+                    {
+                        xs.push_back(ax + (cy - ay) / (by - ay) * (bx - ax));
+                    }
+                }
+            }
+            std::sort(xs.begin(), xs.end());
+            for (std::size_t k = 0; k + 1 < xs.size(); k += 2)
+            {
+                const int x0 = std::max(0, static_cast<int>(std::ceil(xs[k] * sx - 0.5)));
+                const int x1 = std::min(w, static_cast<int>(std::ceil(xs[k + 1] * sx - 0.5)));
+                for (int x = x0; x < x1; ++x)
+                {
+                    mask[static_cast<std::size_t>(y) * w + x] = 255;
+                }
+            }
+        }
+        return from_mask(mask.data(), w, h, image_w, image_h);
+    }
+
+    /**
+     * @brief Read a polygon file: one polygon per line, "x0 y0 x1 y1 ..." in
+     * full-resolution pixels (commas allowed as separators, '#' starts a comment).
+     */
+    static std::vector<std::vector<double>> read_polygons(const std::string &path)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            throw std::runtime_error(path + ": cannot open polygon file.");
+        }
+        std::vector<std::vector<double>> polygons;
+        std::string line;
+        while (std::getline(in, line))
+        {
+            line = line.substr(0, line.find('#'));
+            std::replace(line.begin(), line.end(), ',', ' ');
+            std::istringstream s(line);
+            std::vector<double> p;
+            for (double v; s >> v;)
+            {
+                p.push_back(v);
+            }
+            if (p.size() % 2 != 0 || (!p.empty() && p.size() < 6))
+            {
+                throw std::runtime_error(path + ": a polygon needs at least 3 x y pairs.");
+            }
+            if (!p.empty())
+            {
+                polygons.push_back(p);
+            }
+        }
+        return polygons;
+    }
+
+    /**
+     * @brief Load the annotation at `path` for an `image_w` x `image_h` image.
+     *
+     * ".txt" and ".poly" files are polygon files (see read_polygons()); anything
+     * else is opened with libvips as a mask whose first band is non-zero where
+     * labelled. Large masks are block-averaged down to max_side.
+     */
+    static std::shared_ptr<const AreaTable> load(const std::string &path, const int image_w, const int image_h)
+    {
+        const std::size_t dot = path.rfind('.');
+        const std::string ext = dot == std::string::npos ? "" : path.substr(dot);
+        if (ext == ".txt" || ext == ".poly")
+        {
+            return from_polygons(read_polygons(path), image_w, image_h);
+        }
+        vips::VImage mask = vips::VImage::new_from_file(path.c_str(), vips::VImage::option()->set("access", VIPS_ACCESS_SEQUENTIAL));
+        mask = mask.extract_band(0) > 0;
+        const int f = (std::max(mask.width(), mask.height()) + max_side - 1) / max_side;
+        if (f > 1)
+        {
+            mask = mask.shrink(f, f);
+        }
+        std::size_t bytes = 0;
+        void *px = mask.write_to_memory(&bytes);
+        std::shared_ptr<const AreaTable> t;
+        try
+        {
+            t = from_mask(static_cast<const uint8_t *>(px), mask.width(), mask.height(), image_w, image_h);
+        }
+        catch (...)
+        {
+            g_free(px);
+            throw;
+        }
+        g_free(px);
+        return t;
+    }
+
+    /**
+     * @brief Labelled area, in full-resolution pixels, of the rectangle [x0, x1) x [y0, y1) in full-resolution pixels.
+     */
+    inline double area(const double x0, const double y0, const double x1, const double y1) const
+    {
+        const double s = at(x1 * sx_, y1 * sy_) - at(x0 * sx_, y1 * sy_) - at(x1 * sx_, y0 * sy_) + at(x0 * sx_, y0 * sy_);
+        return std::max(0.0, s / 255.0 / (sx_ * sy_));
+    }
+
+    /**
+     * @brief Bytes held by the table.
+     */
+    std::size_t bytes(void) const
+    {
+        return sat_.size() * sizeof(uint32_t);
+    }
+};
+
+/**
+ * Annotations
+ *
+ * Annotation file of every dataset file (empty path = not annotated) and a
+ * pool-wide, thread-safe LRU cache of their AreaTables, built on first use and
+ * evicted once they exceed the byte budget. Like ImageCache, tables are built
+ * without holding the lock and evicted tables stay valid for the envs holding
+ * them.
+ */
+class Annotations
+{
+private:
+    Annotations(const Annotations &) = delete;
+    Annotations &operator=(const Annotations &) = delete;
+
+    struct Entry
+    {
+        std::shared_ptr<const AreaTable> table; ///< Built table
+        std::list<int>::iterator pos;           ///< Position in lru_
+    };
+
+    const std::vector<std::string> paths_;  /**< Annotation file per dataset index. */
+    std::mutex m_;                          /**< Guards everything below. */
+    std::list<int> lru_;                    /**< Dataset indices, most recently used first. */
+    std::unordered_map<int, Entry> map_;    /**< Dataset index -> entry. */
+    std::size_t bytes_ = 0;                 /**< Sum of the tables' bytes(). */
+
+public:
+    const std::size_t budget; ///< Byte budget of the cached tables
+
+    /**
+     * @brief Constructor for Annotations
+     *
+     * @param paths        Annotation file per dataset index, "" where there is none.
+     * @param budget_bytes Byte budget of the cached tables.
+     */
+    Annotations(const std::vector<std::string> &paths, const std::size_t budget_bytes = std::size_t(256) << 20)
+        : paths_(paths), budget(budget_bytes) {}
+
+    /**
+     * @brief Table of dataset file `index`, an `image_w` x `image_h` image; nullptr if it has no annotation.
+     */
+    std::shared_ptr<const AreaTable> get(const int index, const int image_w, const int image_h)
+    {
+        if (index < 0 || static_cast<std::size_t>(index) >= paths_.size() || paths_[index].empty())
+        {
+            return nullptr;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            auto it = map_.find(index);
+            if (it != map_.end())
+            {
+                lru_.splice(lru_.begin(), lru_, it->second.pos);
+                return it->second.table;
+            }
+        }
+
+        std::shared_ptr<const AreaTable> table = AreaTable::load(paths_[index], image_w, image_h);
+
+        std::lock_guard<std::mutex> lock(m_);
+        auto it = map_.find(index);
+        if (it != map_.end())
+        {
+            lru_.splice(lru_.begin(), lru_, it->second.pos);
+            return it->second.table;
+        }
+        lru_.push_front(index);
+        Entry &e = map_[index];
+        e.table = table;
+        e.pos = lru_.begin();
+        bytes_ += table->bytes();
+        while (bytes_ > budget && map_.size() > 1)
+        {
+            auto old = map_.find(lru_.back());
+            bytes_ -= old->second.table->bytes();
+            map_.erase(old);
+            lru_.pop_back();
+        }
+        return table;
+    }
+};
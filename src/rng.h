@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+
+/**
+ * Rng
+ *
+ * xoshiro256** generator owned by one env. Four words of state, a handful of
+ * instructions per draw and no system calls, so it can be drawn from on
+ * every reset. Seeded through splitmix64 from (pool seed, env id), which
+ * gives each env an independent, reproducible stream.
+ */
+class Rng
+{
+private:
+    uint64_t s_[4] = {1, 2, 3, 4}; /**< Generator state, never all zero. */
+
+    static inline uint64_t rotl(const uint64_t x, const int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    static inline uint64_t splitmix64(uint64_t &x)
+    {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+public:
+    Rng() = default;
+
+    /**
+     * @brief Constructor for Rng
+     *
+     * @param seed    Pool seed.
+     * @param stream  Stream id, e.g. the env id.
+     */
+    Rng(const uint64_t seed, const uint64_t stream = 0)
+    {
+        this->seed(seed, stream);
+    }
+
+    /**
+     * @brief Restart the generator at (seed, stream).
+     */
+    void seed(const uint64_t seed, const uint64_t stream = 0)
+    {
+        uint64_t x = seed ^ (stream * 0xd1342543de82ef95ULL);
+        for (int k = 0; k < 4; ++k)
+        {
+            s_[k] = splitmix64(x);
+        }
+    }
+
+    /**
+     * @brief Next 64 random bits.
+     */
+    inline uint64_t next(void)
+    {
+        const uint64_t result = rotl(s_[1] * 5, 7) * 9;
+        const uint64_t t = s_[1] << 17;
+        s_[2] ^= s_[0];
+        s_[3] ^= s_[1];
+        s_[1] ^= s_[2];
+        s_[0] ^= s_[3];
+        s_[2] ^= t;
+        s_[3] = rotl(s_[3], 45);
+        return result;
+    }
+
+    /**
+     * @brief Uniform float in [0, 1).
+     */
+    inline float uniform(void)
+    {
+        return static_cast<float>(next() >> 40) * (1.0f / 16777216.0f);
+    }
+
+    /**
+     * @brief Uniform integer in [0, n), n > 0.
+     *
+     * Lemire's multiply-shift; the bias for n << 2^32 is negligible.
+     */
+    inline uint32_t below(const uint32_t n)
+    {
+        return static_cast<uint32_t>(((next() >> 32) * static_cast<uint64_t>(n)) >> 32);
+    }
+};
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#include "rng.h"
+#include "dataset.h"
+
+/**
+ * @brief Counters reported by EpisodeScheduler::stats().
+ */
+struct ScheduleStats
+{
+    uint64_t episodes = 0; ///< Episodes handed out
+    uint64_t files = 0;    ///< (group, window) file assignments, i.e. distinct image visits
+};
+
+/**
+ * EpisodeScheduler
+ *
+ * Cache-friendly replacement for drawing every episode's file independently.
+ * Envs are split into groups of `group_size` consecutive env ids; all envs of a
+ * group play the same file for `window` episodes each, so their crops hit the
+ * same open image and decoded tiles (see ImageCache), then move on together.
+ *
+ * Groups walk one global stream of files: position p = window_index * groups +
+ * group. Without weights the stream is a sequence of shuffled epochs (every
+ * file once per epoch); with weights each position is an independent draw
+ * proportional to its weight. Either way every file's marginal probability is
+ * as configured, and the schedule depends only on (seed, env id, episode
+ * number), not on thread timing.
+ *
+ * @see VipsEnv::_random_episode() for the env side.
+ */
+class EpisodeScheduler
+{
+private:
+    EpisodeScheduler(const EpisodeScheduler &) = delete;
+    EpisodeScheduler &operator=(const EpisodeScheduler &) = delete;
+
+    const std::shared_ptr<const Dataset> dataset_;          /**< Files to schedule. */
+    uint64_t seed_ = 0;                                     /**< Stream seed. */
+    std::vector<float> prob_;                               /**< Alias table: probability of keeping a column (weighted only). */
+    std::vector<uint32_t> alias_;                           /**< Alias table: fallback column (weighted only). */
+    std::mutex m_;                                          /**< Guards perms_ and seed_. */
+    std::map<uint64_t, std::shared_ptr<const std::vector<uint32_t>>> perms_; /**< Recently used epoch permutations. */
+    std::unique_ptr<std::atomic<uint64_t>[]> windows_;      /**< Per group: windows started so far. */
+    std::atomic<uint64_t> episodes_;                        /**< See ScheduleStats::episodes. */
+    std::atomic<uint64_t> files_;                           /**< See ScheduleStats::files. */
+
+    static const std::size_t kept_epochs = 4; /**< Permutations kept for groups in different epochs. */
+
+    /**
+     * @brief Shuffled order of epoch `epoch`, built on first use.
+     */
+    std::shared_ptr<const std::vector<uint32_t>> permutation(const uint64_t epoch)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        auto it = perms_.find(epoch);
+        if (it != perms_.end())
+        {
+            return it->second;
+        }
+        std::shared_ptr<std::vector<uint32_t>> perm = std::make_shared<std::vector<uint32_t>>(dataset_->size());
+        for (uint32_t k = 0; k < perm->size(); ++k)
+        {
+            (*perm)[k] = k;
+        }
+        Rng rng(seed_, epoch);
+        for (uint32_t k = static_cast<uint32_t>(perm->size()); k > 1; --k)
+        {
+            std::swap((*perm)[k - 1], (*perm)[rng.below(k)]);
+        }
+        perms_[epoch] = perm;
+        if (perms_.size() > kept_epochs)
+        {
+            perms_.erase(perms_.begin());
+        }
+        return perm;
+    }
+
+    /**
+     * @brief Vose's alias table for O(1) weighted draws.
+     */
+    void build_alias(const std::vector<double> &weights)
+    {
+        const std::size_t n = weights.size();
+        double total = 0.0;
+        for (const double w : weights)
+        {
+            if (!(w >= 0.0))
+            {
+                throw std::runtime_error("EpisodeScheduler: weights must be non-negative.");
+            }
+            total += w;
+        }
+        if (!(total > 0.0))
+        {
+            throw std::runtime_error("EpisodeScheduler: weights must not all be zero.");
+        }
+
+        prob_.assign(n, 0.0f);
+        alias_.assign(n, 0);
+        std::vector<double> scaled(n);
+        std::vector<uint32_t> small, large;
+        for (std::size_t k = 0; k < n; ++k)
+        {
+            scaled[k] = weights[k] * n / total;
+            (scaled[k] < 1.0 ? small : large).push_back(static_cast<uint32_t>(k));
+        }
+        while (!small.empty() && !large.empty())
+        {
+            const uint32_t s = small.back(), l = large.back();
+            small.pop_back();
+            prob_[s] = static_cast<float>(scaled[s]);
+            alias_[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if (scaled[l] < 1.0)
+            {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        for (const uint32_t k : large)
+        {
+            prob_[k] = 1.0f;
+        }
+        for (const uint32_t k : small)
+        {
+            prob_[k] = 1.0f; // rounding leftovers
+        }
+    }
+
+public:
+    const int num_env;    ///< Envs of the pool
+    const int group_size; ///< Envs sharing a file
+    const int groups;     ///< Number of groups
+    const int window;     ///< Episodes each env plays on a file before the group moves on
+
+    /**
+     * @brief Constructor for EpisodeScheduler
+     *
+     * @param dataset     Files to schedule.
+     * @param num_env     Envs of the pool.
+     * @param group_size  Envs sharing a file (clamped to [1, num_env]).
+     * @param window      Episodes per env on a file (at least 1).
+     * @param weights     Per-file sampling weights; empty for uniform shuffled epochs.
+     */
+    EpisodeScheduler(const std::shared_ptr<const Dataset> &dataset, const int num_env, const int group_size, const int window,
+                     const std::vector<double> &weights = {})
+        : dataset_(dataset), episodes_(0), files_(0), num_env(num_env),
+          group_size(std::max(1, std::min(group_size, num_env))),
+          groups((num_env + this->group_size - 1) / this->group_size),
+          window(std::max(1, window))
+    {
+        if (!dataset_ || dataset_->size() == 0)
+        {
+            throw std::runtime_error("EpisodeScheduler needs a non-empty dataset.");
+        }
+        if (!weights.empty())
+        {
+            if (weights.size() != dataset_->size())
+            {
+                throw std::runtime_error("EpisodeScheduler: expected one weight per file.");
+            }
+            build_alias(weights);
+        }
+        windows_.reset(new std::atomic<uint64_t>[groups]);
+        for (int g = 0; g < groups; ++g)
+        {
+            windows_[g].store(0);
+        }
+    }
+
+    /**
+     * @brief Weights that give every class the same total probability.
+     */
+    static std::vector<double> balanced_weights(const Dataset &dataset)
+    {
+        std::map<int, std::size_t> count;
+        for (std::size_t k = 0; k < dataset.size(); ++k)
+        {
+            count[dataset.cls(k)] += 1;
+        }
+        std::vector<double> w(dataset.size());
+        for (std::size_t k = 0; k < dataset.size(); ++k)
+        {
+            w[k] = 1.0 / count[dataset.cls(k)];
+        }
+        return w;
+    }
+
+    /**
+     * @brief Restart the schedule from `seed`; call with no episode draws in flight.
+     *
+     * Every env calls this with the pool seed, so repeated calls are no-ops.
+     */
+    void seed(const uint64_t seed)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        if (seed != seed_)
+        {
+            seed_ = seed;
+            perms_.clear();
+        }
+        for (int g = 0; g < groups; ++g)
+        {
+            windows_[g].store(0);
+        }
+    }
+
+    /**
+     * @brief Dataset index of episode `episode` (0, 1, ...) of env `env_id`.
+     */
+    int next(const int env_id, const uint64_t episode)
+    {
+        const int g = env_id / group_size;
+        const uint64_t w = episode / static_cast<uint64_t>(window);
+        const uint64_t p = w * static_cast<uint64_t>(groups) + static_cast<uint64_t>(g);
+
+        episodes_.fetch_add(1, std::memory_order_relaxed);
+        uint64_t seen = windows_[g].load(std::memory_order_relaxed);
+        while (w >= seen)
+        {
+            if (windows_[g].compare_exchange_weak(seen, w + 1, std::memory_order_relaxed))
+            {
+                files_.fetch_add(w + 1 - seen, std::memory_order_relaxed);
+                break;
+            }
+        }
+
+        const uint64_t n = dataset_->size();
+        if (!prob_.empty())
+        {
+            Rng rng(seed_ ^ 0x9e3779b97f4a7c15ULL, p);
+            const uint32_t k = rng.below(static_cast<uint32_t>(n));
+            return static_cast<int>(rng.uniform() < prob_[k] ? k : alias_[k]);
+        }
+        return static_cast<int>((*permutation(p / n))[p % n]);
+    }
+
+    /**
+     * @brief Snapshot of the counters; episodes / files is the reuse factor.
+     */
+    ScheduleStats stats(void) const
+    {
+        ScheduleStats s;
+        s.episodes = episodes_.load();
+        s.files = files_.load();
+        return s;
+    }
+};
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cerrno>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "threadpool.h"
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "Shared-memory rings need lock-free atomics.");
+
+/**
+ * SharedMemory
+ *
+ * Anonymous shared mapping. A child created with fork() sees the same pages at
+ * the same address, so pointers into the mapping are valid in every process
+ * of a sharded pool (see init_t::num_procs) and nothing has to be named or
+ * unlinked. The memory starts zeroed.
+ */
+class SharedMemory
+{
+private:
+    SharedMemory(const SharedMemory &) = delete;
+    SharedMemory &operator=(const SharedMemory &) = delete;
+
+    uint8_t *data_ = nullptr; /**< Start of the mapping. */
+    std::size_t bytes_ = 0;   /**< Length of the mapping. */
+
+public:
+    /**
+     * @brief Map `bytes` bytes (at least one page).
+     *
+     * @throws std::runtime_error if the mapping fails.
+     */
+    explicit SharedMemory(const std::size_t bytes) : bytes_(bytes > 0 ? bytes : 1)
+    {
+        void *p = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+        {
+            throw std::runtime_error("Cannot map " + std::to_string(bytes_) + " bytes of shared memory.");
+        }
+        data_ = static_cast<uint8_t *>(p);
+    }
+
+    ~SharedMemory()
+    {
+        munmap(data_, bytes_);
+    }
+
+    inline uint8_t *data(void) const
+    {
+        return data_;
+    }
+
+    inline std::size_t size(void) const
+    {
+        return bytes_;
+    }
+};
+
+/**
+ * ShmRing
+ *
+ * Bounded single-producer single-consumer queue of T living in a
+ * SharedMemory, for passing commands and results between the processes of a
+ * sharded pool. T is copied by assignment, so it must hold plain values (or
+ * pointers into shared memory) only.
+ *
+ * An empty ring is polled according to the consumer's WaitPolicy, then the
+ * consumer sleeps on an eventfd; it announces it in `waiting` before its last
+ * check, and the producer writes the eventfd only when the flag is set, so a
+ * busy ring costs no system calls.
+ */
+template <typename T>
+class ShmRing
+{
+private:
+    struct Header
+    {
+        alignas(64) std::atomic<uint64_t> head; ///< Next entry to pop (consumer)
+        alignas(64) std::atomic<uint64_t> tail; ///< Next entry to push (producer)
+        alignas(64) std::atomic<int> waiting;   ///< Consumer is about to sleep
+    };
+
+    Header *header_ = nullptr; /**< In shared memory. */
+    T *entries_ = nullptr;     /**< In shared memory, capacity_ of them. */
+    uint64_t capacity_ = 0;    /**< Entries. */
+    int fd_ = -1;              /**< eventfd the consumer sleeps on. */
+    WaitPolicy wait_ = WaitPolicy::BLOCK; /**< How the consumer waits. */
+    int budget_ = 0;           /**< Consumer's adaptive spin budget, see spin_until(). */
+
+public:
+    /**
+     * @brief Bytes of shared memory a ring of `capacity` entries occupies.
+     */
+    static std::size_t bytes(const std::size_t capacity)
+    {
+        return (sizeof(Header) + sizeof(T) * capacity + 63) / 64 * 64;
+    }
+
+    ShmRing(void) {}
+
+    ShmRing(const ShmRing &) = delete;
+    ShmRing &operator=(const ShmRing &) = delete;
+
+    /**
+     * @brief Construct an empty ring in `mem`, bytes(capacity) bytes of shared memory.
+     *
+     * Call before forking; both processes then use their copy of this object.
+     *
+     * @param wait How the consumer waits for entries.
+     *
+     * @throws std::runtime_error if the eventfd cannot be created.
+     */
+    void init(uint8_t *mem, const std::size_t capacity, const WaitPolicy wait = WaitPolicy::BLOCK)
+    {
+        wait_ = wait;
+        fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (fd_ < 0)
+        {
+            throw std::runtime_error("Cannot create an eventfd.");
+        }
+        header_ = new (mem) Header();
+        header_->head.store(0);
+        header_->tail.store(0);
+        header_->waiting.store(0);
+        entries_ = reinterpret_cast<T *>(mem + sizeof(Header));
+        for (std::size_t k = 0; k < capacity; ++k)
+        {
+            new (entries_ + k) T();
+        }
+        capacity_ = capacity;
+    }
+
+    ~ShmRing()
+    {
+        if (fd_ >= 0)
+        {
+            close(fd_);
+        }
+    }
+
+    /**
+     * @brief Append `value`, yielding while the ring is full (producer only).
+     */
+    void push(const T &value)
+    {
+        const uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+        while (tail - header_->head.load(std::memory_order_acquire) >= capacity_)
+        {
+            std::this_thread::yield();
+        }
+        entries_[tail % capacity_] = value;
+        header_->tail.store(tail + 1, std::memory_order_seq_cst);
+        if (header_->waiting.load(std::memory_order_seq_cst))
+        {
+            wake();
+        }
+    }
+
+    /**
+     * @brief Take the oldest entry without blocking (consumer only).
+     *
+     * @return Whether there was one.
+     */
+    bool try_pop(T &value)
+    {
+        const uint64_t head = header_->head.load(std::memory_order_relaxed);
+        if (head == header_->tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        value = entries_[head % capacity_];
+        header_->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief Take the oldest entry, sleeping up to `timeout` for one (consumer only).
+     *
+     * @param timeout Longest sleep; negative sleeps until an entry or wake() arrives.
+     * @return Whether an entry was taken.
+     */
+    bool pop(T &value, const std::chrono::milliseconds timeout = std::chrono::milliseconds(-1))
+    {
+        if (try_pop(value))
+        {
+            return true;
+        }
+        const auto ready = [this]
+        { return header_->tail.load(std::memory_order_acquire) != header_->head.load(std::memory_order_relaxed); };
+        const auto deadline = timeout.count() < 0 ? std::chrono::steady_clock::time_point::max() : std::chrono::steady_clock::now() + timeout;
+        if (spin_until(wait_, budget_, ready, deadline) || wait_ == WaitPolicy::SPIN) // SPIN only gives up at the deadline
+        {
+            return try_pop(value);
+        }
+        header_->waiting.store(1, std::memory_order_seq_cst);
+        if (header_->tail.load(std::memory_order_seq_cst) == header_->head.load(std::memory_order_relaxed))
+        {
+            pollfd p = {fd_, POLLIN, 0};
+            if (poll(&p, 1, timeout.count() < 0 ? -1 : static_cast<int>(timeout.count())) > 0)
+            {
+                uint64_t count;
+                while (read(fd_, &count, sizeof(count)) < 0 && errno == EINTR)
+                {
+                }
+            }
+        }
+        header_->waiting.store(0, std::memory_order_relaxed);
+        return try_pop(value);
+    }
+
+    /**
+     * @brief Wake the consumer's pop(), e.g. to make it look at a stop flag.
+     */
+    void wake(void)
+    {
+        const uint64_t one = 1;
+        while (write(fd_, &one, sizeof(one)) < 0 && errno == EINTR)
+        {
+        }
+    }
+};
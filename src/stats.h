@@ -0,0 +1,373 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+
+/**
+ * @brief Phases of the worker loop timed by Stats.
+ */
+enum class Phase
+{
+    QUEUE = 0,    ///< Action submitted -> worker picks it up
+    STEP,         ///< VipsEnv::step, whole
+    RESET,        ///< VipsEnv::reset, whole
+    OPEN,         ///< Opening an episode's file(s) and pyramid levels
+    EPISODE_WAIT, ///< reset() blocked on a prefetched episode
+    FETCH,        ///< image.region(): tile decode of the crop
+    COPY,         ///< Deinterleave/convert of the crop into the obs slot
+    RECV_WAIT,    ///< recv() blocked on the completion queue
+    GATHER,       ///< Async recv copying ready slots into the batch buffer
+    PY_RECV,      ///< Building the Python objects of a recv
+    COUNT
+};
+
+/**
+ * @brief Name of `p` as reported by get_stats().
+ */
+inline const char *phase_name(const Phase p)
+{
+    static const char *names[] = {"queue", "step", "reset", "open", "episode_wait", "fetch", "copy", "recv_wait", "gather", "py_recv"};
+    return names[static_cast<int>(p)];
+}
+
+/**
+ * @brief Summary of one phase reported by Stats::summary().
+ */
+struct PhaseStats
+{
+    uint64_t count = 0;    ///< Samples
+    double total_us = 0.0; ///< Sum of the samples
+    double p50_us = 0.0;   ///< Median
+    double p90_us = 0.0;   ///< 90th percentile
+    double p99_us = 0.0;   ///< 99th percentile
+    double max_us = 0.0;   ///< Largest sample
+};
+
+/**
+ * Stats
+ *
+ * Per-phase latency histograms of one pool. Every thread that records gets its
+ * own Recorder, written only by that thread (plain load + store, no locked
+ * instructions), and summary() sums the recorders without stopping anyone.
+ * Histograms are HDR-style: a power-of-two bucket per octave of nanoseconds
+ * split into 8 linear sub-buckets, i.e. 12.5% relative precision from 1 ns to
+ * minutes in 512 counters.
+ *
+ * reset() does not touch the recorders; it snapshots them as a baseline that
+ * summary() subtracts, which keeps the writers lock-free.
+ *
+ * Recorders written by other processes (in shared memory, see publish()) can
+ * be attach()ed and are summed like the local ones.
+ *
+ * Compile with -DVIPSENV_NO_STATS to remove the timing points entirely.
+ *
+ * @see VIPSENV_TIME_PHASE for timing a scope.
+ */
+class Stats
+{
+public:
+    static const int sub_bits = 3;                 ///< log2 of the sub-buckets per octave
+    static const int buckets = 64 << sub_bits;     ///< Buckets per histogram
+
+    /**
+     * @brief Histograms written by one thread.
+     */
+    struct Recorder
+    {
+        std::atomic<uint64_t> hist[static_cast<int>(Phase::COUNT)][buckets];
+        std::atomic<uint64_t> total_ns[static_cast<int>(Phase::COUNT)];
+        std::atomic<uint64_t> max_ns[static_cast<int>(Phase::COUNT)];
+
+        Recorder()
+        {
+            for (int p = 0; p < static_cast<int>(Phase::COUNT); ++p)
+            {
+                for (int b = 0; b < buckets; ++b)
+                {
+                    hist[p][b].store(0, std::memory_order_relaxed);
+                }
+                total_ns[p].store(0, std::memory_order_relaxed);
+                max_ns[p].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * @brief Add a sample; only the owning thread may call this.
+         */
+        inline void add(const Phase phase, const uint64_t ns)
+        {
+            const int p = static_cast<int>(phase);
+            std::atomic<uint64_t> &h = hist[p][bucket(ns)];
+            h.store(h.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            total_ns[p].store(total_ns[p].load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+            if (ns > max_ns[p].load(std::memory_order_relaxed))
+            {
+                max_ns[p].store(ns, std::memory_order_relaxed);
+            }
+        }
+    };
+
+private:
+    Stats(const Stats &) = delete;
+    Stats &operator=(const Stats &) = delete;
+
+    /**
+     * @brief Plain copy of the recorders' counters.
+     */
+    struct Snapshot
+    {
+        std::vector<uint64_t> hist, total_ns;
+        Snapshot() : hist(static_cast<int>(Phase::COUNT) * buckets, 0), total_ns(static_cast<int>(Phase::COUNT), 0) {}
+    };
+
+    const uint64_t id_;                                         /**< Unique id, keys the per-thread lookup cache. */
+    std::mutex m_;                                              /**< Guards recorders_, by_thread_ and base_. */
+    std::vector<std::unique_ptr<Recorder>> recorders_;          /**< One per thread that recorded, kept after it exits. */
+    std::unordered_map<std::thread::id, Recorder *> by_thread_; /**< Thread -> its recorder. */
+    std::vector<const Recorder *> attached_;                    /**< Recorders owned elsewhere, see attach(). */
+    Snapshot base_;                                             /**< Counters at the last reset(). */
+
+    static uint64_t next_id(void)
+    {
+        static std::atomic<uint64_t> ids(1);
+        return ids.fetch_add(1);
+    }
+
+    static void add_to(Snapshot &s, std::vector<uint64_t> *max_ns, const Recorder &r)
+    {
+        for (int p = 0; p < static_cast<int>(Phase::COUNT); ++p)
+        {
+            for (int b = 0; b < buckets; ++b)
+            {
+                s.hist[p * buckets + b] += r.hist[p][b].load(std::memory_order_relaxed);
+            }
+            s.total_ns[p] += r.total_ns[p].load(std::memory_order_relaxed);
+            if (max_ns)
+            {
+                (*max_ns)[p] = std::max((*max_ns)[p], r.max_ns[p].load(std::memory_order_relaxed));
+            }
+        }
+    }
+
+    Snapshot collect(std::vector<uint64_t> *max_ns)
+    {
+        Snapshot s;
+        for (const std::unique_ptr<Recorder> &r : recorders_)
+        {
+            add_to(s, max_ns, *r);
+        }
+        for (const Recorder *r : attached_)
+        {
+            add_to(s, max_ns, *r);
+        }
+        return s;
+    }
+
+public:
+    Stats() : id_(next_id()) {}
+
+    /**
+     * @brief Histogram bucket of a sample of `ns` nanoseconds.
+     */
+    static inline int bucket(const uint64_t ns)
+    {
+        if (ns < (1u << sub_bits))
+        {
+            return static_cast<int>(ns);
+        }
+        const int msb = 63 - __builtin_clzll(ns);
+        const int sub = static_cast<int>((ns >> (msb - sub_bits)) & ((1u << sub_bits) - 1));
+        return ((msb - sub_bits + 1) << sub_bits) + sub;
+    }
+
+    /**
+     * @brief Smallest value that falls into bucket `b`.
+     */
+    static inline double bucket_floor(const int b)
+    {
+        if (b < (1 << sub_bits))
+        {
+            return b;
+        }
+        const int msb = (b >> sub_bits) + sub_bits - 1;
+        const uint64_t sub = static_cast<uint64_t>(b & ((1 << sub_bits) - 1));
+        return static_cast<double>((uint64_t(1) << msb) | (sub << (msb - sub_bits)));
+    }
+
+    /**
+     * @brief The calling thread's recorder, created on first use.
+     */
+    Recorder &local(void)
+    {
+        struct Cached
+        {
+            uint64_t owner;
+            Recorder *rec;
+        };
+        static thread_local Cached cached = {0, nullptr};
+        if (cached.owner == id_)
+        {
+            return *cached.rec;
+        }
+        std::lock_guard<std::mutex> lock(m_);
+        Recorder *&rec = by_thread_[std::this_thread::get_id()];
+        if (!rec)
+        {
+            recorders_.emplace_back(new Recorder());
+            rec = recorders_.back().get();
+        }
+        cached.owner = id_;
+        cached.rec = rec;
+        return *rec;
+    }
+
+    /**
+     * @brief Record `ns` nanoseconds spent in `phase` by the calling thread.
+     */
+    inline void add(const Phase phase, const uint64_t ns)
+    {
+        local().add(phase, ns);
+    }
+
+    /**
+     * @brief Per-phase summary of the samples since the last reset().
+     */
+    std::vector<PhaseStats> summary(void)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        std::vector<uint64_t> max_ns(static_cast<int>(Phase::COUNT), 0);
+        const Snapshot now = collect(&max_ns);
+
+        std::vector<PhaseStats> out(static_cast<int>(Phase::COUNT));
+        for (int p = 0; p < static_cast<int>(Phase::COUNT); ++p)
+        {
+            std::vector<uint64_t> h(buckets);
+            uint64_t count = 0;
+            for (int b = 0; b < buckets; ++b)
+            {
+                h[b] = now.hist[p * buckets + b] - base_.hist[p * buckets + b];
+                count += h[b];
+            }
+            PhaseStats &s = out[p];
+            s.count = count;
+            s.total_us = (now.total_ns[p] - base_.total_ns[p]) / 1e3;
+            if (count == 0)
+            {
+                continue;
+            }
+            const double q[3] = {0.50, 0.90, 0.99};
+            double *dst[3] = {&s.p50_us, &s.p90_us, &s.p99_us};
+            for (int k = 0; k < 3; ++k)
+            {
+                const uint64_t rank = static_cast<uint64_t>(q[k] * (count - 1));
+                uint64_t seen = 0;
+                for (int b = 0; b < buckets; ++b)
+                {
+                    seen += h[b];
+                    if (seen > rank)
+                    {
+                        *dst[k] = (bucket_floor(b) + bucket_floor(b + 1)) / 2e3; // bucket midpoint
+                        break;
+                    }
+                }
+            }
+            // the recorders keep the max since they were created; bound it by the window's top bucket
+            int top = buckets - 1;
+            while (h[top] == 0)
+            {
+                --top;
+            }
+            s.max_us = std::min(static_cast<double>(max_ns[p]), bucket_floor(top + 1)) / 1e3;
+        }
+        return out;
+    }
+
+    /**
+     * @brief Start a new measurement window.
+     */
+    void reset(void)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        base_ = collect(nullptr);
+    }
+
+    /**
+     * @brief Count `r`, written by someone else, in every summary from now on.
+     *
+     * `r` must outlive this Stats.
+     */
+    void attach(const Recorder *r)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        attached_.push_back(r);
+    }
+
+    /**
+     * @brief Overwrite `dst` with the samples recorded since the last reset().
+     *
+     * Lets a process export its histograms to a Recorder in shared memory that
+     * another process's Stats attach()es. Only one thread may publish to `dst`.
+     */
+    void publish(Recorder &dst)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        std::vector<uint64_t> max_ns(static_cast<int>(Phase::COUNT), 0);
+        const Snapshot now = collect(&max_ns);
+        for (int p = 0; p < static_cast<int>(Phase::COUNT); ++p)
+        {
+            for (int b = 0; b < buckets; ++b)
+            {
+                dst.hist[p][b].store(now.hist[p * buckets + b] - base_.hist[p * buckets + b], std::memory_order_relaxed);
+            }
+            dst.total_ns[p].store(now.total_ns[p] - base_.total_ns[p], std::memory_order_relaxed);
+            dst.max_ns[p].store(max_ns[p], std::memory_order_relaxed);
+        }
+    }
+};
+
+/**
+ * @brief Adds the lifetime of the object to a phase of a Stats (no-op for nullptr).
+ */
+class ScopedPhase
+{
+private:
+    Stats *stats_;
+    const Phase phase_;
+    std::chrono::steady_clock::time_point start_;
+
+public:
+    ScopedPhase(Stats *stats, const Phase phase) : stats_(stats), phase_(phase)
+    {
+        if (stats_)
+        {
+            start_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    ~ScopedPhase()
+    {
+        if (stats_)
+        {
+            stats_->add(phase_, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count());
+        }
+    }
+};
+
+#define VIPSENV_CONCAT_(a, b) a##b
+#define VIPSENV_CONCAT(a, b) VIPSENV_CONCAT_(a, b)
+
+#ifndef VIPSENV_NO_STATS
+/**
+ * @brief Time the rest of the enclosing scope as `phase` of `stats` (a Stats *, may be nullptr).
+ */
+#define VIPSENV_TIME_PHASE(stats, phase) ScopedPhase VIPSENV_CONCAT(vipsenv_phase_, __LINE__)((stats), (phase))
+#else
+#define VIPSENV_TIME_PHASE(stats, phase) ((void)(stats))
+#endif
@@ -0,0 +1,396 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <random>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include "threadpool.h"
+#include "envpool.h"
+#include "stats.h"
+#include "trajectory.h"
+
+/**
+ * Sync EnvPool
+ *
+ * Synchronous counterpart of EnvPool with the same env_t contract and the same
+ * send()/recv() surface, for callers that always want a finished batch back.
+ * send() and reset() only record the actions; recv() steps the envs with a
+ * blocking ParallelFor in which the calling thread takes part, so a batch
+ * costs no task queues, no completion queue and no cross-thread handoff of
+ * results: every env writes its observation and StepArrays slot in place.
+ *
+ * Observations live in one [num_env, obs_size] buffer, valid until the next
+ * recv(); with init_t::history_len > 1 every slot holds a history as in
+ * EnvPool. Steps can be recorded (init_t::record). Async batches
+ * (batch_size < num_env), several buffers and process shards need EnvPool.
+ *
+ * @tparam env_t      The type representing the environment.
+ * @tparam action_t   The type representing actions to be taken in the environment.
+ * @tparam data_t     The type representing the data associated with each environment.
+ * @tparam init_t     The type representing the initialization parameters for environments.
+ */
+template <class env_t, typename action_t, typename data_t, typename init_t>
+class SyncEnvPool
+{
+private:
+    SyncEnvPool(const SyncEnvPool &) = delete;
+    SyncEnvPool &operator=(const SyncEnvPool &) = delete;
+
+public:
+    const int num_env_ = 0;    /**< Number of environments in the pool. */
+    const int batch_size_ = 0; /**< Number of environments returned by a full recv(). */
+
+    init_t init; /**< Initialization parameters for setting up the environments. */
+
+    std::vector<env_t> envs_; /**< Vector of environments in the pool. */
+
+    std::size_t view_size_ = 0;     /**< Size of the observation one step writes, in bytes. */
+    int history_ = 1;               /**< Observations kept per env, see init_t::history_len. */
+    std::size_t obs_size_ = 0;      /**< Size of one env's slot (history_ observations) in bytes. */
+    std::vector<uint8_t> obs_;      /**< [num_env_, obs_size_] slots the envs write into. */
+    StepArrays slots_;              /**< Per-env step results, written by the team. */
+    std::vector<int> newest_;       /**< History index of each env's newest observation. */
+    std::vector<char> failed_;      /**< Whether each env's last reset or step threw, so its next action resets it. */
+    std::vector<uint8_t> batch_obs_; /**< Gather buffer for batches of fewer than num_env_ envs. */
+    StepArrays batch_;              /**< Gathered step results. */
+    bool gathered_ = false;         /**< Whether the last recv() gathered. */
+
+    std::vector<action_t> actions_; /**< Pending action of each env. */
+    std::vector<char> busy_;        /**< Whether an env has an action pending. */
+    std::vector<int> pending_;      /**< Envs sent since the last recv(). */
+
+    std::unique_ptr<ParallelFor> team_;          /**< Caller plus helper threads stepping the envs. */
+    std::unique_ptr<TrajectoryWriter> recorder_; /**< Trajectory file of init_t::record, nullptr if not recording. */
+    std::vector<uint32_t> recorded_;             /**< Steps recorded per env. */
+
+    /**
+     * @brief Constructor for SyncEnvPool
+     *
+     * @param init_params   The initialization parameters; num_threads counts the calling thread.
+     *
+     * @throws std::runtime_error for options only EnvPool supports.
+     */
+    SyncEnvPool(init_t init_params)
+        : num_env_(init_params.num_env), batch_size_(init_params.num_env)
+    {
+        init = init_params;
+        if (init.batch_size > 0 && init.batch_size < num_env_)
+        {
+            throw std::runtime_error("SyncEnvPool returns every env; async batches (batch_size < num_env) need EnvPool.");
+        }
+        if (init.num_buffers > 1 || init.num_procs > 0)
+        {
+            throw std::runtime_error("SyncEnvPool has one observation buffer and no shard processes; use EnvPool.");
+        }
+        if (!init.stats)
+        {
+            init.stats = std::make_shared<Stats>();
+        }
+
+        view_size_ = env_t::obs_size(init_params);
+        history_ = std::max(1, init_params.history_len);
+        obs_size_ = view_size_ * history_;
+        obs_.assign(static_cast<std::size_t>(num_env_) * obs_size_, 0);
+        slots_.resize(num_env_);
+        for (int i = 0; i < num_env_; ++i)
+        {
+            slots_.env_id[i] = i;
+        }
+        newest_.assign(num_env_, 0);
+        failed_.assign(num_env_, 0);
+
+        envs_.reserve(num_env_);
+        for (int i = 0; i < num_env_; ++i)
+        {
+            envs_.emplace_back(init, obs(i));
+        }
+        actions_.resize(num_env_);
+        busy_.assign(num_env_, 0);
+        seed(init_params.seed < 0 ? std::random_device{}() : static_cast<uint64_t>(init_params.seed));
+
+        int num_threads = init_params.num_threads;
+        if (num_threads <= 0)
+        {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        team_.reset(new ParallelFor(std::min(num_threads, num_env_), init_params.affinity, init_params.cpus, init_params.wait));
+
+        if (!init.record.empty())
+        {
+            recorded_.assign(num_env_, 0);
+            recorder_.reset(new TrajectoryWriter(init.record, TrajectoryMeta::of(init), init.record_compress));
+        }
+    }
+
+    /**
+     * @brief Reset or step env `i` with its pending action and fill its slot.
+     */
+    void run(const int i, data_t &data)
+    {
+        Stats *stats = init.stats.get();
+        uint8_t *slot = obs(i);
+        const bool reset = actions_[i].force_reset || envs_[i].is_done() || failed_[i];
+        if (history_ > 1)
+        {
+            if (reset)
+            {
+                std::memset(slot, 0, obs_size_);
+                newest_[i] = 0;
+            }
+            else
+            {
+                newest_[i] = (newest_[i] + 1) % history_;
+            }
+        }
+        envs_[i].bind(slot + newest_[i] * view_size_);
+
+        failed_[i] = 1;
+        if (reset)
+        {
+            VIPSENV_TIME_PHASE(stats, Phase::RESET);
+            data = envs_[i].reset();
+        } else {
+            VIPSENV_TIME_PHASE(stats, Phase::STEP);
+            data = envs_[i].step(actions_[i]);
+        }
+        failed_[i] = 0;
+        data.env_id = i;
+        slots_.reward[i] = data.reward;
+        slots_.terminated[i] = data.done;
+        slots_.truncated[i] = data.truncated;
+        slots_.timestep[i] = data.info.timestep;
+        slots_.target[i] = data.info.target;
+        slots_.level[i] = data.info.level;
+        slots_.newest[i] = newest_[i];
+        if (recorder_)
+        {
+            recorder_->append(to_record(data, actions_[i], recorded_[i]++, reset));
+        }
+    }
+
+    /**
+     * @brief Set the pending action of the envs in `env_id`.
+     *
+     * @throws std::runtime_error if an id is out of range, repeated, or already
+     * has an action pending; nothing is set in that case.
+     */
+    void claim(const std::vector<action_t> &action, const std::vector<int> &env_id)
+    {
+        if (action.size() != env_id.size())
+        {
+            throw std::runtime_error("Got " + std::to_string(action.size()) + " actions for " + std::to_string(env_id.size()) + " env ids.");
+        }
+        for (std::size_t k = 0; k < env_id.size(); ++k)
+        {
+            const int i = env_id[k];
+            if (i < 0 || i >= num_env_ || busy_[i])
+            {
+                for (std::size_t j = 0; j < k; ++j)
+                {
+                    busy_[env_id[j]] = 0;
+                }
+                throw std::runtime_error("env_id " + std::to_string(i) + " is out of range or already has an action in flight.");
+            }
+            busy_[i] = 1;
+        }
+        for (std::size_t k = 0; k < env_id.size(); ++k)
+        {
+            actions_[env_id[k]] = action[k];
+            pending_.push_back(env_id[k]);
+        }
+    }
+
+    /**
+     * @brief Set the actions of every env for the next recv().
+     */
+    void send(const std::vector<action_t> &action)
+    {
+        send(action, all_env_ids());
+    }
+
+    /**
+     * @brief Set the actions of the envs in `env_id` for the next recv(); action[k] goes to env_id[k].
+     */
+    void send(const std::vector<action_t> &action, const std::vector<int> &env_id)
+    {
+        claim(action, env_id);
+    }
+
+    /**
+     * @brief Reset every env at the next recv().
+     */
+    void reset(void)
+    {
+        reset(all_env_ids());
+    }
+
+    /**
+     * @brief Reset the envs in `env_id` at the next recv().
+     */
+    void reset(const std::vector<int> &env_id)
+    {
+        claim(std::vector<action_t>(env_id.size(), action_t(true)), env_id);
+    }
+
+    /**
+     * @brief Step the envs sent since the last recv() and return their states.
+     */
+    std::vector<data_t> recv(void)
+    {
+        std::vector<data_t> states;
+        recv(states);
+        return states;
+    }
+
+    /**
+     * @brief Step the envs sent since the last recv() on the team, in env order.
+     *
+     * Observations are at batch_obs() in the order of `states`, valid until
+     * the next recv().
+     *
+     * @param states   Vector resized to the number of envs stepped.
+     *
+     * @throws The first exception of an env step, after every env has run; the
+     * next action of an env that threw resets it.
+     */
+    void recv(std::vector<data_t> &states)
+    {
+        std::sort(pending_.begin(), pending_.end());
+        const int n = static_cast<int>(pending_.size());
+        states.resize(n);
+        for (const int i : pending_)
+        {
+            busy_[i] = 0;
+        }
+        const std::vector<int> ids = std::move(pending_);
+        pending_.clear();
+        team_->run(n, [this, &ids, &states](const int k)
+                   { run(ids[k], states[k]); });
+
+        gathered_ = n < num_env_;
+        if (gathered_)
+        {
+            VIPSENV_TIME_PHASE(init.stats.get(), Phase::GATHER);
+            batch_obs_.resize(static_cast<std::size_t>(num_env_) * obs_size_);
+            batch_.resize(num_env_);
+            for (int k = 0; k < n; ++k)
+            {
+                std::memcpy(batch_obs_.data() + k * obs_size_, obs(ids[k]), obs_size_);
+                batch_.copy(k, slots_, ids[k]);
+            }
+        }
+    }
+
+    /**
+     * @brief Always 0: the single buffer is never leased.
+     */
+    uint64_t lease(void) const
+    {
+        return 0;
+    }
+
+    /**
+     * @brief No-op, see lease().
+     */
+    bool release(const uint64_t)
+    {
+        return false;
+    }
+
+    /**
+     * @brief Pointer to the [n, obs_size_] observations of the last recv().
+     */
+    uint8_t *batch_obs(void)
+    {
+        return gathered_ ? batch_obs_.data() : obs_.data();
+    }
+
+    /**
+     * @brief Step results of the last recv(), first n entries, in the order of its states.
+     */
+    const StepArrays &batch_arrays(void) const
+    {
+        return gathered_ ? batch_ : slots_;
+    }
+
+    /**
+     * @brief Ids 0..num_env_-1.
+     */
+    std::vector<int> all_env_ids(void) const
+    {
+        std::vector<int> ids(num_env_);
+        for (int i = 0; i < num_env_; ++i)
+        {
+            ids[i] = i;
+        }
+        return ids;
+    }
+
+    /**
+     * @brief Pointer to the observation slot of env `i`.
+     */
+    uint8_t *obs(const int i)
+    {
+        return obs_.data() + i * obs_size_;
+    }
+
+    /**
+     * @brief Reseed every env from `seed`, see EnvPool::seed().
+     *
+     * @throws std::runtime_error if an env has an action pending.
+     */
+    void seed(const uint64_t seed)
+    {
+        if (!pending_.empty())
+        {
+            throw std::runtime_error("Cannot seed while envs have actions in flight; recv() them first.");
+        }
+        for (int i = 0; i < num_env_; ++i)
+        {
+            envs_[i].seed(seed, i);
+        }
+    }
+
+    /**
+     * @brief Write every step recorded so far to the trajectory file (see init_t::record).
+     */
+    void flush_record(void)
+    {
+        if (recorder_)
+        {
+            recorder_->flush();
+        }
+    }
+
+    /**
+     * @brief Per-phase latency summary since the last reset_stats(), indexed by Phase.
+     */
+    std::vector<PhaseStats> get_stats(void)
+    {
+        return init.stats->summary();
+    }
+
+    /**
+     * @brief Start a new stats window.
+     */
+    void reset_stats(void)
+    {
+        init.stats->reset();
+    }
+
+    /**
+     * @brief Destructor for SyncEnvPool
+     *
+     * Joins the helper threads, then flushes the recording.
+     */
+    ~SyncEnvPool()
+    {
+        team_.reset();
+        recorder_.reset();
+    }
+};
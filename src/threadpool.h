@@ -0,0 +1,538 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+#include <pthread.h>
+
+/**
+ * @brief CPU pinning policy for pool worker threads.
+ */
+enum class Affinity
+{
+    NONE,     ///< Let the OS scheduler place threads.
+    COMPACT,  ///< Thread t on core t % cores (fill neighbouring cores first).
+    SCATTER,  ///< Spread threads evenly over all cores.
+    EXPLICIT, ///< Thread t on cpus[t % cpus.size()].
+};
+
+/**
+ * @brief How a thread waits for work or results.
+ */
+enum class WaitPolicy
+{
+    BLOCK,    ///< Sleep on the futex-backed primitive right away (least CPU).
+    ADAPTIVE, ///< Spin for a budget that adapts to how often spinning pays off, yield a little, then sleep.
+    SPIN,     ///< Spin, then yield until woken; never sleeps (lowest latency, burns a core per waiter).
+};
+
+/**
+ * @brief Pause instruction for spin loops.
+ */
+inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+/**
+ * @brief Poll `ready` according to `policy` before the caller sleeps.
+ *
+ * Spins for `budget` pause iterations, then yields a few times (under SPIN:
+ * until `deadline`). The budget belongs to the waiting thread: it doubles when
+ * spinning found the condition and halves when the caller had to sleep, so a
+ * waiter whose wakeups come within microseconds keeps spinning and one that
+ * idles for milliseconds stops wasting the core.
+ *
+ * @return Whether `ready` returned true; if not, the caller blocks.
+ */
+template <typename Ready>
+inline bool spin_until(const WaitPolicy policy, int &budget, Ready ready,
+                       const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max())
+{
+    static const int min_spins = 64, max_spins = 1 << 14, yields = 16;
+    if (policy == WaitPolicy::BLOCK)
+    {
+        return ready();
+    }
+    budget = std::max(min_spins, std::min(budget, max_spins));
+    for (int k = 0; k < budget; ++k)
+    {
+        if (ready())
+        {
+            budget = std::min(max_spins, budget * 2);
+            return true;
+        }
+        cpu_relax();
+    }
+    for (int k = 0; policy == WaitPolicy::SPIN || k < yields; ++k)
+    {
+        if (ready())
+        {
+            return true;
+        }
+        if (policy == WaitPolicy::SPIN && (k & 63) == 63 && std::chrono::steady_clock::now() >= deadline)
+        {
+            break;
+        }
+        std::this_thread::yield();
+    }
+    budget = std::max(min_spins, budget / 2);
+    return ready();
+}
+
+/**
+ * Work-Stealing ThreadPool
+ *
+ * Runs submitted tasks on a fixed set of worker threads. Each worker owns a
+ * task deque; tasks are pushed to the deque chosen by the caller's hint, the
+ * owner pops from the front and idle workers steal from the back of the others.
+ * This lets a worker whose task is blocked on disk I/O leave its remaining tasks
+ * to whichever worker is free.
+ *
+ * An idle worker polls for new tasks according to its WaitPolicy before it
+ * sleeps on the condition variable; submit() only takes the sleep lock and
+ * notifies when some worker actually sleeps.
+ *
+ * @note Tasks must not throw.
+ *
+ * @see ThreadPool::submit() for queuing work.
+ * @see ThreadPool::~ThreadPool() for the controlled shutdown of the pool.
+ */
+class ThreadPool
+{
+private:
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    struct TaskQueue
+    {
+        std::mutex m;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<TaskQueue>> queues_; /**< One task deque per worker. */
+    std::vector<std::thread> workers_;               /**< Worker threads. */
+
+    std::mutex sleep_m_;         /**< Guards sleeping on cv_. */
+    std::condition_variable cv_; /**< Wakes idle workers when tasks arrive. */
+    std::atomic<int> pending_;   /**< Number of queued, not yet started tasks. */
+    std::atomic<int> sleeping_;  /**< Workers waiting on cv_, changed under sleep_m_. */
+    std::atomic<unsigned> next_; /**< Round-robin cursor for tasks without a hint. */
+    std::atomic<bool> stop_;     /**< Set under sleep_m_ to drain and exit. */
+    const WaitPolicy wait_;      /**< How idle workers wait for tasks. */
+
+    /**
+     * @brief Pop a task from worker `w`'s deque, otherwise steal one from another worker.
+     */
+    bool take(const std::size_t w, std::function<void()> &task)
+    {
+        const std::size_t n = queues_.size();
+        for (std::size_t k = 0; k < n; ++k)
+        {
+            TaskQueue &q = *queues_[(w + k) % n];
+            std::lock_guard<std::mutex> lock(q.m);
+            if (q.tasks.empty())
+            {
+                continue;
+            }
+            if (k == 0)
+            {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+            else
+            {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            }
+            pending_.fetch_sub(1);
+            return true;
+        }
+        return false;
+    }
+
+    void run(const std::size_t w)
+    {
+        std::function<void()> task;
+        int budget = 0;
+        const auto ready = [this]
+        { return stop_.load() || pending_.load() > 0; };
+        for (;;)
+        {
+            if (take(w, task))
+            {
+                task();
+                continue;
+            }
+            if (!spin_until(wait_, budget, ready))
+            {
+                std::unique_lock<std::mutex> lock(sleep_m_);
+                sleeping_.fetch_add(1);
+                cv_.wait(lock, ready);
+                sleeping_.fetch_sub(1);
+            }
+            if (stop_.load() && pending_.load() == 0)
+            {
+                return;
+            }
+        }
+    }
+
+public:
+    /**
+     * @brief Constructor for ThreadPool
+     *
+     * @param num_threads  Number of worker threads (0 = hardware concurrency).
+     * @param affinity     CPU pinning policy for the workers.
+     * @param cpus         CPU ids used by Affinity::EXPLICIT.
+     * @param wait         How idle workers wait for tasks.
+     */
+    ThreadPool(int num_threads, const Affinity affinity = Affinity::NONE, const std::vector<int> &cpus = {},
+               const WaitPolicy wait = WaitPolicy::BLOCK)
+        : pending_(0), sleeping_(0), next_(0), stop_(false), wait_(wait)
+    {
+        if (num_threads <= 0)
+        {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (int i = 0; i < num_threads; ++i)
+        {
+            queues_.emplace_back(new TaskQueue());
+        }
+        for (int i = 0; i < num_threads; ++i)
+        {
+            workers_.emplace_back([this, i]
+                                  { run(i); });
+        }
+        pin(affinity, cpus);
+    }
+
+    /**
+     * @brief Number of worker threads.
+     */
+    std::size_t size(void) const
+    {
+        return workers_.size();
+    }
+
+    /**
+     * @brief Queue a task.
+     *
+     * @param task  Callable to run on a worker.
+     * @param hint  Preferred worker (taken modulo size()); -1 picks round-robin.
+     */
+    void submit(std::function<void()> task, const int hint = -1)
+    {
+        const std::size_t w = (hint < 0 ? next_.fetch_add(1) : static_cast<unsigned>(hint)) % queues_.size();
+        {
+            std::lock_guard<std::mutex> lock(queues_[w]->m);
+            queues_[w]->tasks.emplace_back(std::move(task));
+        }
+        pending_.fetch_add(1);
+        // a worker counts itself in sleeping_ before its last look at pending_, so it cannot miss this
+        if (sleeping_.load() > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(sleep_m_);
+            }
+            cv_.notify_one();
+        }
+    }
+
+    /**
+     * @brief CPU that thread `tid` of `n` pinned workers runs on under `affinity`.
+     *
+     * @return The CPU id, or -1 if the policy leaves the thread unpinned.
+     */
+    static int cpu_of(const std::size_t tid, const std::size_t n, const Affinity affinity, const std::vector<int> &cpus)
+    {
+        if (affinity == Affinity::NONE || (affinity == Affinity::EXPLICIT && cpus.empty()))
+        {
+            return -1;
+        }
+        const std::size_t processor_count = std::max(1u, std::thread::hardware_concurrency());
+        const std::size_t stride = std::max<std::size_t>(1, processor_count / std::max<std::size_t>(1, n));
+        std::size_t cid = tid % processor_count;
+        if (affinity == Affinity::SCATTER)
+        {
+            cid = (tid * stride + tid * stride / processor_count) % processor_count;
+        }
+        else if (affinity == Affinity::EXPLICIT)
+        {
+            return cpus[tid % cpus.size()];
+        }
+        return static_cast<int>(cid);
+    }
+
+    /**
+     * @brief Pin the workers according to `affinity`.
+     */
+    void pin(const Affinity affinity, const std::vector<int> &cpus)
+    {
+        const std::size_t n = workers_.size();
+        for (std::size_t tid = 0; tid < n; ++tid)
+        {
+            const int cid = cpu_of(tid, n, affinity, cpus);
+            if (cid < 0)
+            {
+                return;
+            }
+            cpu_set_t cpuset;
+            CPU_ZERO(&cpuset);
+            CPU_SET(cid, &cpuset);
+            pthread_setaffinity_np(workers_[tid].native_handle(), sizeof(cpu_set_t), &cpuset);
+        }
+    }
+
+    /**
+     * @brief Destructor for ThreadPool
+     *
+     * Runs all queued tasks to completion, then joins the workers.
+     */
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(sleep_m_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto &worker : workers_)
+        {
+            if (worker.joinable())
+            {
+                worker.join();
+            }
+        }
+    }
+};
+
+/**
+ * ParallelFor
+ *
+ * Runs `body(k)` for every k in [0, n) on a fixed team: the calling thread
+ * plus num_threads - 1 helper threads that persist between calls. There are
+ * no task queues: indices are claimed in chunks from one shared cursor tagged
+ * with the call's generation, so a helper arriving late cannot take indices of
+ * a later call, and run() returns as soon as every index is done without
+ * waiting for helpers that did not wake up in time.
+ *
+ * Between calls helpers wait according to their WaitPolicy, like ThreadPool
+ * workers; run() only takes the sleep lock when a helper actually sleeps.
+ *
+ * @see ParallelFor::run()
+ */
+class ParallelFor
+{
+private:
+    ParallelFor(const ParallelFor &) = delete;
+    ParallelFor &operator=(const ParallelFor &) = delete;
+
+    std::vector<std::thread> helpers_;   /**< Helper threads; the caller is the rest of the team. */
+    std::atomic<uint64_t> cursor_;       /**< Generation << 32 | next unclaimed index. */
+    std::atomic<int> n_;                 /**< Indices of the current call. */
+    std::atomic<int> grain_;             /**< Indices claimed at a time. */
+    std::atomic<const std::function<void(int)> *> body_; /**< Body of the current call. */
+    std::atomic<int> remaining_;         /**< Indices of the current call not finished yet. */
+    std::atomic<int> sleeping_;          /**< Helpers waiting on cv_, changed under m_. */
+    std::atomic<int> waiting_;           /**< The caller waits on done_cv_, changed under m_. */
+    std::atomic<bool> stop_;             /**< Set under m_ to make the helpers exit. */
+    std::mutex m_;                       /**< Guards sleeping on cv_ and done_cv_. */
+    std::condition_variable cv_;         /**< Wakes helpers when a call starts. */
+    std::condition_variable done_cv_;    /**< Wakes the caller when the last index is done. */
+    std::mutex error_m_;                 /**< Guards error_. */
+    std::exception_ptr error_;           /**< First exception thrown by the current call's body. */
+    uint32_t generation_ = 0;            /**< Last generation used; each call takes two, see run() (caller only). */
+    int budget_ = 0;                     /**< Caller's adaptive spin budget, see spin_until(). */
+    const WaitPolicy wait_;              /**< How helpers wait for calls and the caller for helpers. */
+
+    /**
+     * @brief Claim and run chunks of call `g` until none is left.
+     */
+    void work(const uint32_t g)
+    {
+        for (;;)
+        {
+            uint64_t c = cursor_.load();
+            int first = 0, last = 0;
+            do
+            {
+                first = static_cast<int>(static_cast<uint32_t>(c));
+                // acquire: a new n_ implies the CAS sees run()'s closing store to cursor_
+                if ((c >> 32) != g || first >= n_.load(std::memory_order_acquire))
+                {
+                    return;
+                }
+                last = std::min(first + grain_.load(std::memory_order_acquire), n_.load(std::memory_order_acquire));
+            } while (!cursor_.compare_exchange_weak(c, c + static_cast<uint64_t>(last - first)));
+
+            // the claim pins call g: run() cannot return (and start another call) before this chunk is done
+            const std::function<void(int)> &body = *body_.load();
+            for (int k = first; k < last; ++k)
+            {
+                try
+                {
+                    body(k);
+                }
+                catch (...)
+                {
+                    std::lock_guard<std::mutex> lock(error_m_);
+                    if (!error_)
+                    {
+                        error_ = std::current_exception();
+                    }
+                }
+            }
+            if (remaining_.fetch_sub(last - first) == last - first && waiting_.load() > 0)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_);
+                }
+                done_cv_.notify_one();
+            }
+        }
+    }
+
+    void help(void)
+    {
+        uint32_t seen = 0;
+        int budget = 0;
+        const auto ready = [this, &seen]
+        { return stop_.load() || static_cast<uint32_t>(cursor_.load() >> 32) != seen; };
+        for (;;)
+        {
+            if (!spin_until(wait_, budget, ready))
+            {
+                std::unique_lock<std::mutex> lock(m_);
+                sleeping_.fetch_add(1);
+                cv_.wait(lock, ready);
+                sleeping_.fetch_sub(1);
+            }
+            if (stop_.load())
+            {
+                return;
+            }
+            seen = static_cast<uint32_t>(cursor_.load() >> 32);
+            work(seen);
+        }
+    }
+
+public:
+    /**
+     * @brief Constructor for ParallelFor
+     *
+     * @param num_threads  Team size including the calling thread (0 = hardware concurrency).
+     * @param affinity     CPU pinning policy; helper t is pinned like thread t of a ThreadPool
+     *                     of num_threads (the caller, thread 0, is left alone).
+     * @param cpus         CPU ids used by Affinity::EXPLICIT.
+     * @param wait         How helpers wait between calls.
+     */
+    ParallelFor(int num_threads, const Affinity affinity = Affinity::NONE, const std::vector<int> &cpus = {},
+                const WaitPolicy wait = WaitPolicy::BLOCK)
+        : cursor_(0), n_(0), grain_(1), body_(nullptr), remaining_(0), sleeping_(0), waiting_(0), stop_(false), wait_(wait)
+    {
+        if (num_threads <= 0)
+        {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (int t = 1; t < num_threads; ++t)
+        {
+            helpers_.emplace_back([this]
+                                  { help(); });
+            const int cid = ThreadPool::cpu_of(t, num_threads, affinity, cpus);
+            if (cid >= 0)
+            {
+                cpu_set_t cpuset;
+                CPU_ZERO(&cpuset);
+                CPU_SET(cid, &cpuset);
+                pthread_setaffinity_np(helpers_.back().native_handle(), sizeof(cpu_set_t), &cpuset);
+            }
+        }
+    }
+
+    /**
+     * @brief Team size, including the calling thread.
+     */
+    std::size_t size(void) const
+    {
+        return helpers_.size() + 1;
+    }
+
+    /**
+     * @brief Run `body(k)` for k in [0, n) on the team and return when all are done.
+     *
+     * Not reentrant: one call at a time, from one thread.
+     *
+     * @throws The first exception thrown by `body`, after every index has run.
+     */
+    void run(const int n, const std::function<void(int)> &body)
+    {
+        if (n <= 0)
+        {
+            return;
+        }
+        // close the last call's generation before publishing this call: a helper still
+        // holding a cursor of the last call must fail its claim instead of pairing it
+        // with the new n_ and running indices twice
+        generation_ += 2;
+        cursor_.store(static_cast<uint64_t>(generation_ - 1) << 32 | 0x7fffffffu);
+        error_ = nullptr;
+        body_.store(&body);
+        n_.store(n);
+        grain_.store(std::max(1, n / static_cast<int>(4 * size())));
+        remaining_.store(n);
+        cursor_.store(static_cast<uint64_t>(generation_) << 32);
+        // a helper counts itself in sleeping_ before its last look at cursor_, so it cannot miss this
+        if (sleeping_.load() > 0)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_);
+            }
+            cv_.notify_all();
+        }
+
+        work(generation_);
+        const auto done = [this]
+        { return remaining_.load() == 0; };
+        if (!spin_until(wait_, budget_, done))
+        {
+            std::unique_lock<std::mutex> lock(m_);
+            waiting_.store(1);
+            done_cv_.wait(lock, done);
+            waiting_.store(0);
+        }
+        if (error_)
+        {
+            std::rethrow_exception(error_);
+        }
+    }
+
+    /**
+     * @brief Destructor for ParallelFor
+     *
+     * Joins the helpers; must not be called during run().
+     */
+    ~ParallelFor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (std::thread &t : helpers_)
+        {
+            t.join();
+        }
+    }
+};
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#include "vipsenv.h"
+#include "tiledimage.h"
+
+/**
+ * @brief TiledEnv Class
+ *
+ * VipsEnv backend for datasets converted to the pre-tiled format (see
+ * tiledimage.h). Each reset maps the episode's file and every crop is copied
+ * row by row straight out of the mapped tiles, so a step costs a page-cache
+ * bound memcpy instead of a codec decode. Episode sampling, seeding,
+ * observation layout and dtype conversion are VipsEnv's; the image cache and
+ * prefetcher are not used, the page cache plays their role.
+ *
+ * Dataset paths must point at converted files, see TiledEnv::convert().
+ *
+ * @class TiledEnv
+ */
+class TiledEnv : public VipsEnv
+{
+public:
+    TiledEnv(TiledEnv &&) = default; ///< Envs are moved, never copied, into the pool's vector
+
+    std::shared_ptr<const TiledImage> tiled; ///< Mapping of the current episode's file
+
+    /**
+     * @brief Constructor for TiledEnv
+     *
+     * @param i Initialization parameters for the environment.
+     * @param obs_slot Storage of obs_size(i) bytes the env writes observations into.
+     */
+    TiledEnv(const init_t &i, uint8_t *obs_slot) : VipsEnv(i, obs_slot) {}
+
+    /**
+     * @brief Converts an image file into the pre-tiled format.
+     *
+     * Pyramid levels are taken from the source like VipsEnv does (pages,
+     * subifds, then 2x shrinks) until `num_levels` levels are written or a level
+     * gets smaller than one tile. Pixels are cast to uint8. Written to
+     * `dst`.tmp and renamed, so readers never map a partial file.
+     *
+     * @param src Any file libvips can open.
+     * @param dst Output path.
+     * @param tile Tile edge in pixels.
+     * @param num_levels Maximum number of levels, including full resolution.
+     */
+    static void convert(const std::string &src, const std::string &dst, const int tile = 256, const int num_levels = 1)
+    {
+        if (tile <= 0)
+        {
+            throw std::runtime_error("TiledEnv::convert: tile must be positive.");
+        }
+        const VImage full = open_image(src, nullptr);
+        std::vector<VImage> levels = open_pyramid(src, nullptr, full, std::max(1, num_levels), std::make_pair(tile, tile));
+
+        TiledImage::Header h;
+        std::memcpy(h.magic, "GVTL", 4);
+        h.version = TiledImage::version;
+        h.bands = static_cast<uint32_t>(full.bands());
+        h.tile = static_cast<uint32_t>(tile);
+        h.levels = static_cast<uint32_t>(levels.size());
+        h.compression = 0;
+
+        std::vector<TiledImage::Level> table;
+        uint64_t tiles = 0;
+        for (VImage &im : levels)
+        {
+            if (im.format() != VIPS_FORMAT_UCHAR)
+            {
+                im = im.cast(VIPS_FORMAT_UCHAR);
+            }
+            TiledImage::Level L;
+            L.width = im.width();
+            L.height = im.height();
+            L.tiles_x = static_cast<uint32_t>((im.width() + tile - 1) / tile);
+            L.tiles_y = static_cast<uint32_t>((im.height() + tile - 1) / tile);
+            L.first = tiles;
+            table.push_back(L);
+            tiles += static_cast<uint64_t>(L.tiles_x) * L.tiles_y;
+        }
+
+        const std::size_t bytes = TiledImage::tile_bytes(h.tile, h.bands);
+        const uint64_t data = TiledImage::data_offset(h.levels, tiles);
+        std::vector<uint64_t> offsets(tiles);
+        for (uint64_t k = 0; k < tiles; ++k)
+        {
+            offsets[k] = data + k * bytes;
+        }
+
+        const std::string tmp = dst + ".tmp";
+        FILE *f = std::fopen(tmp.c_str(), "wb");
+        if (!f)
+        {
+            throw std::runtime_error(tmp + ": cannot create tiled image.");
+        }
+        const uint64_t meta = sizeof(h) + table.size() * sizeof(TiledImage::Level) + offsets.size() * sizeof(uint64_t);
+        const std::vector<uint8_t> pad(static_cast<std::size_t>(data - meta), 0);
+        bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1 &&
+                  std::fwrite(table.data(), sizeof(TiledImage::Level), table.size(), f) == table.size() &&
+                  std::fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), f) == offsets.size() &&
+                  std::fwrite(pad.data(), 1, pad.size(), f) == pad.size();
+
+        std::vector<uint8_t> buf(bytes);
+        for (std::size_t l = 0; ok && l < levels.size(); ++l)
+        {
+            const TiledImage::Level &L = table[l];
+            for (int ty = 0; ok && ty < static_cast<int>(L.tiles_y); ++ty)
+            {
+                // one strip of tile rows per region keeps the source read top to bottom
+                VipsRect strip = VipsRect{0, ty * tile, L.width, std::min(tile, L.height - ty * tile)};
+                VRegion r = levels[l].region(&strip);
+                for (int tx = 0; ok && tx < static_cast<int>(L.tiles_x); ++tx)
+                {
+                    const int x = tx * tile;
+                    const std::size_t run = static_cast<std::size_t>(std::min(tile, L.width - x)) * h.bands;
+                    std::fill(buf.begin(), buf.end(), 0);
+                    for (int iy = 0; iy < strip.height; ++iy)
+                    {
+                        std::memcpy(buf.data() + static_cast<std::size_t>(iy) * tile * h.bands, r.addr(x, strip.top + iy), run);
+                    }
+                    ok = std::fwrite(buf.data(), 1, bytes, f) == bytes;
+                }
+            }
+        }
+        if (std::fclose(f) != 0 || !ok || std::rename(tmp.c_str(), dst.c_str()) != 0)
+        {
+            std::remove(tmp.c_str());
+            throw std::runtime_error(dst + ": cannot write tiled image.");
+        }
+    }
+
+    /**
+     * @brief Switches the env to a newly mapped file.
+     *
+     * Runs on a pool worker; EnvPool::recv() rethrows its errors. The env
+     * keeps its current file if the new one cannot be used.
+     *
+     * @param index Dataset index of the file.
+     *
+     * @throws std::runtime_error if the file cannot be mapped or is smaller than the view.
+     */
+    void _init_tiled(const int index)
+    {
+        std::shared_ptr<const TiledImage> next;
+        {
+            VIPSENV_TIME_PHASE(stats.get(), Phase::OPEN);
+            next = TiledImage::open(dataset->path(index));
+        }
+        if (next->width() < view_sz.second || next->height() < view_sz.first)
+        {
+            throw std::runtime_error(std::string(dataset->path(index)) + ": image is smaller than the view.");
+        }
+        tiled = std::move(next);
+        dataset_index = index;
+        width = tiled->width();
+        height = tiled->height();
+        bands = tiled->bands();
+        level_sz.clear();
+        for (int l = 0; l < std::min(num_levels, tiled->levels()); ++l)
+        {
+            if (tiled->width(l) < view_sz.second || tiled->height(l) < view_sz.first)
+            {
+                break;
+            }
+            level_sz.emplace_back(tiled->width(l), tiled->height(l));
+        }
+        copy_row = select_deinterleave(bands, obs.C);
+    }
+
+    /**
+     * @brief Copies the view at (left, top) of level `level` into `img`.
+     *
+     * Each output row is assembled from the runs of the tiles it crosses.
+     */
+    void copy_tiles(const int level, const int left, const int top, image_t &img)
+    {
+        VIPSENV_TIME_PHASE(stats.get(), Phase::COPY);
+        _draw_augment();
+        for (int y = 0; y < img.H; ++y)
+        {
+            for (int x = 0, run = 0; x < img.W; x += run)
+            {
+                const uint8_t *p = tiled->pixel(level, left + x, top + y, run);
+                run = std::min(run, img.W - x);
+                write_row(p, img, y, x, run);
+            }
+        }
+    }
+
+    /**
+     * @brief Switches the env to dataset file `index`, see VipsEnv::_open().
+     */
+    void _open(const int index)
+    {
+        _init_tiled(index);
+    }
+
+    /**
+     * @brief Copies the view at (left, top) of level `level` into `img`, see VipsEnv::_crop().
+     */
+    void _crop(const int level, const int left, const int top, image_t &img)
+    {
+        copy_tiles(level, left, top, img);
+    }
+
+    /**
+     * @brief Resets the environment by mapping a random file and copying the initial crop.
+     *
+     * Draws the episode exactly like VipsEnv (file, then crop position), so a
+     * converted dataset replays the same episodes for the same seed.
+     *
+     * @return Initial data_t object representing the state after the reset.
+     */
+    data_t reset()
+    {
+        const int index = _draw_index();
+        const float u = rng.uniform();
+        const float v = rng.uniform();
+        _init_tiled(index);
+
+        const int left = static_cast<int>((width - view_sz.second) * u);
+        const int top = static_cast<int>((height - view_sz.first) * v);
+        tiled->willneed(0, left, top, view_sz.second, view_sz.first);
+
+        timestep = 0;
+
+        data_t d;
+        d.obs = obs;
+        copy_tiles(0, left, top, d.obs);
+        d.info = info_t(timestep, dataset->cls(dataset_index));
+        d.info.index = dataset_index;
+        d.info.left = left;
+        d.info.top = top;
+        _init_reward(left, top);
+
+        return d;
+    }
+
+    /**
+     * @brief Takes a step in the environment based on the provided action.
+     *
+     * Same crop geometry and reward as VipsEnv::step().
+     *
+     * @param action Action to take in the environment.
+     * @return data_t object representing the state after the step.
+     */
+    data_t step(action_t action)
+    {
+        const int level = std::max(0, std::min(action.level, static_cast<int>(level_sz.size()) - 1));
+        const std::pair<int, int> &sz = level_sz[level];
+        // clamped like VipsEnv: reading past the mapped tiles is out of bounds
+        const int left = _offset(sz.first - view_sz.second, action.val.first);
+        const int top = _offset(sz.second - view_sz.first, action.val.second);
+
+        timestep += 1;
+
+        data_t d;
+        d.obs = obs;
+        copy_tiles(level, left, top, d.obs);
+        d.reward = _reward(level, left, top);
+        d.info = info_t(timestep, dataset->cls(dataset_index), level);
+        d.info.index = dataset_index;
+        d.info.left = left;
+        d.info.top = top;
+        d.done = this->is_done();
+        d.truncated = d.done;
+
+        return d;
+    }
+};
@@ -0,0 +1,249 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * TiledImage
+ *
+ * Read-only memory mapping of a pre-tiled image file. Pixels are stored as
+ * raw uint8, band-interleaved tiles of `tile` x `tile` pixels (edge tiles are
+ * padded to full size), so a crop is served by copying rows straight out of
+ * the page cache instead of decoding. Every pyramid level is stored the same
+ * way, full resolution first.
+ *
+ * File layout (native endianness):
+ *
+ *     Header { char magic[4] = "GVTL"; uint32 version = 1; uint32 bands; uint32 tile; uint32 levels; uint32 compression = 0; }
+ *     Level  { int32 width; int32 height; uint32 tiles_x; uint32 tiles_y; uint64 first; } x levels
+ *     uint64 offset[total tiles]  (file offset of each tile; level by level, row-major)
+ *     tile data, starting at a page boundary
+ *
+ * `first` is the position of a level's first tile in the offset table.
+ * `compression` is reserved for compressed tiles; only 0 (raw) is defined.
+ *
+ * @see TiledEnv::convert() for writing one.
+ */
+class TiledImage
+{
+public:
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t bands;
+        uint32_t tile;
+        uint32_t levels;
+        uint32_t compression;
+    };
+
+    struct Level
+    {
+        int32_t width;    ///< Width of the level in pixels
+        int32_t height;   ///< Height of the level in pixels
+        uint32_t tiles_x; ///< Tiles per row
+        uint32_t tiles_y; ///< Tile rows
+        uint64_t first;   ///< Offset table position of the level's first tile
+    };
+
+    static const uint32_t version = 1;
+    static const uint32_t page = 4096; ///< Alignment of the tile data
+
+private:
+    TiledImage(const TiledImage &) = delete;
+    TiledImage &operator=(const TiledImage &) = delete;
+
+    const uint8_t *map_ = nullptr; /**< Mapping of the whole file. */
+    std::size_t map_bytes_ = 0;    /**< Length of map_. */
+    Header header_;                /**< Copy of the file header. */
+    const Level *levels_ = nullptr;    /**< Level table. */
+    const uint64_t *offsets_ = nullptr; /**< Tile offset table. */
+
+    TiledImage() = default;
+
+public:
+    ~TiledImage()
+    {
+        if (map_)
+        {
+            munmap(const_cast<uint8_t *>(map_), map_bytes_);
+        }
+    }
+
+    /**
+     * @brief Bytes of one tile.
+     */
+    static inline std::size_t tile_bytes(const uint32_t tile, const uint32_t bands)
+    {
+        return static_cast<std::size_t>(tile) * tile * bands;
+    }
+
+    /**
+     * @brief Bytes before the tile data of a file with `tiles` tiles over `levels` levels.
+     */
+    static inline uint64_t data_offset(const uint32_t levels, const uint64_t tiles)
+    {
+        const uint64_t meta = sizeof(Header) + levels * sizeof(Level) + tiles * sizeof(uint64_t);
+        return (meta + page - 1) / page * page;
+    }
+
+    /**
+     * @brief Memory-map and validate a file written by TiledEnv::convert().
+     *
+     * @throws std::runtime_error if the file cannot be mapped or is not a valid tiled image.
+     */
+    static std::shared_ptr<const TiledImage> open(const std::string &path)
+    {
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error(path + ": cannot open tiled image.");
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(Header))
+        {
+            close(fd);
+            throw std::runtime_error(path + ": too small to be a tiled image.");
+        }
+        void *map = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED)
+        {
+            throw std::runtime_error(path + ": cannot map tiled image.");
+        }
+
+        std::shared_ptr<TiledImage> t(new TiledImage());
+        t->map_ = static_cast<const uint8_t *>(map);
+        t->map_bytes_ = static_cast<std::size_t>(st.st_size);
+
+        Header &h = t->header_;
+        std::memcpy(&h, t->map_, sizeof(h));
+        if (std::memcmp(h.magic, "GVTL", 4) != 0 || h.version != version)
+        {
+            throw std::runtime_error(path + ": not a version " + std::to_string(version) + " tiled image.");
+        }
+        if (h.compression != 0)
+        {
+            throw std::runtime_error(path + ": unsupported tile compression " + std::to_string(h.compression) + ".");
+        }
+        if (h.bands == 0 || h.tile == 0 || h.levels == 0 || sizeof(Header) + h.levels * sizeof(Level) > t->map_bytes_)
+        {
+            throw std::runtime_error(path + ": corrupt tiled image header.");
+        }
+        t->levels_ = reinterpret_cast<const Level *>(t->map_ + sizeof(Header));
+
+        uint64_t tiles = 0;
+        for (uint32_t l = 0; l < h.levels; ++l)
+        {
+            const Level &L = t->levels_[l];
+            if (L.width <= 0 || L.height <= 0 || L.first != tiles ||
+                L.tiles_x != (static_cast<uint32_t>(L.width) + h.tile - 1) / h.tile ||
+                L.tiles_y != (static_cast<uint32_t>(L.height) + h.tile - 1) / h.tile)
+            {
+                throw std::runtime_error(path + ": corrupt level " + std::to_string(l) + ".");
+            }
+            tiles += static_cast<uint64_t>(L.tiles_x) * L.tiles_y;
+        }
+        if (data_offset(h.levels, tiles) > t->map_bytes_)
+        {
+            throw std::runtime_error(path + ": truncated tiled image.");
+        }
+        t->offsets_ = reinterpret_cast<const uint64_t *>(t->map_ + sizeof(Header) + h.levels * sizeof(Level));
+        const std::size_t bytes = tile_bytes(h.tile, h.bands);
+        for (uint64_t k = 0; k < tiles; ++k)
+        {
+            if (t->offsets_[k] > t->map_bytes_ || t->map_bytes_ - t->offsets_[k] < bytes)
+            {
+                throw std::runtime_error(path + ": tile " + std::to_string(k) + " is out of bounds.");
+            }
+        }
+        return t;
+    }
+
+    /**
+     * @brief Number of pyramid levels, full resolution included.
+     */
+    inline int levels(void) const
+    {
+        return static_cast<int>(header_.levels);
+    }
+
+    /**
+     * @brief Bands per pixel.
+     */
+    inline int bands(void) const
+    {
+        return static_cast<int>(header_.bands);
+    }
+
+    /**
+     * @brief Edge of a tile in pixels.
+     */
+    inline int tile(void) const
+    {
+        return static_cast<int>(header_.tile);
+    }
+
+    /**
+     * @brief Width of level `l`.
+     */
+    inline int width(const int l = 0) const
+    {
+        return levels_[l].width;
+    }
+
+    /**
+     * @brief Height of level `l`.
+     */
+    inline int height(const int l = 0) const
+    {
+        return levels_[l].height;
+    }
+
+    /**
+     * @brief Address of pixel (x, y) of level `l`.
+     *
+     * @param run Set to the number of pixels from (x, y) that are contiguous in
+     *            memory: up to the end of the tile or of the image row.
+     */
+    inline const uint8_t *pixel(const int l, const int x, const int y, int &run) const
+    {
+        const Level &L = levels_[l];
+        const int t = static_cast<int>(header_.tile);
+        const int tx = x / t, ty = y / t, ix = x % t, iy = y % t;
+        const uint8_t *base = map_ + offsets_[L.first + static_cast<uint64_t>(ty) * L.tiles_x + tx];
+        run = std::min(t - ix, L.width - x);
+        return base + (static_cast<std::size_t>(iy) * t + ix) * header_.bands;
+    }
+
+    /**
+     * @brief Ask the kernel to read ahead the tiles under a rectangle of level `l`.
+     *
+     * Advisory only; used to warm an episode's first crop before it is copied.
+     */
+    void willneed(const int l, const int left, const int top, const int w, const int h) const
+    {
+        const Level &L = levels_[l];
+        const int t = static_cast<int>(header_.tile);
+        const std::size_t bytes = tile_bytes(header_.tile, header_.bands);
+        for (int ty = top / t; ty <= (top + h - 1) / t && ty < static_cast<int>(L.tiles_y); ++ty)
+        {
+            for (int tx = left / t; tx <= (left + w - 1) / t && tx < static_cast<int>(L.tiles_x); ++tx)
+            {
+                const uint64_t off = offsets_[L.first + static_cast<uint64_t>(ty) * L.tiles_x + tx];
+                const uint64_t start = off / page * page;
+                madvise(const_cast<uint8_t *>(map_) + start, static_cast<std::size_t>(off + bytes - start), MADV_WILLNEED);
+            }
+        }
+    }
+};
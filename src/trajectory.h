@@ -0,0 +1,516 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <condition_variable>
+
+#include <zlib.h>
+
+/**
+ * @brief One step of one env, as written by TrajectoryWriter.
+ *
+ * The glimpse is identified by (index, level, left, top); with the view size
+ * of the recording that is enough to crop the observation again.
+ */
+struct TrajectoryRecord
+{
+    uint32_t env = 0;       ///< Env that took the step
+    uint32_t seq = 0;       ///< Steps the env recorded before this one
+    int32_t index = -1;     ///< Dataset index of the image
+    int32_t timestep = 0;   ///< Timestep of the observation (0 = reset)
+    int32_t level = 0;      ///< Pyramid level of the glimpse
+    int32_t left = 0;       ///< Left of the glimpse, in level pixels
+    int32_t top = 0;        ///< Top of the glimpse, in level pixels
+    float action[2] = {0.0f, 0.0f}; ///< Action that led to the glimpse (0 for resets)
+    float reward = 0.0f;    ///< Reward of the step
+    uint8_t done = 0;       ///< Episode terminated
+    uint8_t truncated = 0;  ///< Episode truncated
+    uint8_t reset = 0;      ///< Record is the first glimpse of an episode
+    uint8_t pad = 0;
+};
+static_assert(sizeof(TrajectoryRecord) == 44, "TrajectoryRecord is written as is.");
+
+/**
+ * @brief What a recording was made of: enough to serve it again.
+ */
+struct TrajectoryMeta
+{
+    int view_h = 0, view_w = 0;     ///< View size
+    int channels = 0;               ///< Channels of the observations
+    int num_levels = 1;             ///< Pyramid levels of the pool
+    int num_env = 0;                ///< Envs of the pool
+    std::vector<std::string> files; ///< Dataset paths, by dataset index
+    std::vector<int> classes;       ///< Dataset classes, by dataset index
+
+    /**
+     * @brief Meta of a pool built from `init`.
+     */
+    template <typename init_t>
+    static TrajectoryMeta of(const init_t &init)
+    {
+        TrajectoryMeta meta;
+        meta.view_h = init.view_sz.first;
+        meta.view_w = init.view_sz.second;
+        meta.channels = init.channels;
+        meta.num_levels = init.num_levels;
+        meta.num_env = init.num_env;
+        for (std::size_t k = 0; k < init.dataset->size(); ++k)
+        {
+            meta.files.emplace_back(init.dataset->path(k));
+            meta.classes.push_back(init.dataset->cls(k));
+        }
+        return meta;
+    }
+};
+
+/**
+ * @brief Record of a finished step `data` of env data.env_id, taken with `action`.
+ *
+ * data_t::info must carry index, left and top besides timestep and level.
+ *
+ * @param seq   Steps the env recorded before this one.
+ * @param reset Whether the pool ran a reset rather than a step, i.e.
+ *              action.force_reset or the env was done; `action` is not stored then.
+ */
+template <typename data_t, typename action_t>
+inline TrajectoryRecord to_record(const data_t &data, const action_t &action, const uint32_t seq, const bool reset)
+{
+    TrajectoryRecord r;
+    r.env = static_cast<uint32_t>(data.env_id);
+    r.seq = seq;
+    r.index = data.info.index;
+    r.timestep = data.info.timestep;
+    r.level = data.info.level;
+    r.left = data.info.left;
+    r.top = data.info.top;
+    r.reward = data.reward;
+    r.done = data.done;
+    r.truncated = data.truncated;
+    r.reset = reset;
+    if (!r.reset)
+    {
+        r.action[0] = action.val.first;
+        r.action[1] = action.val.second;
+    }
+    return r;
+}
+
+/**
+ * Trajectory file format
+ *
+ * Header ("GVTJ", version, record size, compression, view_h, view_w, channels,
+ * num_levels, num_env, file count as uint32), then per file its class
+ * (int32), path length (uint32) and path bytes. Then chunks: record count and
+ * stored bytes (uint32 each) followed by the records, zlib-compressed when the
+ * header says so. Chunks are appended as they fill, so an interrupted
+ * recording is readable up to its last complete chunk.
+ */
+namespace trajectory_format
+{
+    static const uint32_t version = 1;
+    static const uint32_t header_words = 10;
+}
+
+/**
+ * TrajectoryWriter
+ *
+ * Appends TrajectoryRecords from any number of threads to a trajectory file.
+ * Like Stats, every thread appends into its own buffer without locking; a full
+ * buffer (chunk_records records) is handed to a background thread that
+ * compresses and writes it, so the stepping threads never touch the file.
+ */
+class TrajectoryWriter
+{
+private:
+    TrajectoryWriter(const TrajectoryWriter &) = delete;
+    TrajectoryWriter &operator=(const TrajectoryWriter &) = delete;
+
+    typedef std::vector<TrajectoryRecord> Chunk;
+
+    const uint64_t id_;                                      /**< Unique id, keys the per-thread lookup cache. */
+    const std::string path_;                                 /**< Output file. */
+    const bool compress_;                                    /**< zlib-compress the chunks. */
+    const std::size_t chunk_records_;                        /**< Records per chunk. */
+    FILE *f_ = nullptr;                                      /**< Output, written by writer_ only. */
+
+    std::mutex m_;                                           /**< Guards everything below. */
+    std::condition_variable cv_;                             /**< Signals full_ to the writer and drained to flush(). */
+    std::vector<std::unique_ptr<Chunk>> buffers_;            /**< One per thread that appended, kept after it exits. */
+    std::unordered_map<std::thread::id, Chunk *> by_thread_; /**< Thread -> its buffer. */
+    std::deque<Chunk> full_;                                 /**< Chunks waiting to be written. */
+    std::vector<Chunk> spare_;                               /**< Written chunks, recycled as buffers. */
+    bool writing_ = false;                                   /**< The writer holds a chunk outside full_. */
+    bool stop_ = false;                                      /**< Stops the writer once full_ is empty. */
+    bool failed_ = false;                                    /**< A write failed; the recording is truncated. */
+    uint64_t records_ = 0;                                   /**< Records handed to the writer. */
+    std::thread writer_;                                     /**< Background writer. */
+
+    static uint64_t next_id(void)
+    {
+        static std::atomic<uint64_t> ids(1);
+        return ids.fetch_add(1);
+    }
+
+    /**
+     * @brief The calling thread's buffer, created on first use.
+     */
+    Chunk &local(void)
+    {
+        struct Cached
+        {
+            uint64_t owner;
+            Chunk *buf;
+        };
+        static thread_local Cached cached = {0, nullptr};
+        if (cached.owner == id_)
+        {
+            return *cached.buf;
+        }
+        std::lock_guard<std::mutex> lock(m_);
+        Chunk *&buf = by_thread_[std::this_thread::get_id()];
+        if (!buf)
+        {
+            buffers_.emplace_back(new Chunk());
+            buf = buffers_.back().get();
+            buf->reserve(chunk_records_);
+        }
+        cached.owner = id_;
+        cached.buf = buf;
+        return *buf;
+    }
+
+    /**
+     * @brief Queue `buf` for writing and give it an empty replacement; needs m_.
+     */
+    void hand_off(Chunk &buf)
+    {
+        records_ += buf.size();
+        full_.emplace_back();
+        full_.back().swap(buf);
+        if (!spare_.empty())
+        {
+            buf.swap(spare_.back());
+            spare_.pop_back();
+        }
+        buf.clear();
+        buf.reserve(chunk_records_);
+        cv_.notify_all();
+    }
+
+    bool write_chunk(const Chunk &c, std::vector<uint8_t> &z)
+    {
+        const uLong raw = static_cast<uLong>(c.size() * sizeof(TrajectoryRecord));
+        const uint8_t *data = reinterpret_cast<const uint8_t *>(c.data());
+        uLongf stored = raw;
+        if (compress_)
+        {
+            stored = compressBound(raw);
+            z.resize(stored);
+            if (compress2(z.data(), &stored, data, raw, 1) != Z_OK)
+            {
+                return false;
+            }
+            data = z.data();
+        }
+        const uint32_t head[2] = {static_cast<uint32_t>(c.size()), static_cast<uint32_t>(stored)};
+        return std::fwrite(head, sizeof(head), 1, f_) == 1 && std::fwrite(data, 1, stored, f_) == stored;
+    }
+
+    void write_loop(void)
+    {
+        std::vector<uint8_t> z;
+        std::unique_lock<std::mutex> lock(m_);
+        while (true)
+        {
+            cv_.wait(lock, [this]
+                     { return stop_ || !full_.empty(); });
+            if (full_.empty())
+            {
+                return;
+            }
+            Chunk c;
+            c.swap(full_.front());
+            full_.pop_front();
+            writing_ = true;
+            lock.unlock();
+            const bool ok = write_chunk(c, z) && std::fflush(f_) == 0;
+            lock.lock();
+            writing_ = false;
+            failed_ = failed_ || !ok;
+            spare_.emplace_back();
+            spare_.back().swap(c);
+            cv_.notify_all();
+        }
+    }
+
+public:
+    /**
+     * @brief Create `path` and write its header.
+     *
+     * @param compress zlib-compress the chunks (level 1).
+     * @param chunk_records Records per chunk and per-thread buffer.
+     *
+     * @throws std::runtime_error if the file cannot be written.
+     */
+    TrajectoryWriter(const std::string &path, const TrajectoryMeta &meta, const bool compress = true, const std::size_t chunk_records = 4096)
+        : id_(next_id()), path_(path), compress_(compress), chunk_records_(std::max<std::size_t>(1, chunk_records))
+    {
+        f_ = std::fopen(path.c_str(), "wb");
+        if (!f_)
+        {
+            throw std::runtime_error(path + ": cannot create trajectory file.");
+        }
+        const uint32_t head[trajectory_format::header_words] = {
+            0x4A545647u, // "GVTJ"
+            trajectory_format::version,
+            static_cast<uint32_t>(sizeof(TrajectoryRecord)),
+            compress ? 1u : 0u,
+            static_cast<uint32_t>(meta.view_h),
+            static_cast<uint32_t>(meta.view_w),
+            static_cast<uint32_t>(meta.channels),
+            static_cast<uint32_t>(meta.num_levels),
+            static_cast<uint32_t>(meta.num_env),
+            static_cast<uint32_t>(meta.files.size())};
+        bool ok = std::fwrite(head, sizeof(head), 1, f_) == 1;
+        for (std::size_t i = 0; ok && i < meta.files.size(); ++i)
+        {
+            const int32_t cls = i < meta.classes.size() ? meta.classes[i] : 0;
+            const uint32_t len = static_cast<uint32_t>(meta.files[i].size());
+            ok = std::fwrite(&cls, sizeof(cls), 1, f_) == 1 && std::fwrite(&len, sizeof(len), 1, f_) == 1 &&
+                 std::fwrite(meta.files[i].data(), 1, len, f_) == len;
+        }
+        if (!ok)
+        {
+            std::fclose(f_);
+            throw std::runtime_error(path + ": cannot write trajectory file.");
+        }
+        writer_ = std::thread(&TrajectoryWriter::write_loop, this);
+    }
+
+    /**
+     * @brief Flush, then stop the writer and close the file.
+     */
+    ~TrajectoryWriter()
+    {
+        try
+        {
+            flush();
+        }
+        catch (const std::exception &e)
+        {
+            std::fprintf(stderr, "%s\n", e.what());
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        writer_.join();
+        std::fclose(f_);
+    }
+
+    /**
+     * @brief Append a record from the calling thread.
+     */
+    inline void append(const TrajectoryRecord &r)
+    {
+        Chunk &buf = local();
+        buf.push_back(r);
+        if (buf.size() >= chunk_records_)
+        {
+            std::lock_guard<std::mutex> lock(m_);
+            hand_off(buf);
+        }
+    }
+
+    /**
+     * @brief Write every record appended so far and wait until it is on disk.
+     *
+     * Takes the other threads' partial buffers, so no thread may append
+     * concurrently (EnvPool calls it with no envs in flight).
+     *
+     * @throws std::runtime_error if a write failed.
+     */
+    void flush(void)
+    {
+        std::unique_lock<std::mutex> lock(m_);
+        for (std::unique_ptr<Chunk> &buf : buffers_)
+        {
+            if (!buf->empty())
+            {
+                hand_off(*buf);
+            }
+        }
+        cv_.wait(lock, [this]
+                 { return full_.empty() && !writing_; });
+        if (failed_)
+        {
+            throw std::runtime_error(path_ + ": cannot write trajectory file; the recording is truncated.");
+        }
+    }
+
+    /**
+     * @brief Records handed to the background writer so far.
+     */
+    uint64_t records(void)
+    {
+        std::lock_guard<std::mutex> lock(m_);
+        return records_;
+    }
+};
+
+/**
+ * Trajectory
+ *
+ * A trajectory file read back into memory, records grouped by env in the
+ * order each env took them (TrajectoryRecord::seq).
+ */
+class Trajectory
+{
+private:
+    Trajectory(const Trajectory &) = delete;
+    Trajectory &operator=(const Trajectory &) = delete;
+
+    TrajectoryMeta meta_;                                /**< Header. */
+    std::vector<TrajectoryRecord> records_;              /**< Every record, in file order. */
+    std::vector<std::vector<uint32_t>> by_env_;          /**< Per env: its records' positions in records_. */
+
+    Trajectory() = default;
+
+public:
+    /**
+     * @brief Read a file written by TrajectoryWriter.
+     *
+     * A truncated last chunk (e.g. the recording process was killed) is ignored.
+     *
+     * @throws std::runtime_error if the file cannot be read or is not a trajectory file.
+     */
+    static std::shared_ptr<const Trajectory> open(const std::string &path)
+    {
+        FILE *f = std::fopen(path.c_str(), "rb");
+        if (!f)
+        {
+            throw std::runtime_error(path + ": cannot open trajectory file.");
+        }
+        std::unique_ptr<FILE, int (*)(FILE *)> closer(f, std::fclose);
+        uint32_t head[trajectory_format::header_words];
+        if (std::fread(head, sizeof(head), 1, f) != 1 || head[0] != 0x4A545647u)
+        {
+            throw std::runtime_error(path + ": not a trajectory file.");
+        }
+        if (head[1] != trajectory_format::version || head[2] != sizeof(TrajectoryRecord))
+        {
+            throw std::runtime_error(path + ": unsupported trajectory file version " + std::to_string(head[1]) + ".");
+        }
+        const bool compressed = head[3] != 0;
+
+        std::shared_ptr<Trajectory> t(new Trajectory());
+        TrajectoryMeta &m = t->meta_;
+        m.view_h = static_cast<int>(head[4]);
+        m.view_w = static_cast<int>(head[5]);
+        m.channels = static_cast<int>(head[6]);
+        m.num_levels = static_cast<int>(head[7]);
+        m.num_env = static_cast<int>(head[8]);
+        for (uint32_t i = 0; i < head[9]; ++i)
+        {
+            int32_t cls = 0;
+            uint32_t len = 0;
+            if (std::fread(&cls, sizeof(cls), 1, f) != 1 || std::fread(&len, sizeof(len), 1, f) != 1 || len > (1u << 20))
+            {
+                throw std::runtime_error(path + ": truncated trajectory header.");
+            }
+            std::string file(len, '\0');
+            if (len > 0 && std::fread(&file[0], 1, len, f) != len)
+            {
+                throw std::runtime_error(path + ": truncated trajectory header.");
+            }
+            m.files.push_back(file);
+            m.classes.push_back(cls);
+        }
+
+        std::vector<uint8_t> z;
+        uint32_t chunk[2];
+        while (std::fread(chunk, sizeof(chunk), 1, f) == 1)
+        {
+            const std::size_t at = t->records_.size();
+            const uLong raw = static_cast<uLong>(chunk[0]) * sizeof(TrajectoryRecord);
+            if (!compressed && chunk[1] != raw)
+            {
+                break;
+            }
+            z.resize(chunk[1]);
+            if (std::fread(z.data(), 1, chunk[1], f) != chunk[1])
+            {
+                break; // partial last chunk
+            }
+            t->records_.resize(at + chunk[0]);
+            uint8_t *dst = reinterpret_cast<uint8_t *>(t->records_.data() + at);
+            if (!compressed)
+            {
+                std::memcpy(dst, z.data(), raw);
+                continue;
+            }
+            uLongf got = raw;
+            if (uncompress(dst, &got, z.data(), chunk[1]) != Z_OK || got != raw)
+            {
+                t->records_.resize(at);
+                break;
+            }
+        }
+
+        t->by_env_.resize(std::max(1, m.num_env));
+        for (std::size_t k = 0; k < t->records_.size(); ++k)
+        {
+            const TrajectoryRecord &r = t->records_[k];
+            if (r.env >= t->by_env_.size() || r.index < 0 || static_cast<std::size_t>(r.index) >= m.files.size())
+            {
+                throw std::runtime_error(path + ": record " + std::to_string(k) + " is out of range.");
+            }
+            t->by_env_[r.env].push_back(static_cast<uint32_t>(k));
+        }
+        // an env may have been stepped by several threads, whose buffers were written in any order
+        for (std::vector<uint32_t> &e : t->by_env_)
+        {
+            std::sort(e.begin(), e.end(), [&t](const uint32_t a, const uint32_t b)
+                      { return t->records_[a].seq < t->records_[b].seq; });
+        }
+        return t;
+    }
+
+    inline const TrajectoryMeta &meta(void) const
+    {
+        return meta_;
+    }
+
+    /**
+     * @brief Every record, in the order they were written.
+     */
+    inline const std::vector<TrajectoryRecord> &records(void) const
+    {
+        return records_;
+    }
+
+    /**
+     * @brief Positions in records() of env `env`'s records, in step order.
+     */
+    inline const std::vector<uint32_t> &env(const int env) const
+    {
+        return by_env_[env];
+    }
+
+    inline int num_env(void) const
+    {
+        return static_cast<int>(by_env_.size());
+    }
+};
@@ -1,10 +1,29 @@
-#include <random>
+#pragma once
+
+#include <deque>
+#include <future>
 #include <vector>
 #include <utility>
 #include <cstdlib>
+#include <memory>
 #include <cstdint>
+#include <cstring>
+#include <algorithm>
 #include <vips/vips8>
 
+#include "threadpool.h"
+#include "deinterleave.h"
+#include "convert.h"
+#include "augment.h"
+#include "imagecache.h"
+#include "prefetcher.h"
+#include "rng.h"
+#include "stats.h"
+#include "dataset.h"
+#include "scheduler.h"
+#include "reward.h"
+#include "trajectory.h"
+
 using namespace vips;
 
 /** Keep these datatypes in C++ for portability!
@@ -14,37 +33,50 @@ using namespace vips;
 /**
  * @brief ImageArray Class
  *
- * Represents a 3D array for storing image data with channels, height, and width dimensions.
+ * Non-owning view over a planar (channels, height, width) image. The
+ * storage is owned by the caller (e.g. a slot of the EnvPool observation
+ * buffer) so no allocation happens when an observation is produced.
+ * Elements are `itemsize` bytes; operator() addresses uint8 views only.
  *
  * @class ImageArray
  */
 class ImageArray
 {
 public:
-    std::vector<uint8_t> array; ///< Internal storage for image data.
-    int C = 0, H = 0, W = 0;    ///< Dimensions of the image array (channels, height, width).
+    uint8_t *data = nullptr; ///< Borrowed pointer to C * H * W * itemsize bytes.
+    int C = 0, H = 0, W = 0; ///< Dimensions of the image array (channels, height, width).
+    std::size_t itemsize = 1; ///< Bytes per element.
 
     /**
      * @brief Default constructor for ImageArray.
      *
-     * @note Use this constructor to create an ImageArray instance without specific dimensions.
-     * Call the init() method to initialize the array with specific dimensions before use.
+     * @note Use this constructor to create an empty view.
+     * Call the bind() method to point it at storage before use.
      */
     ImageArray(void) {}
 
     /**
-     * @brief Initialize the ImageArray with specified dimensions.
+     * @brief Point the view at externally owned storage.
      *
+     * @param ptr Pointer to at least c * h * w * item bytes.
      * @param c Number of channels.
      * @param h Height of the image.
      * @param w Width of the image.
-     *
-     * @note Use this method to initialize the ImageArray with specific dimensions before use.
+     * @param item Bytes per element.
      */
-    void init(const int c, const int h, const int w)
+    void bind(uint8_t *ptr, const int c, const int h, const int w, const std::size_t item = 1)
     {
+        data = ptr;
         C = c, H = h, W = w;
-        array = std::vector<uint8_t>(c * w * h);
+        itemsize = item;
+    }
+
+    /**
+     * @brief Size of the viewed image in bytes.
+     */
+    inline std::size_t size(void) const
+    {
+        return static_cast<std::size_t>(C) * H * W * itemsize;
     }
 
     /**
@@ -53,12 +85,11 @@ public:
      * @param c Channel index.
      * @param h Height index.
      * @param w Width index.
-     * @return Reference to the pixel value at the specified indices.
-     * @throws std::runtime_error if the indices are out of bounds.
+     * @return Reference to the pixel value at the specified indices (CHW layout).
      */
     inline uint8_t &operator()(const int c, const int h, const int w)
     {
-        return this->array[(h * W + w) * C + c];
+        return this->data[(c * H + h) * W + w];
     }
 };
 typedef ImageArray image_t;
@@ -66,6 +97,7 @@ typedef ImageArray image_t;
 typedef struct action
 {
     std::pair<float, float> val = std::make_pair(0.0f, 0.0f); ///< Pair of float values for the action.
+    int level = 0;                                            ///< Pyramid level to read from (0 = full resolution).
     bool force_reset = false;                                 ///< Flag indicating whether a forceful reset is necessary.
 
     action() = default;
@@ -76,29 +108,68 @@ typedef struct info
 {
     int timestep = 0; ///< Current timestep in the simulation.
     int target = 0;   ///< Target value associated with the simulation.
+    int level = 0;    ///< Pyramid level the observation was read from.
+    int index = -1;   ///< Dataset index of the image.
+    int left = 0;     ///< Left of the observation, in pixels of its level.
+    int top = 0;      ///< Top of the observation, in pixels of its level.
 
     info() = default;
-    info(int timestep, int target) : timestep(timestep), target(target) {}
+    info(int timestep, int target, int level = 0) : timestep(timestep), target(target), level(level) {}
 } info_t;
 
 typedef struct data
 {
-    image_t obs;            ///< Observation Array
+    image_t obs;            ///< Observation view into the pool buffer
     float reward = 0.0f;    ///< Reward
     bool done = false;      ///< Done
     bool truncated = false; ///< Truncated Episode
     info_t info;            ///< Info
+    int env_id = 0;         ///< Environment that produced this state
 
     data() = default;  // Ensure a valid default constructor
 } data_t;
 
 struct init_t
 {
-    std::vector<std::string> files{};                   ///< File paths
-    std::vector<int> classes{};                         ///< Class Label
-    std::pair<int, int> view_sz = std::make_pair(0, 0); ///< View size
+    std::shared_ptr<const Dataset> dataset{};           ///< File paths and class labels, shared by all envs
+    std::pair<int, int> view_sz = std::make_pair(0, 0); ///< View size (height, width)
     int max_episode_len = 0;                            ///< Max episode length
     int num_env = 0;                                    ///< Number of environments
+    int batch_size = 0;                                 ///< Envs returned per recv (0 = num_env, synchronous)
+    int channels = 3;                                   ///< Channels of the observation
+    int num_threads = 0;                                ///< Worker threads (0 = one per core, at most num_env)
+    Affinity affinity = Affinity::COMPACT;              ///< CPU pinning policy of the workers
+    std::vector<int> cpus{};                            ///< CPU ids for Affinity::EXPLICIT
+    WaitPolicy wait = WaitPolicy::ADAPTIVE;             ///< How workers wait for actions and recv() for results
+    std::shared_ptr<ImageCache> cache{};                ///< Image cache shared by all envs (nullptr = open on every reset)
+    std::shared_ptr<Prefetcher> prefetch{};             ///< I/O threads opening upcoming episodes (nullptr = open in reset)
+    int num_levels = 1;                                 ///< Pyramid levels available to the level action (1 = full resolution only)
+    std::shared_ptr<EpisodeScheduler> scheduler{};      ///< Shared file schedule (nullptr = every env draws files independently)
+    std::shared_ptr<Stats> stats{};                     ///< Phase latency histograms (nullptr = not recorded; EnvPool creates one)
+    int64_t seed = -1;                                  ///< Pool seed; env i draws from stream (seed, i) (-1 = seed from std::random_device)
+    ObsDtype dtype = ObsDtype::UINT8;                   ///< Element type of the observations
+    std::vector<float> mean{};                          ///< Per-channel mean in [0, 1] units for float dtypes (empty = 0)
+    std::vector<float> stddev{};                        ///< Per-channel std in [0, 1] units for float dtypes (empty = 1)
+    int num_buffers = 1;                                ///< Observation buffers in the pool's ring (1 = batch valid until the next send)
+    int history_len = 1;                                ///< Observations kept per env in the pool buffer (1 = newest only)
+    int num_procs = 0;                                  ///< Shard processes stepping the envs (0 = worker threads of this process)
+    std::shared_ptr<Annotations> annotations{};         ///< Annotation masks/polygons per file (nullptr = none)
+    RewardMode reward = RewardMode::NONE;               ///< Reward computed from the annotations
+    std::string record{};                               ///< Trajectory file every step is appended to ("" = not recorded)
+    bool record_compress = true;                        ///< zlib-compress the trajectory file
+    std::shared_ptr<const Trajectory> replay{};         ///< Recording ReplayEnv serves (nullptr = none)
+    std::vector<AugmentSpec> augment{};                 ///< Augmentation of every env (one entry) or of env i (num_env entries); empty = none
+};
+
+/**
+ * @brief An opened image with the first crop of an episode already decoded.
+ */
+struct episode_t
+{
+    int index = -1;                  ///< Dataset index of the image
+    std::vector<VImage> levels;      ///< Pyramid levels, full resolution first
+    VipsRect patch{0, 0, 0, 0};      ///< Initial crop (at level 0)
+    std::shared_ptr<VRegion> region; ///< Decoded initial crop
 };
 
 
@@ -111,99 +182,607 @@ struct init_t
  */
 class VipsEnv
 {
+private:
+    VipsEnv(const VipsEnv &) = delete;
+    VipsEnv &operator=(const VipsEnv &) = delete;
 
 public:
-    const std::vector<std::string> files; ///< File paths
-    const std::vector<int> classes;       ///< Class Label
-    const std::pair<int, int> view_sz;    ///< View size
+    VipsEnv(VipsEnv &&) = default; ///< Envs are moved, never copied, into the pool's vector
+
+    const std::shared_ptr<const Dataset> dataset; ///< Shared dataset index
+    const std::pair<int, int> view_sz;    ///< View size (height, width)
     const int max_episode_len;      ///< Max episode length
+    const std::shared_ptr<ImageCache> cache; ///< Shared image cache, may be nullptr
+    const std::shared_ptr<Prefetcher> prefetch; ///< Shared prefetcher, may be nullptr
+
+    std::deque<std::future<episode_t>> upcoming; ///< Episodes being opened by the prefetcher
+    Rng rng;                                     ///< Episode sampler, see seed()
+    int env_id = 0;                              ///< Id of this env in the pool, see seed()
+    uint64_t episodes_drawn = 0;                 ///< Episodes drawn since seed()
 
     int timestep = 0;               ///< Current timestep in the simulation
     int dataset_index = -1;         ///< Index of the current dataset
 
-    VImage image; ///< VIPS image object
+    const int num_levels;           ///< Pyramid levels to discover per image
+    const std::shared_ptr<Stats> stats; ///< Phase latency histograms, may be nullptr
+    const std::shared_ptr<EpisodeScheduler> scheduler; ///< Shared file schedule, may be nullptr
+    const std::shared_ptr<Annotations> annotations; ///< Shared annotation tables, may be nullptr
+    const RewardMode reward_mode;   ///< Reward of each step
+
+    std::shared_ptr<const AreaTable> area; ///< Annotation of the current image, nullptr if none
+    std::vector<uint8_t> seen;             ///< DISCOVERY: cells of the current image seen this episode
+    int cell_w = 1, cell_h = 1;            ///< DISCOVERY: cell size in full-resolution pixels
+    int cells_x = 0, cells_y = 0;          ///< DISCOVERY: grid size
+
+    VImage image; ///< VIPS image object (full resolution)
+    std::vector<VImage> levels;                ///< Pyramid levels of the image, levels[0] == image
+    std::vector<std::pair<int, int>> level_sz; ///< (width, height) of each level
 
     int height = 0; ///< Height of the image
     int width = 0;  ///< Width of the image
     int bands = 0;  ///< Number of bands in the image
 
+    image_t obs; ///< View of this env's slot in the pool observation buffer
+
+    deinterleave_fn copy_row = nullptr; ///< Crop row kernel for the current band count (nullptr = generic)
+
+    convert_fn convert = nullptr;       ///< uint8 -> dtype kernel (nullptr = uint8 output)
+    std::vector<float> scale, shift;    ///< Per-channel conversion x * scale + shift
+    std::vector<uint8_t> row_buf;       ///< One planar uint8 row per channel, staged before conversion
+
+    const std::vector<AugmentSpec> augment_specs; ///< init_t::augment
+    AugmentSpec augment_spec;           ///< This env's augmentation, picked in seed()
+    Rng aug_rng;                        ///< Augmentation draws, a stream apart from the episode sampler
+    Augment aug;                        ///< Draw applied to the observation being copied
+    AugmentCopy aug_copy;               ///< Stages and remaps the rows of augmented crops
+
     /**
      * @brief Constructor for VipsEnv
      *
      * @param i Initialization parameters for the environment.
+     * @param obs_slot Storage of obs_size(i) bytes the env writes observations into.
      */
-    VipsEnv(const init_t &i) : files(i.files), classes(i.classes), max_episode_len(i.max_episode_len), view_sz(i.view_sz) {}
+    VipsEnv(const init_t &i, uint8_t *obs_slot) : dataset(i.dataset), view_sz(i.view_sz), max_episode_len(i.max_episode_len), cache(i.cache), prefetch(i.prefetch), num_levels(i.num_levels), stats(i.stats), scheduler(i.scheduler),
+                                                annotations(i.annotations), reward_mode(i.annotations ? i.reward : RewardMode::NONE), augment_specs(i.augment)
+    {
+        if (!dataset || dataset->size() == 0)
+        {
+            throw std::runtime_error("VipsEnv needs a non-empty dataset.");
+        }
+        obs.bind(obs_slot, i.channels, view_sz.first, view_sz.second, dtype_size(i.dtype));
+
+        convert = select_convert(i.dtype);
+        if (convert)
+        {
+            for (int c = 0; c < i.channels; ++c)
+            {
+                const float m = c < static_cast<int>(i.mean.size()) ? i.mean[c] : 0.0f;
+                const float sd = c < static_cast<int>(i.stddev.size()) ? i.stddev[c] : 1.0f;
+                scale.push_back(1.0f / (255.0f * sd));
+                shift.push_back(-m / sd);
+            }
+            row_buf.resize(static_cast<std::size_t>(i.channels) * view_sz.second);
+        }
+
+        if (augment_specs.size() > 1 && static_cast<int>(augment_specs.size()) != i.num_env)
+        {
+            throw std::runtime_error("Got " + std::to_string(augment_specs.size()) + " augmentation specs for " + std::to_string(i.num_env) + " envs.");
+        }
+        if (std::any_of(augment_specs.begin(), augment_specs.end(), [](const AugmentSpec &a)
+                        { return a.any(); }))
+        {
+            if (view_sz.first != view_sz.second &&
+                std::any_of(augment_specs.begin(), augment_specs.end(), [](const AugmentSpec &a)
+                            { return a.rot90 > 0; }))
+            {
+                throw std::runtime_error("Rotations by 90 degrees need a square view.");
+            }
+            aug_copy.init(i.channels, view_sz.second);
+        }
+    }
 
     /**
-     * @brief Initializes a random image from the dataset.
+     * @brief Restart the episode sampler at stream (seed, env_id).
+     *
+     * Episodes already drawn for the prefetcher are dropped so the next reset
+     * is the first draw of the new stream.
      *
-     * @note This method initializes a random image from the dataset for the environment.
+     * @param seed Pool seed.
+     * @param env_id Id of this env in the pool.
      */
-    void _init_random_image()
+    void seed(const uint64_t seed, const int env_id)
     {
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dis(0, files.size() - 1);
+        rng.seed(seed, static_cast<uint64_t>(env_id));
+        aug_rng.seed(~seed, static_cast<uint64_t>(env_id));
+        this->env_id = env_id;
+        augment_spec = augment_specs.empty() ? AugmentSpec() : augment_specs[env_id % augment_specs.size()];
+        episodes_drawn = 0;
+        if (scheduler)
+        {
+            scheduler->seed(seed);
+        }
+        upcoming.clear();
+    }
 
-        dataset_index = dis(gen);
+    /**
+     * @brief Point the next observations at another slot of obs_size() bytes.
+     *
+     * EnvPool calls this before every step to rotate through its buffer ring.
+     *
+     * @param obs_slot Storage the env writes observations into from now on.
+     */
+    void bind(uint8_t *obs_slot)
+    {
+        obs.data = obs_slot;
+    }
+
+    /**
+     * @brief Number of bytes one observation occupies in the pool buffer.
+     *
+     * @param i Initialization parameters for the environment.
+     */
+    static std::size_t obs_size(const init_t &i)
+    {
+        return static_cast<std::size_t>(i.channels) * i.view_sz.first * i.view_sz.second * dtype_size(i.dtype);
+    }
 
-        /* pick a random image from the file list */
-        image = VImage::new_from_file(files[dataset_index].c_str(), VImage::option()->set("access", VIPS_ACCESS_RANDOM));
+    /**
+     * @brief (width, height) of a file, read from its header without decoding pixels.
+     *
+     * Used to fill the dimensions of a dataset manifest.
+     */
+    static std::pair<int, int> probe(const std::string &path)
+    {
+        const VImage im = VImage::new_from_file(path.c_str(), VImage::option()->set("access", VIPS_ACCESS_SEQUENTIAL));
+        return std::make_pair(im.width(), im.height());
+    }
+
+    /**
+     * @brief Opens a file, or one page/subifd of it, through the cache if there is one.
+     *
+     * @param path File to open.
+     * @param cache Shared image cache, may be nullptr.
+     * @param field Load option selecting a sub-image ("page" or "subifd"), or nullptr.
+     * @param value Value of `field`.
+     */
+    static VImage open_image(const std::string &path, const std::shared_ptr<ImageCache> &cache, const char *field = nullptr, const int value = 0)
+    {
+        if (cache)
+        {
+            return cache->get(path, field, value);
+        }
+        VOption *options = VImage::option()->set("access", VIPS_ACCESS_RANDOM);
+        if (field)
+        {
+            options->set(field, value);
+        }
+        return VImage::new_from_file(path.c_str(), options);
+    }
+
+    /**
+     * @brief Discovers up to `num_levels` pyramid levels of an image.
+     *
+     * Levels come from the file's subifds (OME-TIFF) or pages (pyramidal TIFF),
+     * keeping only sub-images that get smaller with the same band count. Missing
+     * levels are synthesized with a 2x box shrink of the previous one. Levels
+     * smaller than the view are dropped so every crop stays inside the image.
+     *
+     * @param path File the image was opened from.
+     * @param cache Shared image cache, may be nullptr.
+     * @param full Full resolution image.
+     * @param num_levels Maximum number of levels, including `full`.
+     * @param view_sz View size.
+     */
+    static std::vector<VImage> open_pyramid(const std::string &path, const std::shared_ptr<ImageCache> &cache, const VImage &full,
+                                            const int num_levels, const std::pair<int, int> view_sz)
+    {
+        std::vector<VImage> levels{full};
+        const auto fits = [&](const VImage &im)
+        {
+            return im.width() >= view_sz.second && im.height() >= view_sz.first;
+        };
+
+        const char *field = nullptr;
+        int count = 0, first = 1;
+        if (num_levels > 1 && full.get_typeof("n-subifds") != 0)
+        {
+            field = "subifd", count = full.get_int("n-subifds"), first = 0;
+        }
+        else if (num_levels > 1 && full.get_typeof("n-pages") != 0)
+        {
+            field = "page", count = full.get_int("n-pages"), first = 1;
+        }
+        for (int k = first; field && k < count && static_cast<int>(levels.size()) < num_levels; ++k)
+        {
+            VImage next = open_image(path, cache, field, k);
+            if (next.width() >= levels.back().width() || next.bands() != full.bands())
+            {
+                continue; // thumbnail, label or macro image
+            }
+            if (!fits(next))
+            {
+                break;
+            }
+            levels.push_back(next);
+        }
+        while (static_cast<int>(levels.size()) < num_levels)
+        {
+            VImage next = levels.back().shrink(2, 2);
+            if (!fits(next))
+            {
+                break;
+            }
+            levels.push_back(next);
+        }
+        return levels;
+    }
+
+    /**
+     * @brief Opens an image and decodes the initial crop of an episode.
+     *
+     * Static so it can run on a prefetch thread without touching the env.
+     *
+     * @param path File to open.
+     * @param cache Shared image cache, may be nullptr.
+     * @param index Dataset index of the file.
+     * @param u Horizontal position of the initial crop in [0, 1].
+     * @param v Vertical position of the initial crop in [0, 1].
+     * @param view_sz View size.
+     * @param num_levels Pyramid levels to discover.
+     * @param stats Phase latency histograms, may be nullptr.
+     */
+    static episode_t open_episode(const std::string &path, const std::shared_ptr<ImageCache> &cache, const int index,
+                                  const float u, const float v, const std::pair<int, int> view_sz, const int num_levels,
+                                  Stats *stats)
+    {
+        episode_t ep;
+        ep.index = index;
+        {
+            VIPSENV_TIME_PHASE(stats, Phase::OPEN);
+            ep.levels = open_pyramid(path, cache, open_image(path, cache), num_levels, view_sz);
+        }
+
+        // Normalize coordinates to the range [0, 1]
+        const VImage &image = ep.levels[0];
+        ep.patch = VipsRect{
+            static_cast<int>((image.width() - view_sz.second) * u),
+            static_cast<int>((image.height() - view_sz.first) * v),
+            view_sz.second,
+            view_sz.first
+        };
+        VIPSENV_TIME_PHASE(stats, Phase::FETCH);
+        ep.region = std::make_shared<VRegion>(image.region(&ep.patch));
+        return ep;
+    }
+
+    /**
+     * @brief Dataset index of the next episode, from the scheduler if there is one.
+     */
+    int _draw_index(void)
+    {
+        const int index = scheduler ? scheduler->next(env_id, episodes_drawn)
+                                    : static_cast<int>(rng.below(static_cast<uint32_t>(dataset->size())));
+        episodes_drawn += 1;
+        return index;
+    }
+
+    /**
+     * @brief Picks a random image and initial crop position from the dataset.
+     *
+     * @return Future of the opened episode, running on the prefetcher if there is one.
+     */
+    std::future<episode_t> _random_episode()
+    {
+        const int index = _draw_index();
+        const float u = rng.uniform();
+        const float v = rng.uniform();
+
+        const std::string path = dataset->path(index);
+        const std::shared_ptr<ImageCache> &c = cache;
+        const std::pair<int, int> view = view_sz;
+        const int n = num_levels;
+        const std::shared_ptr<Stats> st = stats;
+        if (!prefetch)
+        {
+            std::promise<episode_t> now;
+            now.set_value(open_episode(path, c, index, u, v, view, n, st.get()));
+            return now.get_future();
+        }
+        return prefetch->submit<episode_t>([path, c, index, u, v, view, n, st]()
+                                           { return open_episode(path, c, index, u, v, view, n, st.get()); });
+    }
+
+    /**
+     * @brief Takes the next episode, keeping `prefetch->depth` more in flight.
+     */
+    episode_t _next_episode()
+    {
+        const std::size_t depth = prefetch ? static_cast<std::size_t>(prefetch->depth) : 0;
+        while (upcoming.size() < depth + 1)
+        {
+            upcoming.push_back(_random_episode());
+        }
+
+        std::future<episode_t> next = std::move(upcoming.front());
+        upcoming.pop_front();
+        if (prefetch)
+        {
+            prefetch->count(next.wait_for(std::chrono::seconds(0)) != std::future_status::ready);
+            while (upcoming.size() < depth)
+            {
+                upcoming.push_back(_random_episode());
+            }
+        }
+        VIPSENV_TIME_PHASE(stats.get(), Phase::EPISODE_WAIT);
+        return next.get();
+    }
+
+    /**
+     * @brief Switches the env to a new episode's image.
+     *
+     * @param ep Opened episode.
+     */
+    void _init_image(const episode_t &ep)
+    {
+        dataset_index = ep.index;
+        levels = ep.levels;
+        image = levels[0];
+        level_sz.clear();
+        for (const VImage &l : levels)
+        {
+            level_sz.emplace_back(l.width(), l.height());
+        }
         height = image.height();
         width = image.width();
         bands = image.bands();
+        copy_row = select_deinterleave(bands, obs.C);
+    }
+
+    /**
+     * @brief Switches the env to dataset file `index`, without sampling a crop.
+     */
+    void _open(const int index)
+    {
+        const std::string path = dataset->path(index);
+        episode_t ep;
+        ep.index = index;
+        {
+            VIPSENV_TIME_PHASE(stats.get(), Phase::OPEN);
+            ep.levels = open_pyramid(path, cache, open_image(path, cache), num_levels, view_sz);
+        }
+        _init_image(ep);
     }
 
     /**
-     * @brief Gets a region from the current image and stores it in the provided image_t object.
+     * @brief Crop offset for action component `a` along an axis with `extent` free pixels.
      *
-     * @param patch VipsRect object specifying the region to retrieve.
-     * @param img Reference to the image_t object to store the retrieved region.
+     * `a` is clamped to [-1, 1] (NaN to -1) before scaling, so the crop stays
+     * inside the level: VRegion::addr() outside the prepared area is out of
+     * bounds, like reading past the mapped tiles of a TiledEnv.
+     */
+    static int _offset(const int extent, const float a)
+    {
+        const float u = std::max(-1.0f, std::min(a, 1.0f));
+        return std::max(0, std::min(static_cast<int>(extent * (u + 1) / 2), extent));
+    }
+
+    /**
+     * @brief Copies the view at (left, top) of level `level` into `img`.
      */
-    void get_region(VipsRect &patch, image_t &img)
+    void _crop(const int level, const int left, const int top, image_t &img)
     {
-        VRegion v = image.region(&patch);
+        VipsRect patch = VipsRect{left, top, view_sz.second, view_sz.first};
+        get_region(patch, img, level);
+    }
 
-        img.init(this->bands, this->view_sz.first, this->view_sz.second);
-        for (int y = 0; y < patch.height; y++)
+    /**
+     * @brief Loads the current image's annotation and starts a new episode of rewards.
+     *
+     * @param left Left of the episode's first glimpse (full resolution).
+     * @param top Top of the episode's first glimpse (full resolution).
+     */
+    void _init_reward(const int left, const int top)
+    {
+        area = nullptr;
+        if (reward_mode == RewardMode::NONE)
+        {
+            return;
+        }
         {
-            VipsPel *p = v.addr(patch.left, patch.top + y);
-            for (int x = 0; x < patch.width; x++)
+            VIPSENV_TIME_PHASE(stats.get(), Phase::OPEN);
+            area = annotations->get(dataset_index, width, height);
+        }
+        if (area && reward_mode == RewardMode::DISCOVERY)
+        {
+            // half-view cells: a glimpse at level 0 covers the centres of about four
+            cell_w = std::max(1, view_sz.second / 2);
+            cell_h = std::max(1, view_sz.first / 2);
+            cells_x = (width + cell_w - 1) / cell_w;
+            cells_y = (height + cell_h - 1) / cell_h;
+            seen.assign(static_cast<std::size_t>(cells_x) * cells_y, 0);
+            _reward(0, left, top);
+        }
+    }
+
+    /**
+     * @brief Reward of the glimpse at (left, top) of pyramid level `level`, see RewardMode.
+     *
+     * O(1) table lookups for COVERAGE. DISCOVERY tracks which grid cells the
+     * episode has seen: a glimpse discovers the unseen cells whose centres it
+     * covers and earns their labelled area, one lookup per cell.
+     */
+    float _reward(const int level, const int left, const int top)
+    {
+        if (!area)
+        {
+            return 0.0f;
+        }
+        const double fx = static_cast<double>(width) / level_sz[level].first;
+        const double fy = static_cast<double>(height) / level_sz[level].second;
+        const double x0 = left * fx, y0 = top * fy;
+        const double x1 = (left + view_sz.second) * fx, y1 = (top + view_sz.first) * fy;
+        const double glimpse = (x1 - x0) * (y1 - y0);
+        if (reward_mode == RewardMode::COVERAGE)
+        {
+            return static_cast<float>(area->area(x0, y0, x1, y1) / glimpse);
+        }
+
+        // cells whose centre (c + 0.5) * cell lies in [x0, x1)
+        const int cx0 = std::max(0, static_cast<int>(std::ceil(x0 / cell_w - 0.5)));
+        const int cx1 = std::min(cells_x, static_cast<int>(std::ceil(x1 / cell_w - 0.5)));
+        const int cy0 = std::max(0, static_cast<int>(std::ceil(y0 / cell_h - 0.5)));
+        const int cy1 = std::min(cells_y, static_cast<int>(std::ceil(y1 / cell_h - 0.5)));
+        double found = 0.0;
+        for (int cy = cy0; cy < cy1; ++cy)
+        {
+            for (int cx = cx0; cx < cx1; ++cx)
             {
-                for (int b = 0; b < this->bands; b++)
+                uint8_t &s = seen[static_cast<std::size_t>(cy) * cells_x + cx];
+                if (!s)
                 {
-                    img(b, y, x) = *p++;
+                    s = 1;
+                    found += area->area(cx * cell_w, cy * cell_h, std::min(width, (cx + 1) * cell_w), std::min(height, (cy + 1) * cell_h));
                 }
             }
         }
+        return static_cast<float>(std::min(1.0, found / glimpse));
     }
 
     /**
-     * @brief Resets the environment by initializing a random image and creating the initial data_t object.
+     * @brief Gets a region from the current image and writes it into the provided image_t view.
      *
-     * @return Initial data_t object representing the state after the reset.
+     * Each interleaved row of the VRegion is split into the planar (CHW) view by a
+     * kernel specialized for the band count (see deinterleave.h), then converted
+     * to the output dtype (see convert.h) while the row is still in L1. Bands beyond the
+     * observation's channel count are dropped; missing channels repeat the last
+     * band (e.g. grayscale into RGB).
+     * With an augmentation (init_t::augment), rows are staged and remapped
+     * on the way out instead, see AugmentCopy.
+     *
+     * @param patch VipsRect object specifying the region to retrieve.
+     * @param img Reference to the image_t view to store the retrieved region in.
+     * @param level Pyramid level `patch` refers to.
      */
-    data_t reset()
+    void get_region(VipsRect &patch, image_t &img, const int level = 0)
     {
-        _init_random_image();
+        VRegion v = [&]()
+        {
+            VIPSENV_TIME_PHASE(stats.get(), Phase::FETCH);
+            return levels[level].region(&patch);
+        }();
+        VIPSENV_TIME_PHASE(stats.get(), Phase::COPY);
+        copy_region(v, patch, img);
+    }
 
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_real_distribution<> dis(0.0f, 1.0f);
+    /**
+     * @brief Writes an already prepared region into the provided image_t view.
+     *
+     * @param v Region covering `patch`.
+     * @param patch VipsRect object specifying the region to copy.
+     * @param img Reference to the image_t view to store the region in.
+     */
+    void copy_region(VRegion &v, const VipsRect &patch, image_t &img)
+    {
+        _draw_augment();
+        for (int y = 0; y < patch.height; y++)
+        {
+            write_row(v.addr(patch.left, patch.top + y), img, y, 0, patch.width);
+        }
+    }
 
-        // Normalize coordinates to the range [0, 1]
-        VipsRect patch = VipsRect{
-            static_cast<int>((width - view_sz.first) * static_cast<float>(dis(gen))),
-            static_cast<int>((height - view_sz.second) * static_cast<float>(dis(gen))),
-            view_sz.first,
-            view_sz.second
-        };
+    /**
+     * @brief Writes `n` interleaved pixels into row `y` of `img`, starting at column `x`.
+     *
+     * @param src First pixel, `bands` bytes each.
+     * @param img Planar view to write into.
+     * @param y Row of `img`.
+     * @param x First column of `img`; x + n must not exceed img.W.
+     * @param n Number of pixels.
+     */
+    void write_row(const uint8_t *src, image_t &img, const int y, const int x, const int n)
+    {
+        if (aug.active())
+        {
+            // stage the whole row, then remap it once its last run is in
+            uint8_t *stage = aug_copy.stage(aug, y, img.C, img.W) + x;
+            if (copy_row)
+            {
+                copy_row(src, stage, img.W, n);
+            }
+            else
+            {
+                deinterleave_generic(src, stage, img.W, n, this->bands, img.C);
+            }
+            if (x + n == img.W)
+            {
+                aug_copy.write(aug, y, img.data, img.C, img.H, img.W, img.itemsize, convert, scale.data(), shift.data());
+            }
+            return;
+        }
+
+        const std::size_t plane = static_cast<std::size_t>(img.H) * img.W;
+        const std::size_t at = static_cast<std::size_t>(y) * img.W + x;
+
+        // uint8 goes straight into the slot, float dtypes through a cache-hot row
+        uint8_t *row = convert ? row_buf.data() : img.data + at;
+        const std::size_t row_plane = convert ? static_cast<std::size_t>(img.W) : plane;
+        if (copy_row)
+        {
+            copy_row(src, row, row_plane, n);
+        }
+        else
+        {
+            deinterleave_generic(src, row, row_plane, n, this->bands, img.C);
+        }
+
+        if (convert)
+        {
+            for (int c = 0; c < img.C; c++)
+            {
+                convert(row + c * row_plane, img.data + (c * plane + at) * img.itemsize, n, scale[c], shift[c]);
+            }
+        }
+    }
+
+    /**
+     * @brief Draws the augmentation of the next observation, see AugmentSpec.
+     *
+     * Called by the crop copies before the first row is written.
+     */
+    void _draw_augment(void)
+    {
+        if (augment_spec.any())
+        {
+            aug.draw(augment_spec, aug_rng, obs.C);
+        }
+    }
+
+    /**
+     * @brief Resets the environment by switching to a random image and creating the initial data_t object.
+     *
+     * With a prefetcher the image was opened and its initial crop decoded on an
+     * I/O thread during the previous episode, so this only swaps it in.
+     *
+     * @return Initial data_t object representing the state after the reset.
+     */
+    data_t reset()
+    {
+        episode_t ep = _next_episode();
+        _init_image(ep);
 
         timestep = 0;
 
         data_t d;
-        get_region(patch, d.obs);
-        d.info = info_t(timestep, classes[dataset_index]);
+        d.obs = obs;
+        {
+            VIPSENV_TIME_PHASE(stats.get(), Phase::COPY);
+            copy_region(*ep.region, ep.patch, d.obs);
+        }
+        d.info = info_t(timestep, dataset->cls(dataset_index));
+        d.info.index = dataset_index;
+        d.info.left = ep.patch.left;
+        d.info.top = ep.patch.top;
+        _init_reward(ep.patch.left, ep.patch.top);
 
         return d;
     }
@@ -211,22 +790,36 @@ public:
     /**
      * @brief Takes a step in the environment based on the provided action.
      *
+     * The crop position is relative to the pyramid level selected by
+     * action.level (clamped to the levels the image has), so coarse levels
+     * show a larger part of the image for the same decode cost. Positions
+     * outside [-1, 1] are clamped to the level's edges. The reward is
+     * computed from the image's annotation, see RewardMode.
+     *
      * @param action Action to take in the environment.
      * @return data_t object representing the state after the step.
      */
     data_t step(action_t action)
     {
+        const int level = std::max(0, std::min(action.level, static_cast<int>(levels.size()) - 1));
+        const std::pair<int, int> &sz = level_sz[level];
         VipsRect patch = VipsRect{
-            static_cast<int>((width - view_sz.first) * (action.val.first + 1) / 2),
-            static_cast<int>((height - view_sz.second) * (action.val.second + 1) / 2),
-            view_sz.first,
-            view_sz.second
+            _offset(sz.first - view_sz.second, action.val.first),
+            _offset(sz.second - view_sz.first, action.val.second),
+            view_sz.second,
+            view_sz.first
         };
 
         timestep += 1;
 
         data_t d;
-        get_region(patch, d.obs);
+        d.obs = obs;
+        get_region(patch, d.obs, level);
+        d.reward = _reward(level, patch.left, patch.top);
+        d.info = info_t(timestep, dataset->cls(dataset_index), level);
+        d.info.index = dataset_index;
+        d.info.left = patch.left;
+        d.info.top = patch.top;
         d.done = this->is_done();
         d.truncated = d.done;
 
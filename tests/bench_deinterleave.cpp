@@ -0,0 +1,95 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "deinterleave.h"
+
+/**
+ * @brief Micro-benchmark of the crop copy kernels against the per-byte loop.
+ *
+ * Copies a view_sz x view_sz crop out of an interleaved row-major image for 1,
+ * 3 and 4 bands, checks every kernel against the reference loop and prints the
+ * time per crop.
+ *
+ * Usage: ./bench_deinterleave [view_sz] [iterations]
+ */
+
+// the loop VipsEnv::get_region used before the kernels
+static void reference(const uint8_t *img, int img_w, int bands, uint8_t *dst, int planes, int h, int w)
+{
+    for (int y = 0; y < h; y++)
+    {
+        const uint8_t *p = img + static_cast<std::size_t>(y) * img_w * bands;
+        for (int x = 0; x < w; x++)
+        {
+            for (int b = 0; b < planes; b++)
+            {
+                dst[(b * h + y) * w + x] = p[b < bands ? b : bands - 1];
+            }
+            p += bands;
+        }
+    }
+}
+
+template <typename F>
+static double time_ns(F f, int iterations)
+{
+    f(); // warm up
+    auto t1 = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        f();
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<double, std::nano>(t2 - t1).count() / iterations;
+}
+
+int main(int argc, char **argv)
+{
+    const int view = argc > 1 ? std::atoi(argv[1]) : 256;
+    const int iterations = argc > 2 ? std::atoi(argv[2]) : 2000;
+    const int img_w = view + 13; // crop rows are not contiguous, like a VRegion
+
+    const int layouts[][2] = {{1, 1}, {1, 3}, {3, 3}, {4, 4}, {4, 3}};
+    const SimdLevel levels[] = {SimdLevel::SCALAR, SimdLevel::SSSE3, SimdLevel::AVX2};
+    const char *names[] = {"scalar", "ssse3", "avx2"};
+
+    std::printf("view %dx%d, best isa %s\n", view, view, names[static_cast<int>(simd_level())]);
+    std::printf("%-6s %-6s %12s %12s %8s\n", "bands", "planes", "kernel", "ns/crop", "speedup");
+
+    int failures = 0;
+    for (auto &layout : layouts)
+    {
+        const int bands = layout[0], planes = layout[1];
+        std::vector<uint8_t> img(static_cast<std::size_t>(img_w) * view * bands);
+        for (std::size_t i = 0; i < img.size(); ++i)
+        {
+            img[i] = static_cast<uint8_t>(i * 131 + (i >> 7));
+        }
+        std::vector<uint8_t> want(static_cast<std::size_t>(planes) * view * view), got(want.size());
+
+        const double ref = time_ns([&]
+                                   { reference(img.data(), img_w, bands, want.data(), planes, view, view); },
+                                   iterations);
+        std::printf("%-6d %-6d %12s %12.0f %8.2f\n", bands, planes, "loop", ref, 1.0);
+
+        for (int l = 0; l <= static_cast<int>(simd_level()); ++l)
+        {
+            deinterleave_fn fn = select_deinterleave(bands, planes, levels[l]);
+            const std::size_t plane = static_cast<std::size_t>(view) * view;
+            const double ns = time_ns([&]
+                                      {
+                for (int y = 0; y < view; ++y)
+                {
+                    fn(img.data() + static_cast<std::size_t>(y) * img_w * bands, got.data() + y * view, plane, view);
+                } },
+                                      iterations);
+            const bool ok = std::memcmp(want.data(), got.data(), want.size()) == 0;
+            failures += !ok;
+            std::printf("%-6d %-6d %12s %12.0f %8.2f%s\n", bands, planes, names[l], ns, ref / ns, ok ? "" : "  MISMATCH");
+        }
+    }
+    return failures != 0;
+}
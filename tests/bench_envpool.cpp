@@ -0,0 +1,417 @@
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include <unistd.h>
+
+#include "envpool.h"
+#include "syncpool.h"
+#include "vipsenv.h"
+#include "tiledenv.h"
+
+/**
+ * @brief Benchmark suite for EnvPool / SyncEnvPool + VipsEnv / TiledEnv.
+ *
+ * Writes synthetic TIFFs (striped, tiled and tiled pyramids) into a scratch
+ * directory, plus the pyramids converted to the pre-tiled format ("gvt",
+ * served by TiledEnv from mapped raw tiles), then sweeps the cartesian product of layout, band count, file
+ * count, view size, env count, thread count, wait policy and pool mode. Every configuration runs a
+ * fixed number of env steps with seeded random actions and reports steps/sec
+ * and the p50/p99 latency of single env steps and resets. Results are written
+ * as JSON (one object per configuration) for tracking regressions across
+ * releases; progress goes to stderr.
+ *
+ * Usage: ./bench_envpool [--option value ...]
+ *
+ *   --layout     striped,tiled,pyramid,gvt  File layouts
+ *   --bands      3                       Bands of the synthetic images
+ *   --files      1,16                    Distinct files in the dataset
+ *   --view       256                     Square view sizes
+ *   --num-env    16,64                   Envs in the pool
+ *   --threads    1,4,0                   Worker threads (0 = one per core)
+ *   --wait       adaptive                WaitPolicy of workers and recv: block, adaptive, spin
+ *   --mode       async                   Pools: async (EnvPool), sync (SyncEnvPool; --procs is ignored)
+ *   --image      4096                    Edge of the synthetic images in pixels
+ *   --steps      20000                   Env steps measured per configuration
+ *   --warmup     2000                    Env steps run before measuring
+ *   --episode    100                     max_episode_len
+ *   --cache      0                       Image cache bytes
+ *   --prefetch   0                       Prefetch depth
+ *   --seed       0                       Pool and action seed
+ *   --procs      0                       Shard processes (0 = threads only; step/reset times from get_stats())
+ *   --record     0                       Record every step to <dir>/bench.gvtj (1 = measure the recorder's cost)
+ *   --augment    0                       1 = random flips, rotations (square views) and colour jitter on every glimpse
+ *   --dir        /tmp/gymvips_bench      Scratch directory for the TIFFs
+ *   --out        -                       JSON output file (- = stdout)
+ */
+
+typedef std::chrono::steady_clock bench_clock;
+
+/**
+ * @brief Env backend that records the duration of each of its steps and resets.
+ *
+ * EnvPool runs at most one task per env at a time, so the samples need no lock.
+ */
+template <class env_t>
+class TimedEnv : public env_t
+{
+public:
+    std::vector<double> step_ns, reset_ns; ///< Samples since the last clear()
+
+    TimedEnv(const init_t &i, uint8_t *obs_slot) : env_t(i, obs_slot) {}
+
+    data_t reset()
+    {
+        const auto t = bench_clock::now();
+        data_t d = env_t::reset();
+        reset_ns.push_back(std::chrono::duration<double, std::nano>(bench_clock::now() - t).count());
+        return d;
+    }
+
+    data_t step(action_t action)
+    {
+        const auto t = bench_clock::now();
+        data_t d = env_t::step(action);
+        step_ns.push_back(std::chrono::duration<double, std::nano>(bench_clock::now() - t).count());
+        return d;
+    }
+
+    void clear(void)
+    {
+        step_ns.clear();
+        reset_ns.clear();
+    }
+};
+
+static std::vector<std::string> split(const std::string &s)
+{
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        if (!item.empty())
+        {
+            out.push_back(item);
+        }
+    }
+    return out;
+}
+
+static std::vector<int> split_int(const std::string &s)
+{
+    std::vector<int> out;
+    for (const std::string &item : split(s))
+    {
+        out.push_back(std::atoi(item.c_str()));
+    }
+    return out;
+}
+
+static double percentile(std::vector<double> &v, const double q)
+{
+    if (v.empty())
+    {
+        return 0.0;
+    }
+    const std::size_t k = std::min(v.size() - 1, static_cast<std::size_t>(q * v.size()));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+/**
+ * @brief Write (or reuse) synthetic file `index` of the given layout and band count.
+ *
+ * Pixels are seeded noise over a coarse gradient, so tiles differ and the
+ * pyramid levels are not constant. "gvt" files are the pyramid TIFFs
+ * converted with TiledEnv::convert().
+ */
+static std::string synthetic_tiff(const std::string &dir, const std::string &layout, const int bands, const int edge, const int index)
+{
+    if (layout == "gvt")
+    {
+        const std::string path = dir + "/gvt_b" + std::to_string(bands) + "_" + std::to_string(edge) + "_" + std::to_string(index) + ".gvt";
+        if (access(path.c_str(), R_OK) != 0)
+        {
+            TiledEnv::convert(synthetic_tiff(dir, "pyramid", bands, edge, index), path, 256, 4);
+        }
+        return path;
+    }
+
+    const std::string path = dir + "/" + layout + "_b" + std::to_string(bands) + "_" + std::to_string(edge) + "_" + std::to_string(index) + ".tif";
+    if (access(path.c_str(), R_OK) == 0)
+    {
+        return path;
+    }
+
+    std::vector<uint8_t> px(static_cast<std::size_t>(edge) * edge * bands);
+    Rng rng(static_cast<uint64_t>(index), static_cast<uint64_t>(bands));
+    for (int y = 0; y < edge; ++y)
+    {
+        uint8_t *row = px.data() + static_cast<std::size_t>(y) * edge * bands;
+        for (int x = 0; x < edge * bands; ++x)
+        {
+            row[x] = static_cast<uint8_t>(((x / bands) * 255 / edge + y * 255 / edge) / 2 + (rng.next() & 63));
+        }
+    }
+
+    VImage image = VImage::new_from_memory(px.data(), px.size(), edge, edge, bands, VIPS_FORMAT_UCHAR);
+    VOption *options = VImage::option();
+    if (layout != "striped")
+    {
+        options->set("tile", true)->set("tile_width", 256)->set("tile_height", 256);
+    }
+    if (layout == "pyramid")
+    {
+        options->set("pyramid", true);
+    }
+    image.write_to_file(path.c_str(), options);
+    return path;
+}
+
+struct Config
+{
+    std::string layout;
+    int bands, files, view, num_env, threads;
+    std::string wait, mode;
+};
+
+/**
+ * @brief WaitPolicy named `name` (block, adaptive or spin).
+ */
+static WaitPolicy wait_policy(const std::string &name)
+{
+    return name == "block" ? WaitPolicy::BLOCK : name == "spin" ? WaitPolicy::SPIN : WaitPolicy::ADAPTIVE;
+}
+
+struct Result
+{
+    double seconds = 0.0, steps_per_sec = 0.0;
+    double step_p50 = 0.0, step_p99 = 0.0, reset_p50 = 0.0, reset_p99 = 0.0;
+    std::size_t steps = 0, resets = 0;
+};
+
+template <class env_t, template <class, typename, typename, typename> class pool_t>
+static Result run(const Config &c, const std::vector<std::string> &files, const std::map<std::string, std::string> &opt)
+{
+    const int steps = std::atoi(opt.at("--steps").c_str());
+    const int warmup = std::atoi(opt.at("--warmup").c_str());
+    const uint64_t seed = std::strtoull(opt.at("--seed").c_str(), nullptr, 10);
+    const int procs = c.mode == "sync" ? 0 : std::atoi(opt.at("--procs").c_str());
+
+    init_t i;
+    i.dataset = Dataset::from_lists(files, std::vector<int>(files.size(), 0));
+    i.view_sz = std::make_pair(c.view, c.view);
+    i.max_episode_len = std::atoi(opt.at("--episode").c_str());
+    i.num_env = c.num_env;
+    i.num_threads = c.threads;
+    i.seed = static_cast<int64_t>(seed);
+    i.num_procs = procs;
+    i.wait = wait_policy(c.wait);
+    if (std::atoi(opt.at("--record").c_str()) != 0)
+    {
+        i.record = opt.at("--dir") + "/bench.gvtj";
+    }
+    if (std::atoi(opt.at("--augment").c_str()) != 0)
+    {
+        AugmentSpec a;
+        a.flip_x = a.flip_y = 0.5f;
+        a.rot90 = 0.5f;
+        a.brightness = a.contrast = 0.1f;
+        i.augment.push_back(a);
+    }
+    const std::size_t cache_bytes = std::strtoull(opt.at("--cache").c_str(), nullptr, 10);
+    if (cache_bytes > 0)
+    {
+        i.cache = std::make_shared<ImageCache>(cache_bytes);
+    }
+    const int depth = std::atoi(opt.at("--prefetch").c_str());
+    if (depth > 0)
+    {
+        i.prefetch = std::make_shared<Prefetcher>(0, depth);
+    }
+
+    pool_t<TimedEnv<env_t>, action_t, data_t, init_t> pool(i);
+    pool.reset();
+    std::vector<data_t> data = pool.recv();
+
+    Rng rng(seed, 0x5eed);
+    std::vector<action_t> act(c.num_env);
+    const auto round = [&]()
+    {
+        for (action_t &a : act)
+        {
+            a.val = std::make_pair(rng.uniform() * 2 - 1, rng.uniform() * 2 - 1);
+        }
+        pool.send(act);
+        pool.recv(data);
+    };
+
+    for (int s = 0; s < warmup; s += c.num_env)
+    {
+        round();
+    }
+    for (TimedEnv<env_t> &e : pool.envs_)
+    {
+        e.clear();
+    }
+    pool.reset_stats();
+
+    Result r;
+    const auto t = bench_clock::now();
+    for (int s = 0; s < steps; s += c.num_env)
+    {
+        round();
+    }
+    r.seconds = std::chrono::duration<double>(bench_clock::now() - t).count();
+
+    if (procs > 0)
+    {
+        // the envs' own timings stay in the shard processes; use the merged phase histograms
+        const std::vector<PhaseStats> s = pool.get_stats();
+        const PhaseStats &step = s[static_cast<int>(Phase::STEP)], &reset = s[static_cast<int>(Phase::RESET)];
+        r.steps = step.count;
+        r.resets = reset.count;
+        r.steps_per_sec = (r.steps + r.resets) / r.seconds;
+        r.step_p50 = step.p50_us;
+        r.step_p99 = step.p99_us;
+        r.reset_p50 = reset.p50_us;
+        r.reset_p99 = reset.p99_us;
+        return r;
+    }
+
+    std::vector<double> step_ns, reset_ns;
+    for (TimedEnv<env_t> &e : pool.envs_)
+    {
+        step_ns.insert(step_ns.end(), e.step_ns.begin(), e.step_ns.end());
+        reset_ns.insert(reset_ns.end(), e.reset_ns.begin(), e.reset_ns.end());
+    }
+    r.steps = step_ns.size();
+    r.resets = reset_ns.size();
+    r.steps_per_sec = (r.steps + r.resets) / r.seconds;
+    r.step_p50 = percentile(step_ns, 0.50) / 1e3;
+    r.step_p99 = percentile(step_ns, 0.99) / 1e3;
+    r.reset_p50 = percentile(reset_ns, 0.50) / 1e3;
+    r.reset_p99 = percentile(reset_ns, 0.99) / 1e3;
+    return r;
+}
+
+template <class env_t>
+static Result run(const Config &c, const std::vector<std::string> &files, const std::map<std::string, std::string> &opt)
+{
+    return c.mode == "sync" ? run<env_t, SyncEnvPool>(c, files, opt) : run<env_t, EnvPool>(c, files, opt);
+}
+
+int main(int argc, char **argv)
+{
+    if (VIPS_INIT(argv[0]))
+        vips_error_exit(NULL);
+
+    std::map<std::string, std::string> opt = {
+        {"--layout", "striped,tiled,pyramid,gvt"},
+        {"--bands", "3"},
+        {"--files", "1,16"},
+        {"--view", "256"},
+        {"--num-env", "16,64"},
+        {"--threads", "1,4,0"},
+        {"--wait", "adaptive"},
+        {"--mode", "async"},
+        {"--image", "4096"},
+        {"--steps", "20000"},
+        {"--warmup", "2000"},
+        {"--episode", "100"},
+        {"--cache", "0"},
+        {"--prefetch", "0"},
+        {"--seed", "0"},
+        {"--procs", "0"},
+        {"--record", "0"},
+        {"--augment", "0"},
+        {"--dir", "/tmp/gymvips_bench"},
+        {"--out", "-"},
+    };
+    for (int a = 1; a + 1 < argc; a += 2)
+    {
+        if (opt.find(argv[a]) == opt.end())
+        {
+            std::fprintf(stderr, "unknown option %s\n", argv[a]);
+            return 2;
+        }
+        opt[argv[a]] = argv[a + 1];
+    }
+
+    const std::string dir = opt["--dir"];
+    if (std::system(("mkdir -p '" + dir + "'").c_str()) != 0)
+    {
+        std::fprintf(stderr, "cannot create %s\n", dir.c_str());
+        return 2;
+    }
+    const int edge = std::atoi(opt["--image"].c_str());
+
+    FILE *out = opt["--out"] == "-" ? stdout : std::fopen(opt["--out"].c_str(), "w");
+    if (!out)
+    {
+        std::fprintf(stderr, "cannot open %s\n", opt["--out"].c_str());
+        return 2;
+    }
+
+    const char *isa[] = {"scalar", "ssse3", "avx2"};
+    std::fprintf(out, "{\n  \"vips\": \"%s\",\n  \"hardware_concurrency\": %u,\n  \"simd\": \"%s\",\n",
+                 vips_version_string(), std::thread::hardware_concurrency(), isa[static_cast<int>(simd_level())]);
+    std::fprintf(out, "  \"image\": %d,\n  \"steps\": %s,\n  \"episode\": %s,\n  \"cache_bytes\": %s,\n  \"prefetch_depth\": %s,\n  \"seed\": %s,\n  \"num_procs\": %s,\n  \"record\": %s,\n  \"augment\": %s,\n  \"results\": [",
+                 edge, opt["--steps"].c_str(), opt["--episode"].c_str(), opt["--cache"].c_str(), opt["--prefetch"].c_str(), opt["--seed"].c_str(), opt["--procs"].c_str(),
+                 opt["--record"].c_str(), opt["--augment"].c_str());
+
+    bool first = true;
+    for (const std::string &layout : split(opt["--layout"]))
+    {
+        for (const int bands : split_int(opt["--bands"]))
+        {
+            for (const int nfiles : split_int(opt["--files"]))
+            {
+                std::vector<std::string> files;
+                for (int f = 0; f < nfiles; ++f)
+                {
+                    files.push_back(synthetic_tiff(dir, layout, bands, edge, f));
+                }
+                for (const int view : split_int(opt["--view"]))
+                {
+                    for (const int num_env : split_int(opt["--num-env"]))
+                    {
+                        for (const int threads : split_int(opt["--threads"]))
+                        {
+                            for (const std::string &wait : split(opt["--wait"]))
+                            {
+                                for (const std::string &mode : split(opt["--mode"]))
+                                {
+                                    const Config c = {layout, bands, nfiles, view, num_env, threads, wait, mode};
+                                    const Result r = layout == "gvt" ? run<TiledEnv>(c, files, opt) : run<VipsEnv>(c, files, opt);
+                                    std::fprintf(stderr, "%-8s bands %d files %3d view %4d envs %4d threads %3d wait %-8s mode %-5s: %10.0f steps/s, step p50 %8.1fus p99 %8.1fus, reset p50 %8.1fus p99 %8.1fus\n",
+                                                 layout.c_str(), bands, nfiles, view, num_env, threads, wait.c_str(), mode.c_str(), r.steps_per_sec, r.step_p50, r.step_p99, r.reset_p50, r.reset_p99);
+                                    std::fprintf(out, "%s\n    {\"layout\": \"%s\", \"bands\": %d, \"files\": %d, \"view\": %d, \"num_env\": %d, \"threads\": %d, \"wait\": \"%s\", \"mode\": \"%s\", "
+                                                      "\"seconds\": %.6f, \"steps\": %zu, \"resets\": %zu, \"steps_per_sec\": %.1f, "
+                                                      "\"step_p50_us\": %.2f, \"step_p99_us\": %.2f, \"reset_p50_us\": %.2f, \"reset_p99_us\": %.2f}",
+                                                 first ? "" : ",", layout.c_str(), bands, nfiles, view, num_env, threads, wait.c_str(), mode.c_str(),
+                                                 r.seconds, r.steps, r.resets, r.steps_per_sec, r.step_p50, r.step_p99, r.reset_p50, r.reset_p99);
+                                    first = false;
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    std::fprintf(out, "\n  ]\n}\n");
+    if (out != stdout)
+    {
+        std::fclose(out);
+    }
+
+    vips_shutdown();
+    return 0;
+}
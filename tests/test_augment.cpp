@@ -0,0 +1,237 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "augment.h"
+
+static int errors = 0;
+
+/**
+ * @brief Count a failed check.
+ */
+static void expect(const bool ok, const std::string &what)
+{
+    if (!ok)
+    {
+        std::printf("FAILED: %s\n", what.c_str());
+        errors += 1;
+    }
+}
+
+/**
+ * @brief Interleaved H x W source with `bands` bands, every value different from its neighbours.
+ */
+static std::vector<uint8_t> source(const int H, const int W, const int bands)
+{
+    std::vector<uint8_t> src(static_cast<std::size_t>(H) * W * bands);
+    for (std::size_t k = 0; k < src.size(); ++k)
+    {
+        src[k] = static_cast<uint8_t>(k * 37 + k / 255);
+    }
+    return src;
+}
+
+/**
+ * @brief Planar (C, H, W) uint8 result of `aug`, pixel by pixel as Augment documents it.
+ */
+static std::vector<uint8_t> reference(const std::vector<uint8_t> &src, const int H, const int W, const int bands, const int C, const Augment &aug)
+{
+    std::vector<uint8_t> out(static_cast<std::size_t>(C) * H * W);
+    for (int y = 0; y < H; ++y)
+    {
+        for (int x = 0; x < W; ++x)
+        {
+            int a = aug.transpose ? x : y, b = aug.transpose ? y : x;
+            a = aug.flip_y ? H - 1 - a : a;
+            b = aug.flip_x ? W - 1 - b : b;
+            for (int c = 0; c < C; ++c)
+            {
+                uint8_t v = src[(static_cast<std::size_t>(y) * W + x) * bands + std::min(c, bands - 1)];
+                if (aug.jitter)
+                {
+                    v = Augment::jitter_value(v, aug.gain[c], aug.bias[c]);
+                }
+                out[(static_cast<std::size_t>(c) * H + a) * W + b] = v;
+            }
+        }
+    }
+    return out;
+}
+
+/**
+ * @brief Copy `src` through AugmentCopy the way the envs do: rows deinterleaved in two runs, then written.
+ */
+static std::vector<uint8_t> augmented(const std::vector<uint8_t> &src, const int H, const int W, const int bands, const int C, const Augment &aug,
+                                      const SimdLevel level, const convert_fn convert, const std::vector<float> &scale, const std::vector<float> &shift)
+{
+    const std::size_t itemsize = convert ? sizeof(float) : 1;
+    std::vector<uint8_t> out(static_cast<std::size_t>(C) * H * W * itemsize);
+    AugmentCopy copy;
+    copy.init(C, W, level);
+    const deinterleave_fn copy_row = select_deinterleave(bands, C, level);
+    const int split = W / 3;
+    for (int y = 0; y < H; ++y)
+    {
+        uint8_t *stage = copy.stage(aug, y, C, W);
+        for (const int x : {0, split})
+        {
+            const int n = x == 0 ? split : W - split;
+            const uint8_t *row = src.data() + (static_cast<std::size_t>(y) * W + x) * bands;
+            if (copy_row)
+            {
+                copy_row(row, stage + x, W, n);
+            }
+            else
+            {
+                deinterleave_generic(row, stage + x, W, n, bands, C);
+            }
+        }
+        copy.write(aug, y, out.data(), C, H, W, itemsize, convert, scale.data(), shift.data());
+    }
+    return out;
+}
+
+/**
+ * @brief Whether float output `out` is `ref` converted by x * scale[c] + shift[c].
+ */
+static bool converted(const std::vector<uint8_t> &out, const std::vector<uint8_t> &ref, const int C, const std::vector<float> &scale, const std::vector<float> &shift)
+{
+    const std::size_t plane = ref.size() / C;
+    for (std::size_t k = 0; k < ref.size(); ++k)
+    {
+        float v;
+        std::memcpy(&v, out.data() + k * sizeof(float), sizeof(v));
+        const float want = ref[k] * scale[k / plane] + shift[k / plane];
+        if (std::fabs(v - want) > 1e-5f * std::max(1.0f, std::fabs(want)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Planar (C, N, N) image `img` rotated clockwise by `k` quarter turns.
+ */
+static std::vector<uint8_t> rotated(std::vector<uint8_t> img, const int C, const int N, const int k)
+{
+    for (int t = 0; t < k; ++t)
+    {
+        std::vector<uint8_t> r(img.size());
+        for (int c = 0; c < C; ++c)
+        {
+            for (int y = 0; y < N; ++y)
+            {
+                for (int x = 0; x < N; ++x)
+                {
+                    r[(static_cast<std::size_t>(c) * N + y) * N + x] = img[(static_cast<std::size_t>(c) * N + N - 1 - x) * N + y];
+                }
+            }
+        }
+        img.swap(r);
+    }
+    return img;
+}
+
+/**
+ * @brief Checks AugmentCopy against a naive per-pixel reference.
+ *
+ * Covers 1 to 4 source bands into 1, 3 and 4 channels, all 8 symmetries of
+ * the square, no, shared and per-channel jitter, uint8 and float32 output
+ * and every kernel level the CPU runs. Rotations drawn by Augment::draw()
+ * must be the quarter turns of the naive rotation.
+ *
+ * @return 0 if every check passed.
+ */
+int main(void)
+{
+    std::vector<SimdLevel> levels = {SimdLevel::SCALAR};
+    if (simd_level() != SimdLevel::SCALAR)
+    {
+        levels.push_back(SimdLevel::SSSE3);
+    }
+    if (simd_level() == SimdLevel::AVX2)
+    {
+        levels.push_back(SimdLevel::AVX2);
+    }
+
+    // 70: full SIMD blocks plus tails and a partial transpose block; 20 x 75 is not square
+    const int shapes[][2] = {{70, 70}, {20, 75}};
+    Rng rng(1);
+    for (const SimdLevel level : levels)
+    {
+        const std::string lvl = "level " + std::to_string(static_cast<int>(level));
+        for (const auto &shape : shapes)
+        {
+            const int H = shape[0], W = shape[1];
+            for (int bands = 1; bands <= 4; ++bands)
+            {
+                const std::vector<uint8_t> src = source(H, W, bands);
+                for (const int C : {1, 3, 4})
+                {
+                    std::vector<float> scale, shift;
+                    for (int c = 0; c < C; ++c)
+                    {
+                        scale.push_back(1.0f / (255.0f * 0.2f * (c + 1)));
+                        shift.push_back(-0.5f * c);
+                    }
+                    for (int jitter = 0; jitter < 3; ++jitter)
+                    {
+                        AugmentSpec spec;
+                        spec.brightness = jitter ? 0.5f : 0.0f;
+                        spec.contrast = jitter ? 1.0f : 0.0f;
+                        spec.per_channel = jitter == 2;
+                        Augment aug;
+                        aug.draw(spec, rng, C);
+                        for (int sym = 0; sym < 8; ++sym)
+                        {
+                            aug.transpose = sym & 4;
+                            aug.flip_x = sym & 1;
+                            aug.flip_y = sym & 2;
+                            if (aug.transpose && H != W)
+                            {
+                                continue;
+                            }
+                            const std::string what = lvl + ", " + std::to_string(H) + "x" + std::to_string(W) + ", " + std::to_string(bands) +
+                                                     " bands into " + std::to_string(C) + ", jitter " + std::to_string(jitter) + ", symmetry " + std::to_string(sym);
+                            const std::vector<uint8_t> ref = reference(src, H, W, bands, C, aug);
+                            expect(augmented(src, H, W, bands, C, aug, level, nullptr, scale, shift) == ref, what + ", uint8");
+                            expect(converted(augmented(src, H, W, bands, C, aug, level, select_convert(ObsDtype::FLOAT32, level), scale, shift), ref, C, scale, shift),
+                                   what + ", float32");
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // the draws of rot90 are exactly the three quarter turns
+    {
+        const int N = 70, C = 3;
+        const std::vector<uint8_t> src = source(N, N, C);
+        const std::vector<uint8_t> plain = reference(src, N, N, C, C, Augment());
+        AugmentSpec spec;
+        spec.rot90 = 1.0f;
+        bool seen[4] = {false, false, false, false};
+        for (int draw = 0; draw < 64; ++draw)
+        {
+            Augment aug;
+            aug.draw(spec, rng, C);
+            const std::vector<uint8_t> out = augmented(src, N, N, C, C, aug, simd_level(), nullptr, {}, {});
+            int turns = 0;
+            for (int k = 1; k <= 3 && !turns; ++k)
+            {
+                turns = out == rotated(plain, C, N, k) ? k : 0;
+            }
+            expect(turns != 0, "draw " + std::to_string(draw) + " is a quarter turn");
+            seen[turns] = true;
+        }
+        expect(seen[1] && seen[2] && seen[3], "every quarter turn drawn");
+    }
+
+    std::printf("%s\n", errors ? "FAILED" : "passed");
+    return errors ? 1 : 0;
+}
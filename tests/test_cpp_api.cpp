@@ -21,9 +21,8 @@ int main(int argc, char **argv)
 
     // Initialize parameters for environment pool
     init_t i;
-    i.classes = {0, 1};
     std::string f_name(argv[1]);
-    i.files = {f_name, f_name};
+    i.dataset = Dataset::from_lists({f_name, f_name}, {0, 1});
     i.view_sz = std::make_pair(256, 256);
     i.num_env = num_env;
     i.max_episode_len = 100;
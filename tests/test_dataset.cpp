@@ -0,0 +1,168 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "dataset.h"
+
+static int errors = 0;
+
+/**
+ * @brief Count a failed check.
+ */
+static void expect(const bool ok, const std::string &what)
+{
+    if (!ok)
+    {
+        std::printf("FAILED: %s\n", what.c_str());
+        errors += 1;
+    }
+}
+
+/**
+ * @brief Whether `f` throws std::runtime_error.
+ */
+template <typename F>
+static bool throws(F f)
+{
+    try
+    {
+        f();
+    }
+    catch (const std::runtime_error &)
+    {
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Read file `path` into memory.
+ */
+static std::vector<char> slurp(const std::string &path)
+{
+    std::vector<char> buf;
+    FILE *f = std::fopen(path.c_str(), "rb");
+    char chunk[4096];
+    for (std::size_t n; (n = std::fread(chunk, 1, sizeof(chunk), f)) > 0;)
+    {
+        buf.insert(buf.end(), chunk, chunk + n);
+    }
+    std::fclose(f);
+    return buf;
+}
+
+/**
+ * @brief Write the first `n` bytes of `buf` to file `path`.
+ */
+static void spit(const std::string &path, const std::vector<char> &buf, const std::size_t n)
+{
+    FILE *f = std::fopen(path.c_str(), "wb");
+    if (n > 0)
+    {
+        std::fwrite(buf.data(), 1, n, f);
+    }
+    std::fclose(f);
+}
+
+/**
+ * @brief Round trip of a dataset manifest, and rejection of truncated and corrupt ones.
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv Optional scratch directory (default /tmp).
+ * @return 0 if every check passed.
+ */
+int main(int argc, char **argv)
+{
+    const std::string dir = argc > 1 ? argv[1] : "/tmp";
+    const std::string manifest = dir + "/test_dataset.gvds", broken = dir + "/test_dataset_broken.gvds";
+
+    std::vector<std::string> files;
+    std::vector<int> classes;
+    std::vector<std::pair<int, int>> dims;
+    for (int i = 0; i < 1000; ++i)
+    {
+        files.push_back("/data/slide_" + std::to_string(i) + std::string(i % 7, 'x') + ".tif");
+        classes.push_back(i % 5);
+        dims.emplace_back(1000 + i, 2000 + i);
+    }
+    Dataset::write(manifest, files, classes, dims);
+
+    {
+        std::shared_ptr<const Dataset> d = Dataset::open(manifest);
+        expect(d->size() == files.size(), "size");
+        for (std::size_t i = 0; i < files.size(); ++i)
+        {
+            if (d->path(i) != files[i] || d->cls(i) != classes[i] || d->dims(i) != dims[i])
+            {
+                expect(false, "entry " + std::to_string(i));
+                break;
+            }
+        }
+        std::shared_ptr<const Dataset> m = Dataset::from_lists(files, classes);
+        expect(m->size() == files.size() && m->path(999) == files[999] && m->dims(3) == std::make_pair(0, 0), "from_lists");
+    }
+
+    const std::vector<char> good = slurp(manifest);
+    const std::size_t entries = sizeof(Dataset::Header), strings = entries + files.size() * sizeof(Dataset::Entry);
+
+    // truncated: inside the header, the entry table and the string table
+    for (const std::size_t n : {std::size_t(0), sizeof(Dataset::Header) - 1, strings - 5, good.size() - 1})
+    {
+        spit(broken, good, n);
+        expect(throws([&]
+                      { Dataset::open(broken); }),
+               "truncated to " + std::to_string(n) + " bytes");
+    }
+
+    // header counts chosen to wrap the size arithmetic
+    for (const int field : {0, 1})
+    {
+        std::vector<char> bad = good;
+        Dataset::Header h;
+        std::memcpy(&h, bad.data(), sizeof(h));
+        (field == 0 ? h.count : h.strings_bytes) = ~uint64_t(0) - 8;
+        std::memcpy(bad.data(), &h, sizeof(h));
+        spit(broken, bad, bad.size());
+        expect(throws([&]
+                      { Dataset::open(broken); }),
+               field == 0 ? "huge count" : "huge strings_bytes");
+    }
+    {
+        std::vector<char> bad = good;
+        std::memcpy(bad.data(), "XXXX", 4);
+        spit(broken, bad, bad.size());
+        expect(throws([&]
+                      { Dataset::open(broken); }),
+               "bad magic");
+    }
+
+    // corrupt entries open fine (nothing but the header is read) and throw from path()
+    {
+        std::vector<char> bad = good;
+        Dataset::Entry e;
+        std::memcpy(&e, bad.data() + entries + 10 * sizeof(e), sizeof(e));
+        e.offset = ~uint64_t(0) - 2; // offset + length wraps
+        std::memcpy(bad.data() + entries + 10 * sizeof(e), &e, sizeof(e));
+        std::memcpy(&e, bad.data() + entries + 20 * sizeof(e), sizeof(e));
+        e.length += 1; // ends on the next path's first byte, not on a NUL
+        std::memcpy(bad.data() + entries + 20 * sizeof(e), &e, sizeof(e));
+        spit(broken, bad, bad.size());
+
+        std::shared_ptr<const Dataset> d = Dataset::open(broken);
+        expect(d->path(9) == files[9] && d->path(21) == files[21], "intact entries of a corrupt manifest");
+        expect(throws([&]
+                      { d->path(10); }),
+               "wrapping offset");
+        expect(throws([&]
+                      { d->path(20); }),
+               "missing NUL");
+    }
+
+    unlink(manifest.c_str());
+    unlink(broken.c_str());
+    std::printf("%s\n", errors ? "FAILED" : "passed");
+    return errors ? 1 : 0;
+}
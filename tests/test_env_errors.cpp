@@ -0,0 +1,153 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "envpool.h"
+#include "syncpool.h"
+#include "vipsenv.h"
+
+/**
+ * @brief Env without images whose step throws for action level 99.
+ */
+struct ThrowingEnv
+{
+    uint8_t *obs;
+    int timestep = 0;
+
+    ThrowingEnv(const init_t &, uint8_t *obs_slot) : obs(obs_slot) {}
+
+    static std::size_t obs_size(const init_t &)
+    {
+        return 16;
+    }
+
+    void bind(uint8_t *obs_slot)
+    {
+        obs = obs_slot;
+    }
+
+    void seed(const uint64_t, const int) {}
+
+    bool is_done(void)
+    {
+        return timestep >= 100;
+    }
+
+    data_t reset()
+    {
+        timestep = 0;
+        return data_t();
+    }
+
+    data_t step(action_t action)
+    {
+        if (action.level == 99)
+        {
+            throw std::runtime_error("step failed");
+        }
+        timestep += 1;
+        std::memset(obs, timestep, 16);
+        data_t d;
+        d.info.timestep = timestep;
+        return d;
+    }
+};
+
+/**
+ * @brief Whether envs sent to `pool` are not received yet.
+ */
+template <class env_t>
+static bool in_flight(const EnvPool<env_t, action_t, data_t, init_t> &pool)
+{
+    return pool.pending_ > 0;
+}
+
+template <class env_t>
+static bool in_flight(const SyncEnvPool<env_t, action_t, data_t, init_t> &pool)
+{
+    return !pool.pending_.empty();
+}
+
+/**
+ * @brief Send one failing action among `num_env`, and check recv() rethrows it
+ * once and the pool keeps working, with the failed env reset by its next action.
+ *
+ * @return Number of failed checks.
+ */
+template <class pool_t>
+static int check(const char *name, init_t i)
+{
+    pool_t pool(i);
+    pool.reset();
+    std::vector<data_t> data;
+    while (in_flight(pool))
+    {
+        pool.recv(data);
+    }
+
+    std::vector<action_t> action(i.num_env);
+    action[i.num_env / 2].level = 99;
+    pool.send(action);
+    int caught = 0, received = 0;
+    while (in_flight(pool))
+    {
+        try
+        {
+            pool.recv(data);
+            received += static_cast<int>(data.size());
+        }
+        catch (const std::runtime_error &e)
+        {
+            caught += std::string(e.what()) == "step failed";
+        }
+    }
+
+    action[i.num_env / 2].level = 0;
+    pool.send(action);
+    int reset = 0, stepped = 0;
+    while (in_flight(pool))
+    {
+        pool.recv(data);
+        for (const data_t &d : data)
+        {
+            reset += d.env_id == i.num_env / 2 && d.info.timestep == 0;
+            stepped += d.env_id != i.num_env / 2 && d.info.timestep == 2;
+        }
+    }
+
+    const int errors = (caught != 1) + (reset != 1) + (stepped != i.num_env - 1);
+    if (errors)
+    {
+        std::printf("%s: caught %d (received %d), then %d reset and %d stepped\n", name, caught, received, reset, stepped);
+    }
+    return errors;
+}
+
+/**
+ * @brief Checks that an exception of an env step reaches recv() in every pool mode.
+ *
+ * @return 0 if every check passed.
+ */
+int main(void)
+{
+    typedef EnvPool<ThrowingEnv, action_t, data_t, init_t> pool_t;
+    typedef SyncEnvPool<ThrowingEnv, action_t, data_t, init_t> sync_t;
+
+    init_t i;
+    i.num_env = 8;
+    i.num_threads = 3;
+    i.seed = 1;
+
+    int errors = check<pool_t>("EnvPool", i);
+    errors += check<sync_t>("SyncEnvPool", i);
+    i.batch_size = 3;
+    errors += check<pool_t>("EnvPool (batch_size 3)", i);
+    i.batch_size = 0;
+    i.num_procs = 2;
+    errors += check<pool_t>("EnvPool (2 shard processes)", i);
+
+    std::printf("%s\n", errors ? "FAILED" : "passed");
+    return errors ? 1 : 0;
+}
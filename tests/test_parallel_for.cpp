@@ -0,0 +1,51 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "threadpool.h"
+
+/**
+ * @brief Stress test of ParallelFor: alternate tiny and large calls and check every index runs exactly once.
+ *
+ * A helper that is still leaving call g-1 when call g starts must not claim
+ * indices of call g with its stale cursor; a double claim shows up here as a
+ * count of 2, and the double-decremented completion count as a run() that
+ * returns before every index ran (a count of 0).
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv Optional number of rounds.
+ * @return 0 if every call ran each index exactly once.
+ */
+int main(int argc, char **argv)
+{
+    const int rounds = argc > 1 ? std::atoi(argv[1]) : 200000;
+    const int n = 256;
+    int errors = 0;
+    for (const WaitPolicy wait : {WaitPolicy::SPIN, WaitPolicy::ADAPTIVE, WaitPolicy::BLOCK})
+    {
+        ParallelFor team(4, Affinity::NONE, {}, wait);
+        std::vector<std::atomic<int>> count(n);
+        for (int r = 0; r < rounds && errors < 10; ++r)
+        {
+            const int size = r % 2 == 0 ? 1 : n;
+            for (int k = 0; k < size; ++k)
+            {
+                count[k].store(0);
+            }
+            team.run(size, [&count](const int k)
+                     { count[k].fetch_add(1); });
+            for (int k = 0; k < size; ++k)
+            {
+                if (count[k].load() != 1)
+                {
+                    std::printf("wait %d round %d: index %d of %d ran %d times\n", static_cast<int>(wait), r, k, size, count[k].load());
+                    errors += 1;
+                    break;
+                }
+            }
+        }
+    }
+    std::printf("%s\n", errors ? "FAILED" : "passed");
+    return errors ? 1 : 0;
+}
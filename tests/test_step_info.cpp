@@ -0,0 +1,106 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "envpool.h"
+#include "syncpool.h"
+#include "vipsenv.h"
+#include "tiledenv.h"
+
+/**
+ * @brief Write a small gradient image to `path` and return the path.
+ */
+static std::string synthetic_tiff(const std::string &path, const int edge)
+{
+    std::vector<uint8_t> px(static_cast<std::size_t>(edge) * edge * 3);
+    for (std::size_t k = 0; k < px.size(); ++k)
+    {
+        px[k] = static_cast<uint8_t>(k * 7);
+    }
+    VImage image = VImage::new_from_memory(px.data(), px.size(), edge, edge, 3, VIPS_FORMAT_UCHAR);
+    image.write_to_file(path.c_str(), VImage::option()->set("tile", true)->set("pyramid", true));
+    return path;
+}
+
+/**
+ * @brief Check the timestep and target arrays of every batch across a reset and several steps.
+ *
+ * Episodes are max_episode_len = 3 steps long, so the envs go through an
+ * automatic reset too: round r after the reset must report timestep r % 4,
+ * and every step the class of the image the env is looking at.
+ *
+ * @return Number of mismatches.
+ */
+template <class pool_t>
+static int check(const char *name, const std::vector<std::string> &files)
+{
+    const std::vector<int> classes = {3, 7};
+    init_t i;
+    i.dataset = Dataset::from_lists(files, classes);
+    i.view_sz = std::make_pair(32, 32);
+    i.num_env = 4;
+    i.num_threads = 2;
+    i.max_episode_len = 3;
+    i.seed = 1;
+
+    pool_t pool(i);
+    pool.reset();
+    std::vector<data_t> data;
+    int errors = 0;
+    for (int round = 0; round < 9; ++round)
+    {
+        if (round > 0)
+        {
+            pool.send(std::vector<action_t>(i.num_env));
+        }
+        pool.recv(data);
+        const StepArrays &arrays = pool.batch_arrays();
+        for (std::size_t k = 0; k < data.size(); ++k)
+        {
+            const int target = classes[data[k].info.index];
+            if (arrays.timestep[k] != round % 4 || arrays.target[k] != target)
+            {
+                std::printf("%s: round %d env %d: timestep %d target %d, expected %d %d\n", name, round, arrays.env_id[k],
+                            arrays.timestep[k], arrays.target[k], round % 4, target);
+                errors += 1;
+            }
+        }
+    }
+    return errors;
+}
+
+/**
+ * @brief Runs the step info checks on VipsEnv and TiledEnv, in EnvPool and SyncEnvPool.
+ *
+ * @return 0 if every check passed.
+ */
+int main(int argc, char **argv)
+{
+    if (VIPS_INIT(argv[0]))
+        vips_error_exit(NULL);
+
+    const std::string dir = argc > 1 ? argv[1] : "/tmp";
+    const std::vector<std::string> tiffs = {synthetic_tiff(dir + "/step_info_0.tif", 256), synthetic_tiff(dir + "/step_info_1.tif", 256)};
+    std::vector<std::string> gvts;
+    for (std::size_t k = 0; k < tiffs.size(); ++k)
+    {
+        gvts.push_back(dir + "/step_info_" + std::to_string(k) + ".gvt");
+        TiledEnv::convert(tiffs[k], gvts.back(), 64, 2);
+    }
+
+    int errors = 0;
+    errors += check<EnvPool<VipsEnv, action_t, data_t, init_t>>("EnvPool<VipsEnv>", tiffs);
+    errors += check<SyncEnvPool<VipsEnv, action_t, data_t, init_t>>("SyncEnvPool<VipsEnv>", tiffs);
+    errors += check<EnvPool<TiledEnv, action_t, data_t, init_t>>("EnvPool<TiledEnv>", gvts);
+    errors += check<SyncEnvPool<TiledEnv, action_t, data_t, init_t>>("SyncEnvPool<TiledEnv>", gvts);
+    std::printf("%s (%d mismatches)\n", errors ? "FAILED" : "passed", errors);
+
+    for (std::size_t k = 0; k < tiffs.size(); ++k)
+    {
+        unlink(tiffs[k].c_str());
+        unlink(gvts[k].c_str());
+    }
+    vips_shutdown();
+    return errors ? 1 : 0;
+}
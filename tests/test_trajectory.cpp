@@ -0,0 +1,202 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdexcept>
+#include <unistd.h>
+
+#include "trajectory.h"
+
+static int errors = 0;
+
+/**
+ * @brief Count a failed check.
+ */
+static void expect(const bool ok, const std::string &what)
+{
+    if (!ok)
+    {
+        std::printf("FAILED: %s\n", what.c_str());
+        errors += 1;
+    }
+}
+
+/**
+ * @brief The record step `seq` of env `env` writes; every field depends on both.
+ */
+static TrajectoryRecord record_of(const uint32_t env, const uint32_t seq)
+{
+    TrajectoryRecord r;
+    r.env = env;
+    r.seq = seq;
+    r.index = static_cast<int32_t>((env + seq) % 3);
+    r.timestep = static_cast<int32_t>(seq % 10);
+    r.level = static_cast<int32_t>(seq % 2);
+    r.left = static_cast<int32_t>(env * 7 + seq);
+    r.top = static_cast<int32_t>(seq * 3);
+    r.action[0] = 0.25f * static_cast<float>(seq % 5);
+    r.action[1] = -0.5f;
+    r.reward = static_cast<float>(env) + 0.001f * static_cast<float>(seq);
+    r.done = seq % 10 == 9;
+    r.truncated = 0;
+    r.reset = seq % 10 == 0;
+    return r;
+}
+
+/**
+ * @brief Whether a record read back is the one record_of() wrote.
+ */
+static bool intact(const TrajectoryRecord &r)
+{
+    const TrajectoryRecord expected = record_of(r.env, r.seq);
+    return std::memcmp(&r, &expected, sizeof(r)) == 0;
+}
+
+/**
+ * @brief Append `steps` records for each of `num_env` envs from `num_threads` threads.
+ *
+ * Halfway through, every env moves to another thread, as envs do between the
+ * workers of a pool, so an env's records end up in chunks of several threads.
+ */
+static void record(const std::string &path, const TrajectoryMeta &meta, const bool compress, const int num_threads, const uint32_t steps)
+{
+    TrajectoryWriter writer(path, meta, compress, 64);
+    for (int phase = 0; phase < 2; ++phase)
+    {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_threads; ++t)
+        {
+            threads.emplace_back([&, t, phase]
+                                 {
+                for (uint32_t seq = phase * steps / 2; seq < (phase + 1) * steps / 2; ++seq)
+                {
+                    for (int env = 0; env < meta.num_env; ++env)
+                    {
+                        if ((env + phase) % num_threads == t)
+                        {
+                            writer.append(record_of(static_cast<uint32_t>(env), seq));
+                        }
+                    }
+                } });
+        }
+        for (std::thread &t : threads)
+        {
+            t.join();
+        }
+    }
+}
+
+/**
+ * @brief Copy `src` without its last `cut` bytes to `dst`.
+ */
+static void truncate_copy(const std::string &src, const std::string &dst, const long cut)
+{
+    FILE *f = std::fopen(src.c_str(), "rb");
+    std::vector<char> buf;
+    char chunk[4096];
+    for (std::size_t n; (n = std::fread(chunk, 1, sizeof(chunk), f)) > 0;)
+    {
+        buf.insert(buf.end(), chunk, chunk + n);
+    }
+    std::fclose(f);
+    f = std::fopen(dst.c_str(), "wb");
+    std::fwrite(buf.data(), 1, buf.size() - static_cast<std::size_t>(cut), f);
+    std::fclose(f);
+}
+
+/**
+ * @brief Check every env of `t` holds intact records in seq order, all of them if `complete`.
+ */
+static void check_envs(const Trajectory &t, const uint32_t steps, const bool complete, const std::string &what)
+{
+    for (int env = 0; env < t.num_env(); ++env)
+    {
+        const std::vector<uint32_t> &e = t.env(env);
+        bool ok = !complete || e.size() == steps;
+        for (std::size_t k = 0; ok && k < e.size(); ++k)
+        {
+            const TrajectoryRecord &r = t.records()[e[k]];
+            ok = intact(r) && static_cast<int>(r.env) == env && (k == 0 || r.seq > t.records()[e[k - 1]].seq);
+            ok = ok && (!complete || r.seq == k);
+        }
+        expect(ok, what + ": env " + std::to_string(env));
+    }
+}
+
+/**
+ * @brief Round trip of TrajectoryWriter and Trajectory::open.
+ *
+ * Covers appends from several threads, compressed and uncompressed chunks,
+ * the header, seq ordering per env, truncated files and a corrupt chunk.
+ *
+ * @param argc Number of command-line arguments.
+ * @param argv Optional scratch directory (default /tmp).
+ * @return 0 if every check passed.
+ */
+int main(int argc, char **argv)
+{
+    const std::string dir = argc > 1 ? argv[1] : "/tmp";
+    const std::string path = dir + "/test_trajectory.gvtj", cut = dir + "/test_trajectory_cut.gvtj";
+    const uint32_t steps = 1000;
+
+    TrajectoryMeta meta;
+    meta.view_h = 32;
+    meta.view_w = 48;
+    meta.channels = 3;
+    meta.num_levels = 2;
+    meta.num_env = 6;
+    meta.files = {"/data/a.tif", "/data/b.gvt", ""};
+    meta.classes = {4, -1, 7};
+
+    for (const bool compress : {false, true})
+    {
+        const std::string mode = compress ? "compressed" : "uncompressed";
+        record(path, meta, compress, 3, steps);
+
+        std::shared_ptr<const Trajectory> t = Trajectory::open(path);
+        const TrajectoryMeta &m = t->meta();
+        expect(m.view_h == 32 && m.view_w == 48 && m.channels == 3 && m.num_levels == 2 && m.num_env == 6 &&
+                   m.files == meta.files && m.classes == meta.classes,
+               mode + ": header");
+        expect(t->records().size() == steps * meta.num_env, mode + ": record count");
+        check_envs(*t, steps, true, mode);
+
+        // cut inside the last chunk: every complete chunk is still read
+        truncate_copy(path, cut, 10);
+        t = Trajectory::open(cut);
+        expect(t->records().size() < steps * meta.num_env && t->records().size() >= steps * meta.num_env - 64, mode + ": truncated last chunk");
+        check_envs(*t, steps, false, mode + " (truncated)");
+
+        // cut inside the header
+        FILE *f = std::fopen(path.c_str(), "rb");
+        std::fseek(f, 0, SEEK_END);
+        const long size = std::ftell(f);
+        std::fclose(f);
+        truncate_copy(path, cut, size - 50);
+        bool threw = false;
+        try
+        {
+            Trajectory::open(cut);
+        }
+        catch (const std::runtime_error &)
+        {
+            threw = true;
+        }
+        expect(threw, mode + ": truncated header");
+
+        // a chunk whose stored size does not match its records ends the recording there
+        const long first_chunk = 4 * trajectory_format::header_words + 3 * 8 + 11 + 11;
+        f = std::fopen(path.c_str(), "r+b");
+        std::fseek(f, first_chunk + 4, SEEK_SET);
+        const uint32_t bogus = 3;
+        std::fwrite(&bogus, sizeof(bogus), 1, f);
+        std::fclose(f);
+        expect(Trajectory::open(path)->records().empty(), mode + ": corrupt first chunk");
+    }
+
+    unlink(path.c_str());
+    unlink(cut.c_str());
+    std::printf("%s\n", errors ? "FAILED" : "passed");
+    return errors ? 1 : 0;
+}
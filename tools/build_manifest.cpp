@@ -0,0 +1,91 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+
+#include "vipsenv.h"
+
+/**
+ * @brief Build a dataset manifest (see dataset.h) from a text listing.
+ *
+ * Each input line is `path<TAB>class`; blank lines and lines starting with '#'
+ * are skipped. Unless --no-probe is given, every file's header is read to
+ * record its dimensions.
+ *
+ * Usage: ./build_manifest [--no-probe] <listing.tsv> <manifest.gvds>
+ */
+int main(int argc, char **argv)
+{
+    if (VIPS_INIT(argv[0]))
+        vips_error_exit(NULL);
+
+    bool probe = true;
+    std::vector<std::string> args;
+    for (int a = 1; a < argc; ++a)
+    {
+        if (std::string(argv[a]) == "--no-probe")
+            probe = false;
+        else
+            args.push_back(argv[a]);
+    }
+    if (args.size() != 2)
+    {
+        std::fprintf(stderr, "usage: %s [--no-probe] <listing.tsv> <manifest.gvds>\n", argv[0]);
+        return 2;
+    }
+
+    std::ifstream in(args[0]);
+    if (!in)
+    {
+        std::fprintf(stderr, "cannot open %s\n", args[0].c_str());
+        return 2;
+    }
+
+    std::vector<std::string> files;
+    std::vector<int> classes;
+    std::vector<std::pair<int, int>> dims;
+    std::string line;
+    for (std::size_t n = 1; std::getline(in, line); ++n)
+    {
+        if (line.empty() || line[0] == '#')
+            continue;
+        const std::size_t tab = line.rfind('\t');
+        if (tab == std::string::npos)
+        {
+            std::fprintf(stderr, "%s:%zu: expected path<TAB>class\n", args[0].c_str(), n);
+            return 1;
+        }
+        files.push_back(line.substr(0, tab));
+        classes.push_back(std::atoi(line.c_str() + tab + 1));
+        if (probe)
+        {
+            try
+            {
+                dims.push_back(VipsEnv::probe(files.back()));
+            }
+            catch (const std::exception &e)
+            {
+                std::fprintf(stderr, "%s: %s\n", files.back().c_str(), e.what());
+                return 1;
+            }
+        }
+        if (files.size() % 100000 == 0)
+            std::fprintf(stderr, "%zu files\n", files.size());
+    }
+
+    try
+    {
+        Dataset::write(args[1], files, classes, dims);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    std::fprintf(stderr, "wrote %zu files to %s\n", files.size(), args[1].c_str());
+
+    vips_shutdown();
+    return 0;
+}
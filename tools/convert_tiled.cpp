@@ -0,0 +1,124 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "tiledenv.h"
+
+/**
+ * @brief Convert every file of a dataset manifest (see dataset.h) into the
+ * pre-tiled format read by TiledEnv (see tiledimage.h).
+ *
+ * File i is written to <out_dir>/<i>.gvt, and <out_dir>/dataset.gvds indexes
+ * the converted files with the classes of the input manifest, ready to be
+ * passed to a pool with the tiled backend. Existing .gvt files are skipped
+ * unless --force is given, so an interrupted run can be resumed.
+ *
+ * Usage: ./convert_tiled [--tile 256] [--levels 1] [--threads 0] [--force] <manifest.gvds> <out_dir>
+ */
+int main(int argc, char **argv)
+{
+    if (VIPS_INIT(argv[0]))
+        vips_error_exit(NULL);
+
+    int tile = 256, levels = 1, threads = 0;
+    bool force = false;
+    std::vector<std::string> args;
+    for (int a = 1; a < argc; ++a)
+    {
+        const std::string arg = argv[a];
+        if (arg == "--force")
+            force = true;
+        else if ((arg == "--tile" || arg == "--levels" || arg == "--threads") && a + 1 < argc)
+            (arg == "--tile" ? tile : arg == "--levels" ? levels : threads) = std::atoi(argv[++a]);
+        else
+            args.push_back(arg);
+    }
+    if (args.size() != 2 || tile <= 0 || levels <= 0)
+    {
+        std::fprintf(stderr, "usage: %s [--tile 256] [--levels 1] [--threads 0] [--force] <manifest.gvds> <out_dir>\n", argv[0]);
+        return 2;
+    }
+
+    std::shared_ptr<const Dataset> dataset;
+    try
+    {
+        dataset = Dataset::open(args[0]);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    const std::string dir = args[1];
+    if (std::system(("mkdir -p '" + dir + "'").c_str()) != 0)
+    {
+        std::fprintf(stderr, "cannot create %s\n", dir.c_str());
+        return 2;
+    }
+
+    const std::size_t n = dataset->size();
+    std::vector<std::string> files(n);
+    std::vector<int> classes(n);
+    std::vector<std::pair<int, int>> dims(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        files[i] = dir + "/" + std::to_string(i) + ".gvt";
+        classes[i] = dataset->cls(i);
+        dims[i] = dataset->dims(i);
+    }
+
+    std::atomic<std::size_t> next(0), done(0);
+    std::atomic<bool> failed(false);
+    const auto work = [&]()
+    {
+        for (std::size_t i = next++; i < n && !failed; i = next++)
+        {
+            try
+            {
+                FILE *f = force ? nullptr : std::fopen(files[i].c_str(), "rb");
+                if (f)
+                {
+                    std::fclose(f);
+                }
+                else
+                {
+                    TiledEnv::convert(dataset->path(i), files[i], tile, levels);
+                }
+                const std::shared_ptr<const TiledImage> t = TiledImage::open(files[i]); // also validates skipped files
+                dims[i] = std::make_pair(t->width(), t->height());
+            }
+            catch (const std::exception &e)
+            {
+                std::fprintf(stderr, "%s: %s\n", dataset->path(i), e.what());
+                failed = true;
+            }
+            if (++done % 1000 == 0)
+                std::fprintf(stderr, "%zu / %zu files\n", done.load(), n);
+        }
+    };
+    const unsigned num = threads > 0 ? static_cast<unsigned>(threads) : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < num; ++t)
+        pool.emplace_back(work);
+    for (std::thread &t : pool)
+        t.join();
+    if (failed)
+        return 1;
+
+    try
+    {
+        Dataset::write(dir + "/dataset.gvds", files, classes, dims);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    std::fprintf(stderr, "converted %zu files into %s\n", n, dir.c_str());
+
+    vips_shutdown();
+    return 0;
+}